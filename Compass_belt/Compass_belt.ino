@@ -1,9 +1,12 @@
 #include <Wire.h> //I2C Arduino Library
+#include <EEPROM.h> //where the magnetometer types and calibration are kept
+#include "fixtrig.h" //integer atan2/sin/cos, angles in brads
+#include "sector.h" //heading-to-motor table
+#include "magnetometer.h" //HMC5883L/QMC5883L reads and the heading from them
+#include "motors.h" //all the motors in one write per port
+#include "softpwm.h" //and at any intensity, from a timer interrupt
+#include "onset.h" //with a kick to get them going
 
-#define addr 0x1E //7-bit I2C Address for The HMC5883L
-#define configurationRegisterA B01110100  //8-sample average, 30Hz readout, normal configuration
-#define configurationRegisterB B00100000 // Default gain
-#define modeRegister B00000000 // Continous mode
 const int calibrationInterruptPin = 2;
 const int Npin = 13; //5
 const int NEpin = 12;
@@ -13,14 +16,23 @@ const int Spin = 4;
 const int SWpin = 5;
 const int Wpin = 6;
 const int NWpin = 7;
-const int pinArray[] = {Npin, NEpin, Epin, SEpin, Spin, SWpin, Wpin, NWpin};
+constexpr int pinArray[] = {Npin, NEpin, Epin, SEpin, Spin, SWpin, Wpin, NWpin};
 const int numberOfPins = sizeof(pinArray)/sizeof(int);
-const float degreesPerPin = 360/(float)numberOfPins;
-const float radiansPerPin = 2*PI/numberOfPins;
-int x,y,z; //triple axis data
-const float declinationAngle = 0.05; // about +2.75E for Oslo, in radians
-float heading = 0;
-float headingDegrees = 0;
+//The same pins, as port bits worked out at compile time
+typedef MotorPins<pinArray[0], pinArray[1], pinArray[2], pinArray[3],
+                  pinArray[4], pinArray[5], pinArray[6], pinArray[7]> Motors;
+static_assert(Motors::N == numberOfPins, "a motor for each pin in pinArray");
+typedef SoftPwm<Motors> Pwm; //16 intensities, 250 Hz
+typedef Onset<Pwm> Drive; //full on for a moment when a motor goes up
+const uint8_t motorLevel = 12; //of Pwm::LEVELS; the rest is room for the kick
+#define LOG_ONSET 0 //1 to print each change of motor drive, for sim/
+const unsigned long motorPeriod = 500; //ms between motor updates
+unsigned long lastMotorTime = 0;
+int x,y,z; //triple axis data, from the first magnetometer
+const brad_t declinationAngle = 522; // about +2.75E for Oslo (0.05 radians)
+brad_t heading = 0;
+int headingDegrees = 0;
+int pinIndex = 0; //motor that is on
 
 volatile int calibrationMatrix[4][3] = {
                               {0, 0, 0}, //N: {x,y,z}
@@ -41,26 +53,24 @@ unsigned long last_button_time = 0;
 int i, j;
 int test = 0;
 
+ISR(TIMER2_COMPA_vect){
+  Pwm::tick();
+}
+
 void turnOffAllPins(){
-    for (int i = 0; i < numberOfPins; i++){                  
-      digitalWrite(pinArray[i], LOW);  
-    }
+    Drive::all(0);
 }
 
 void turnOnAllPins(){
-    for (int i = 0; i < numberOfPins; i++){                  
-      digitalWrite(pinArray[i], HIGH);  
-    }
+    Drive::all(Pwm::LEVELS);
 }
 
-int headingToIndex(float heading){
-  heading += radiansPerPin/2; //rotate to get clean breaks
-  if (heading >= 2*PI) {
-    return 0; //
-  }
-  else {
-    return (int)round(heading/radiansPerPin);
-  }
+//Motor for each heading, built at compile time. 364 brads (2 degrees) of
+//hysteresis keeps two motors from taking turns on the line between them.
+typedef SectorMap<numberOfPins, 364> MotorMap;
+
+int headingToIndex(brad_t heading, int prevIndex){
+  return MotorMap::lookup(heading, prevIndex);
 }
 
 
@@ -78,6 +88,8 @@ void calibrate(){
       calibrationMatrix[calMatrixRowPointer][0] = x;
       calibrationMatrix[calMatrixRowPointer][1] = y;
       calibrationMatrix[calMatrixRowPointer][2] = z;
+      //and every magnetometer's own calibration
+      magCalPoint(calMatrixRowPointer);
       //increment the row "pointer"
       calMatrixRowPointer++;
       last_button_time = button_time;
@@ -94,35 +106,17 @@ void calibrate(){
           //print average coordinates to serial
           printAverages();
           
-          N_cal = {calibrationMatrix[0][0]-avg_X,
-                  calibrationMatrix[0][1]-avg_Y,
-                  calibrationMatrix[0][2]-avg_Z};
+          N_cal[0] = calibrationMatrix[0][0]-avg_X;
+          N_cal[1] = calibrationMatrix[0][1]-avg_Y;
+          N_cal[2] = calibrationMatrix[0][2]-avg_Z;
 
-          E_cal = {calibrationMatrix[1][0]-avg_X,
-                  calibrationMatrix[2][1]-avg_Y,
-                  calibrationMatrix[3][2]-avg_Z};
+          E_cal[0] = calibrationMatrix[1][0]-avg_X;
+          E_cal[1] = calibrationMatrix[1][1]-avg_Y;
+          E_cal[2] = calibrationMatrix[1][2]-avg_Z;
         }
     }
 }
 
-void getCompassData(){
-
-  Wire.beginTransmission(addr);
-  Wire.write(0x03); //start with register 3.
-  Wire.endTransmission();
- 
- //Read the data, 2 bytes for each axis, 6 total bytes
-  Wire.requestFrom(addr, 6);
-  if (6<=Wire.available()) {
-    x = Wire.read()<<8; //MSB  x 
-    x |= Wire.read(); //LSB  x
-    z = Wire.read()<<8; //MSB  z
-    z |= Wire.read(); //LSB z
-    y = Wire.read()<<8; //MSB y
-    y |= Wire.read(); //LSB y
-  }
-}
-
 void printCalibrationMatrix(){
   //Prints currnet calibration matrix to serial
   for (i=0; i<4; i++){
@@ -174,47 +168,79 @@ void setup() {
     
   Serial.begin(115200);
 
+  //From here on the motors are driven by the PWM interrupt
+  Pwm::begin();
+
   //turn on all motors momentarly to get feedback at reset/power up
   turnOnAllPins();
   delay(500);
 
-  //Start talking to the magnetometer
-  Wire.begin();
-  Wire.beginTransmission(addr); //start talking
-  Wire.write(0x00); // Set the start register (0)
-  //Write to configuration and mode registers
-  Wire.write(configurationRegisterA); 
-  Wire.write(configurationRegisterB);
-  Wire.write(modeRegister);
-  Wire.endTransmission();
+  //Start talking to the magnetometers
+  magBegin();
+  for (uint8_t k = 0; k < MAG_COUNT; k++){
+    char chip = magChip(k);
+    if (chip == 'H'){
+      Serial.println("HMC5883L");
+    } else if (chip == 'Q'){
+      Serial.println("QMC5883L");
+    } else {
+      Serial.println("No magnetometer found");
+    }
+  }
   
   Serial.println("Start");
 }
 
 void loop() {
 
-  getCompassData();
+  //Take every sample the sensors make (30 or 50 per second, depending on
+  //the chip), whenever they make it; the motors are updated on their own schedule below.
+  if (magPoll() == 0){
+    magSample(0, &x, &y, &z);
+  }
+
+  //End the motor kicks on time, rather than at the next motor update
+  Drive::update();
+#if LOG_ONSET
+  Drive::Event e;
+  while (Drive::next(&e)){
+    Serial.print("onset ");
+    Serial.print(e.ms);
+    Serial.print(" ");
+    Serial.print(e.motor);
+    Serial.print(" ");
+    Serial.print(e.drive);
+    Serial.print(" ");
+    Serial.println(e.hold);
+  }
+#endif
+
+  if (millis() - lastMotorTime < motorPeriod){
+    return;
+  }
+  lastMotorTime = millis();
   
-  //heading = atan2(y, x); //Y-axis of magnetometer is pointing up
+  //Every magnetometer that isn't being disturbed. With none to go by, all
+  //the motors go off rather than point the wrong way.
+  if (!magHeading(&heading)){
+    turnOffAllPins();
+    return;
+  }
   
-  //Correct for declination and calibration
+  //Correct for declination and calibration. brad_t wraps around by
+  //itself, so there is no need to check for <0 or >360 degrees.
   //heading -= calibration + declinationAngle;
-  
-  // Correct for when signs are reversed.
-  //if(heading < 0)
-    //heading += 2*PI;
-    
-  // Check for wrap due to addition of declination and calibration.
-  //if(heading > 2*PI)
-    //heading -= 2*PI;
    
-  // Convert radians to degrees for readability.
-  //headingDegrees = heading * 180/PI; 
+  // Convert brads to degrees for readability.
+  headingDegrees = ((unsigned long)heading*360) >> 16;
 
-  //Make sure all motors ar off before turning on a new one
-  turnOffAllPins();
-  
-  //int pinIndex = headingToIndex(heading);
+  //The heading felt between the two motors either side of it, all in the
+  //same write, so there is no moment with none on
+  Drive::bearing(heading, motorLevel);
+  //or, to have only the nearest motor on (nothing changes if it's the same
+  //motor as last time):
+  //pinIndex = headingToIndex(heading, pinIndex);
+  //Drive::one(pinIndex, motorLevel);
  
   //Serial.print("x: ");
   //Serial.print(x);
@@ -230,6 +256,5 @@ void loop() {
   //Serial.print(pinIndex);
   //Serial.print("\t");
   //Serial.println(headingDegrees);
-  delay(500);
   
 }
@@ -29,38 +29,48 @@ int averageCoordinate(volatile int (*calArray)[3], int idx){
    * *ptr is a decayed pointer to the calibrationMatrix array
    * idx is the index for the coordinate to average x=0, y=1, z=2
   */
-  int n, e, s, w;
-  float avg;
-  int row_idx = 0;
-  n = calArray[0][idx];
-  e = calArray[1][idx];
-  s = calArray[2][idx];
-  w = calArray[3][idx];
+  long sum = (long)calArray[0][idx] + calArray[1][idx] +
+             calArray[2][idx] + calArray[3][idx];
 
-  avg = round((n+e+s+w)/(float)4);
-  return (int)avg;
+  //divide by 4, rounding halves away from zero like round() did
+  if (sum < 0){
+    return -((-sum + 2) >> 2);
+  }
+  return (sum + 2) >> 2;
   }
 
-float findPhi_z(int x, int y){
-  float phi = -atan(-(float)x/(float)y);
-  if (x*sin(phi) + y*cos(phi) < 0){
-    phi += PI;  
+/*
+ * The findPhi functions return the angle (in brads, see fixtrig.h) to turn
+ * by about one axis. Each takes atan() of the ratio of the two other
+ * coordinates, then uses the sign test to pick between that angle and
+ * the one opposite.
+ */
+brad_t findPhi_z(int x, int y){
+  int s, c;
+  brad_t phi = iAtan(x, y);
+  iSinCos(phi, &s, &c);
+  if ((long)x*s + (long)y*c < 0){
+    phi += BRAD_HALF;
   }
   return phi;
 }
 
-float findPhi_x(int z, int y){
-  float phi = -atan(-(float)z/(float)y);
-  if (y*cos(phi) - z*sin(phi) < 0){
-    phi += PI;  
+brad_t findPhi_x(int z, int y){
+  int s, c;
+  brad_t phi = iAtan(z, y);
+  iSinCos(phi, &s, &c);
+  if ((long)y*c - (long)z*s < 0){
+    phi += BRAD_HALF;
   }
   return phi;
 }
 
-float findPhi_y(int z, int x){
-  float phi = -atan(-(float)z/(float)x);
-  if (x*cos(phi) + z*sin(phi) > 0){
-    phi += PI;  
+brad_t findPhi_y(int z, int x){
+  int s, c;
+  brad_t phi = iAtan(z, x);
+  iSinCos(phi, &s, &c);
+  if ((long)x*c + (long)z*s > 0){
+    phi += BRAD_HALF;
   }
   return phi;
 }
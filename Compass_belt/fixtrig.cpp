@@ -0,0 +1,133 @@
+#include <avr/pgmspace.h>
+#include "fixtrig.h"
+
+/*
+ * Both functions use CORDIC: a vector is turned towards (or away from) the
+ * x axis by a fixed series of steps, each by atan(2^-i), which needs only
+ * shifts and adds. The steps are tabulated here in brads.
+ */
+#define CORDIC_STEPS 15
+static const int16_t cordicAngle[CORDIC_STEPS] PROGMEM = {
+  8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1, 1
+};
+
+//Length of the starting vector for iSinCos(): TRIG_ONE divided by the
+//stretch the CORDIC steps add (1.6468), so the result comes out at TRIG_ONE
+#define CORDIC_X0 9949
+
+brad_t iAtan2(long y, long x){
+  /*
+   * Turns {x,y} onto the positive x axis and adds up how far it turned.
+   * The point is first scaled so its larger coordinate is 4096 to 8191:
+   * big enough that the shifts keep 12 bits or more, small enough that
+   * the rest can be done in 16 bits (the vector grows by 1.65 on the way).
+   */
+  brad_t phi = 0;
+  int16_t xx, yy, tmp;
+  long m;
+
+  if (x == 0 && y == 0){
+    return 0;
+  }
+  if (x < 0){ //steps cover +/-99 degrees, so start in the right half-plane
+    x = -x;
+    y = -y;
+    phi = BRAD_HALF;
+  }
+  m = x | (y < 0 ? -y : y);
+  while (m >= 8192){
+    m >>= 1;
+    x >>= 1;
+    y >>= 1;
+  }
+  while (m < 4096){
+    m <<= 1;
+    x <<= 1;
+    y <<= 1;
+  }
+  xx = x;
+  yy = y;
+
+  for (int i = 0; i < CORDIC_STEPS; i++){
+    int16_t step = pgm_read_word(&cordicAngle[i]);
+    if (yy > 0){
+      tmp = xx + (yy >> i);
+      yy -= xx >> i;
+      xx = tmp;
+      phi += step;
+    }
+    else {
+      tmp = xx - (yy >> i);
+      yy += xx >> i;
+      xx = tmp;
+      phi -= step;
+    }
+  }
+  return phi;
+}
+
+brad_t iAtan(int num, int den){
+  //atan() only returns the right half-plane: flip the point there first
+  if (den < 0){
+    return iAtan2(-(long)num, -(long)den);
+  }
+  if (den == 0){ //float atan(+/-inf)
+    return num < 0 ? -BRAD_QUARTER : BRAD_QUARTER;
+  }
+  return iAtan2(num, den);
+}
+
+void iSinCos(brad_t angle, int *s, int *c){
+  /*
+   * Starts with a vector along the x axis and turns it through the angle;
+   * its coordinates are then the cosine and the sine.
+   */
+  int16_t x = CORDIC_X0, y = 0, tmp;
+  int16_t z;
+  bool flip = false;
+
+  //Steps cover +/-99 degrees: turn the back half of the circle round
+  if (angle > BRAD_QUARTER && angle < BRAD_HALF + BRAD_QUARTER){
+    angle += BRAD_HALF;
+    flip = true;
+  }
+  z = (int16_t)angle; //now between -90 and +90 degrees
+
+  for (int i = 0; i < CORDIC_STEPS; i++){
+    int16_t step = pgm_read_word(&cordicAngle[i]);
+    if (z >= 0){
+      tmp = x - (y >> i);
+      y += x >> i;
+      x = tmp;
+      z -= step;
+    }
+    else {
+      tmp = x + (y >> i);
+      y -= x >> i;
+      x = tmp;
+      z += step;
+    }
+  }
+  *s = flip ? -y : y;
+  *c = flip ? -x : x;
+}
+
+uint16_t iSqrt(uint32_t v){
+  //One result bit per step, from the top: no division and no multiply
+  uint32_t r = 0, bit = 1UL << 30;
+
+  while (bit > v){
+    bit >>= 2;
+  }
+  while (bit){
+    if (v >= r + bit){
+      v -= r + bit;
+      r = (r >> 1) + bit;
+    }
+    else {
+      r >>= 1;
+    }
+    bit >>= 2;
+  }
+  return r;
+}
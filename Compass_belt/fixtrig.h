@@ -0,0 +1,33 @@
+#ifndef FIXTRIG_H
+#define FIXTRIG_H
+
+#include <stdint.h>
+
+/*
+ * Integer trigonometry for the belt, so the sketch needs no floating point
+ * (the ATmega has no FPU, and the soft-float atan/sin/cos pull in several
+ * KB of flash and take thousands of cycles each).
+ *
+ * Angles are binary radians ("brads"): a full circle is 65536, so an angle
+ * fits a uint16_t and wraps around by itself with no "if (heading > 2*PI)"
+ * checks. Sines and cosines are scaled so that TRIG_ONE is 1.0.
+ */
+typedef uint16_t brad_t;
+
+#define BRAD_HALF 32768U    // 180 degrees
+#define BRAD_QUARTER 16384U // 90 degrees
+#define TRIG_ONE 16384      // 1.0 for iSinCos()
+
+//Angle of the point {x,y} from the positive x axis (like atan2(y, x))
+brad_t iAtan2(long y, long x);
+
+//atan(num/den), between -90 and +90 degrees (like atan((float)num/den))
+brad_t iAtan(int num, int den);
+
+//Sine and cosine of an angle, both at once, scaled by TRIG_ONE
+void iSinCos(brad_t angle, int *s, int *c);
+
+//Square root, rounded down (like (uint16_t)sqrt(v))
+uint16_t iSqrt(uint32_t v);
+
+#endif
@@ -0,0 +1,314 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <EEPROM.h>
+#include <util/atomic.h>
+#include "mag5883.h"
+#include "magnetometer.h"
+
+static_assert(MAG_COUNT >= 1 && MAG_COUNT <= 8, "the mux has eight channels");
+
+//DRDY only works for a single sensor (see magnetometer.h)
+#define MAG_USE_DRDY (MAG_DRDY_PIN >= 0 && MAG_COUNT == 1)
+
+#define MAG_CAL_VALID 0xA6 //erased EEPROM is 0xFF
+
+typedef mag5883::Mag<mag5883::Hmc5883l, MAG_HMC_GAIN> Hmc;
+typedef mag5883::Mag<mag5883::Qmc5883l, MAG_QMC_RANGE> Qmc;
+
+//One sensor's calibration, as kept in EEPROM
+struct MagCal {
+  uint8_t valid; //MAG_CAL_VALID once the sensor has been calibrated
+  int centre[3]; //the middle of its readings, taken off every sample
+  int north[3]; //which way the field points, facing north, TRIG_ONE long
+  int east[3]; //...and facing east
+  uint16_t field; //strength of the Earth's field, in half counts
+  int16_t dip; //angle of the field out of the sensor's x-y plane
+};
+
+static_assert(MAG_CAL_EEPROM_ADDR >= MAG_EEPROM_ADDR + MAG_COUNT,
+              "the calibration would overwrite the chip bytes");
+
+static mag5883::Driver mag[MAG_COUNT];
+static MagCal cal[MAG_COUNT];
+static int sample[MAG_COUNT][3]; //latest from each
+static uint8_t seen = 0; //bit k is set once sensor k has been read
+static int calPoint[4][MAG_COUNT][3]; //samples at N, E, S and W
+                                      //(written from an interrupt)
+static volatile bool calTaken = false; //all four points are in
+
+#if MAG_COUNT > 1
+
+static const uint8_t channel[] = MAG_CHANNELS;
+static_assert(sizeof(channel) >= MAG_COUNT, "a mux channel for each sensor");
+
+static uint8_t selected = 0xFF; //mux channel that's on
+
+//Connect sensor k to the bus, if it isn't already
+static bool muxSelect(uint8_t k){
+  if (channel[k] == selected){
+    return true;
+  }
+  Wire.beginTransmission(MAG_MUX_ADDR);
+  Wire.write(1 << channel[k]);
+  if (Wire.endTransmission() != 0){
+    selected = 0xFF;
+    return false;
+  }
+  selected = channel[k];
+  return true;
+}
+
+#else
+
+static bool muxSelect(uint8_t){
+  return true;
+}
+
+#endif
+
+#if MAG_USE_DRDY
+
+static volatile bool fresh = false;
+
+static void onDrdy(){
+  fresh = true;
+}
+
+#else
+
+static uint32_t due[MAG_COUNT]; //micros() when each sensor is next read
+static uint8_t next = 0; //sensor to try first
+
+#endif
+
+//A sample less the sensor's centre, halved so that the squares of all
+//three add up in 32 bits even with the QMC5883L's 16-bit readings
+static void centred(const int *s, const int *centre, long *d){
+  for (uint8_t a = 0; a < 3; a++){
+    d[a] = ((long)s[a] - centre[a]) >> 1;
+  }
+}
+
+static uint16_t strength(const long *d){
+  return iSqrt((uint32_t)(d[0]*d[0]) + (uint32_t)(d[1]*d[1]) +
+               (uint32_t)(d[2]*d[2]));
+}
+
+static int16_t dip(const long *d){
+  return (int16_t)iAtan2(d[2], iSqrt((uint32_t)(d[0]*d[0]) +
+                                     (uint32_t)(d[1]*d[1])));
+}
+
+//The direction from point b to point a, scaled to TRIG_ONE long. Returns
+//false if they're the same point.
+static bool axis(const int *a, const int *b, int *v){
+  long d[3];
+  uint16_t len;
+
+  centred(a, b, d);
+  if (!(len = strength(d))){
+    return false;
+  }
+  for (uint8_t i = 0; i < 3; i++){
+    v[i] = d[i] * TRIG_ONE / len;
+  }
+  return true;
+}
+
+//A centred sample's component along a calibration axis, in centred
+//counts times TRIG_ONE (which can't overflow: it's at most the sample's
+//strength times TRIG_ONE)
+static long along(const long *d, const int *v){
+  return d[0] * v[0] + d[1] * v[1] + d[2] * v[2];
+}
+
+//True if the field a sensor sees isn't the one it saw when calibrated
+static bool interfered(const long *d, const MagCal &c){
+  uint32_t f = strength(d), tol = (uint32_t)c.field * MAG_FIELD_TOL >> 8;
+  long turn = (long)dip(d) - c.dip;
+
+  return f > c.field + tol || f + tol < c.field ||
+         turn > MAG_DIP_TOL || turn < -MAG_DIP_TOL;
+}
+
+//Work out each sensor's calibration from the four points, and save it
+static void calFinish(){
+  for (uint8_t k = 0; k < MAG_COUNT; k++){
+    MagCal c;
+    long d[3], sum;
+    uint32_t field = 0;
+    long dips = 0;
+
+    //A sample's heading is the angle of the field from where it pointed
+    //with the belt facing north, towards where it pointed facing east. The
+    //axes go from S to N and from W to E, so the offsets and the field's
+    //dip cancel out, and the E point gives which way round that is however
+    //the sensor is mounted.
+    if (!(seen & 1 << k) || !axis(calPoint[0][k], calPoint[2][k], c.north) ||
+        !axis(calPoint[1][k], calPoint[3][k], c.east)){
+      continue;
+    }
+    c.valid = MAG_CAL_VALID;
+    for (uint8_t a = 0; a < 3; a++){
+      sum = (long)calPoint[0][k][a] + calPoint[1][k][a] +
+            calPoint[2][k][a] + calPoint[3][k][a];
+      //divide by 4, rounding halves away from zero
+      c.centre[a] = sum < 0 ? -((-sum + 2) >> 2) : (sum + 2) >> 2;
+    }
+    for (uint8_t n = 0; n < 4; n++){
+      centred(calPoint[n][k], c.centre, d);
+      field += strength(d);
+      dips += dip(d);
+    }
+    c.field = field / 4;
+    c.dip = dips / 4;
+
+    cal[k] = c;
+    EEPROM.put(MAG_CAL_EEPROM_ADDR + k * sizeof(MagCal), c);
+  }
+}
+
+static bool readSensor(uint8_t k){
+  int s[3];
+
+  if (!muxSelect(k) || !mag[k].read(&s[0], &s[1], &s[2])){
+    return false;
+  }
+  //magCalPoint() copies sample from an interrupt, so it must never see
+  //one half written
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    memcpy(sample[k], s, sizeof(s));
+    seen |= 1 << k;
+  }
+  return true;
+}
+
+uint8_t magBegin(){
+  uint8_t found = 0;
+
+  Wire.begin();
+  Wire.setClock(400000); //all three chips can; a sample then takes ~0.2 ms
+  for (uint8_t k = 0; k < MAG_COUNT; k++){
+    muxSelect(k); //if there is no mux, nothing answers and k isn't found
+    mag[k] = mag5883::begin<Hmc, Qmc>(MAG_EEPROM_ADDR + k);
+    if (mag[k].chip != mag5883::NONE){
+      found++;
+    }
+    EEPROM.get(MAG_CAL_EEPROM_ADDR + k * sizeof(MagCal), cal[k]);
+    if (cal[k].valid != MAG_CAL_VALID){
+      cal[k] = MagCal(); //no centre, and nothing is interference
+      cal[k].north[0] = cal[k].east[1] = TRIG_ONE; //the sensor's x and y
+    }
+  }
+  if (!found){
+    return 0;
+  }
+
+#if MAG_USE_DRDY
+  pinMode(MAG_DRDY_PIN, INPUT); //both chips drive the pin themselves
+  attachInterrupt(digitalPinToInterrupt(MAG_DRDY_PIN), onDrdy, mag[0].drdyMode);
+#else
+  uint32_t now = micros();
+  for (uint8_t k = 0; k < MAG_COUNT; k++){
+    due[k] = now + mag[k].periodUs * k / MAG_COUNT;
+  }
+#endif
+  return found;
+}
+
+char magChip(uint8_t k){
+  return k < MAG_COUNT && mag[k].chip != mag5883::NONE ? mag[k].chip : 0;
+}
+
+int8_t magPoll(){
+  if (calTaken){
+    calTaken = false;
+    calFinish();
+  }
+
+#if MAG_USE_DRDY
+  if (!fresh){
+    return -1;
+  }
+  fresh = false; //before the read, so a sample arriving during it counts
+  if (!readSensor(0)){
+    //the QMC5883L holds DRDY high until its data is read, so no new edge
+    //will come; try again on the next call
+    fresh = true;
+    return -1;
+  }
+  return 0;
+#else
+  uint32_t now = micros();
+
+  for (uint8_t i = 0; i < MAG_COUNT; i++){
+    uint8_t k = (next + i) % MAG_COUNT;
+
+    if (mag[k].chip == mag5883::NONE || (int32_t)(now - due[k]) < 0){
+      continue;
+    }
+    due[k] += mag[k].periodUs;
+    if ((int32_t)(now - due[k]) >= 0){ //fell behind; don't catch up
+      due[k] = now + mag[k].periodUs;
+    }
+    next = (k + 1) % MAG_COUNT;
+    return readSensor(k) ? k : -1;
+  }
+  return -1;
+#endif
+}
+
+bool magSample(uint8_t k, int *x, int *y, int *z){
+  if (k >= MAG_COUNT || !(seen & 1 << k)){
+    return false;
+  }
+  *x = sample[k][0];
+  *y = sample[k][1];
+  *z = sample[k][2];
+  return true;
+}
+
+void magCalPoint(uint8_t n){
+  if (n > 3){
+    return;
+  }
+  memcpy(calPoint[n], sample, sizeof(sample));
+  if (n == 3){
+    calTaken = true;
+  }
+}
+
+bool magHeading(brad_t *heading){
+  long sx = 0, sy = 0, d[3];
+  uint8_t used = 0, use = 0;
+  int s, c;
+
+  //An uncalibrated sensor's heading is off by its offsets and by however
+  //it faces on the belt, so it only counts when no calibrated one is read
+  for (uint8_t k = 0; k < MAG_COUNT; k++){
+    if (cal[k].valid == MAG_CAL_VALID){
+      use |= 1 << k;
+    }
+  }
+  use = use & seen ? use & seen : seen;
+
+  for (uint8_t k = 0; k < MAG_COUNT; k++){
+    if (!(use & 1 << k)){
+      continue;
+    }
+    centred(sample[k], cal[k].centre, d);
+    if (cal[k].valid == MAG_CAL_VALID && interfered(d, cal[k])){
+      continue;
+    }
+    //Unit vectors, so each sensor that's left counts the same
+    iSinCos(iAtan2(along(d, cal[k].east), along(d, cal[k].north)), &s, &c);
+    sx += c;
+    sy += s;
+    used++;
+  }
+  if (!used){
+    return false;
+  }
+  *heading = iAtan2(sy, sx);
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef MAGNETOMETER_H
+#define MAGNETOMETER_H
+
+#include <stdint.h>
+#include "fixtrig.h"
+
+/*
+ * Magnetometer acquisition for the belt, on top of the HMC5883L/QMC5883L
+ * driver in mag5883.h: one GY-273 or MAG_COUNT of them around the belt.
+ *
+ * magBegin() finds out which chip each GY-273 has (probing only the first
+ * time; the answers are kept in EEPROM from MAG_EEPROM_ADDR on) and sets
+ * it up so that every sample is a single read: one bus transaction, as both
+ * chips roll the register pointer back to the start of the data by
+ * themselves.
+ *
+ * With one sensor, whether there is a new sample is taken from the chip's
+ * DRDY pin, wired to MAG_DRDY_PIN (2 and 3 are the ones with interrupts on
+ * the Uno and Nano, and 2 is the calibration button). With it not wired,
+ * set MAG_DRDY_PIN to -1: samples are then read once per output period of
+ * the chip, timed by micros().
+ *
+ * Several sensors all answer at the same address, so they go behind a
+ * TCA9548A multiplexer at MAG_MUX_ADDR, sensor k on channel MAG_CHANNELS[k].
+ * They all run continuously, so their conversions overlap, and they are
+ * read on the timed schedule, spread evenly over the output period: sensor
+ * k is read k/MAG_COUNT of a period after sensor 0. (DRDY isn't used; the
+ * pins would need one interrupt each.)
+ *
+ * Either way, magPoll() reads at most one sensor, and only when it has a
+ * sample that hasn't been read yet, so loop() can call it as often as it
+ * likes. A pass never costs more than one read however many sensors there
+ * are, and no sample is more than one output period and one read old when
+ * it is used.
+ *
+ * magHeading() puts the sensors' latest samples together into one heading.
+ * Each sensor has its own calibration (magCalPoint(), below): the centre of
+ * its readings, which way it faces on the belt, and the strength and dip of
+ * the Earth's field as it saw it. A sensor whose field is now more than
+ * MAG_FIELD_TOL stronger or weaker than that, or dips more than
+ * MAG_DIP_TOL differently (a magnet or a lump of steel nearby, or the
+ * sensor tipped over), is left out. So are the sensors that haven't been
+ * calibrated, as long as one that has is being read; only when none is
+ * are the uncalibrated ones used, as they are.
+ */
+
+#define MAG_COUNT 1 //GY-273s on the belt
+#define MAG_MUX_ADDR 0x70 //TCA9548A, when MAG_COUNT > 1
+#define MAG_CHANNELS {0, 1, 2, 3, 4, 5, 6, 7} //mux channel of each sensor
+#define MAG_DRDY_PIN 3 //DRDY, or -1 if not wired; one sensor only
+#define MAG_EEPROM_ADDR 0 //MAG_COUNT bytes: which chip each is
+#define MAG_CAL_EEPROM_ADDR 8 //each sensor's calibration, after the chips
+#define MAG_HMC_GAIN 1 //HMC5883L gain code: +/-1.3 Ga
+#define MAG_QMC_RANGE 0 //QMC5883L range code: +/-2 G
+#define MAG_FIELD_TOL 51 //256ths of the calibrated field strength (20%)
+#define MAG_DIP_TOL 1820 //brads of dip angle (10 degrees)
+
+//Find the magnetometers and set them up. Returns how many were found.
+uint8_t magBegin();
+
+//The chip sensor k has ('H' for the HMC5883L, 'Q' for the QMC5883L), or 0
+//if there is none
+char magChip(uint8_t k);
+
+//Read the next sensor with a new sample, if there is one. Returns the
+//sensor read, or -1 if none was (nothing new, or the read failed).
+int8_t magPoll();
+
+//The latest sample from sensor k. Returns false, leaving x, y and z alone,
+//if it hasn't been read yet.
+bool magSample(uint8_t k, int *x, int *y, int *z);
+
+//Take each sensor's latest sample as calibration point n: 0 to 3 with the
+//belt facing north, east, south and west in turn. After point 3 the
+//calibration is worked out and saved to EEPROM by the next magPoll().
+//Short enough for an interrupt handler.
+void magCalPoint(uint8_t n);
+
+//The heading from all the sensors that look trustworthy (see above).
+//Returns false, leaving heading alone, if none do.
+bool magHeading(brad_t *heading);
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef MOTORS_H
+#define MOTORS_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+/*
+ * Motor output straight to the port registers, worked out by the compiler.
+ *
+ * MotorPins<P0, P1, ...> drives the motors on Arduino pins P0, P1, ... (Uno
+ * and Nano numbering: 0-7 are PORTD, 8-13 PORTB and 14-19, A0-A5, PORTC). A
+ * frame is a bit pattern with bit i for the motor on Pi, and show() sets
+ * every motor from it: one read-modify-write of each port there are motors
+ * on, all with interrupts off, so the motors change together and an
+ * interrupt handler's change to the other pins of a port can't be lost.
+ * A frame that is the one already shown isn't written at all.
+ *
+ * Which port and bit each pin is are constexpr, so a frame comes down to a
+ * bit test and an OR of a constant per motor, and the ports with no motors
+ * on them are left out altogether. (digitalWrite() looks the pin up in
+ * three tables in flash on every call.) ports() and write() are the two
+ * halves of show(), for code that works the port bits out ahead of time,
+ * such as the PWM engine in softpwm.h.
+ */
+
+namespace motor_detail {
+
+enum Port : uint8_t { PORT_B, PORT_C, PORT_D, PORT_NONE };
+
+constexpr uint8_t portOf(uint8_t pin){
+  return pin < 8 ? PORT_D : pin < 14 ? PORT_B : pin < 20 ? PORT_C : PORT_NONE;
+}
+
+constexpr uint8_t maskOf(uint8_t pin){
+  return 1 << (pin < 8 ? pin : pin < 14 ? pin - 8 : pin - 14);
+}
+
+//The bits of PORT for the motors I on (pins P...) that are on in a frame;
+//used is all the bits of PORT there are motors on
+template <uint8_t PORT, uint8_t I, uint8_t... P> struct Bits;
+
+template <uint8_t PORT, uint8_t I> struct Bits<PORT, I> {
+  enum : uint8_t { used = 0 };
+  static uint8_t of(uint8_t){
+    return 0;
+  }
+};
+
+template <uint8_t PORT, uint8_t I, uint8_t P0, uint8_t... P>
+struct Bits<PORT, I, P0, P...> {
+  enum : uint8_t {
+    used = (portOf(P0) == PORT ? maskOf(P0) : 0) | Bits<PORT, I + 1, P...>::used
+  };
+  static uint8_t of(uint8_t frame){
+    return (portOf(P0) == PORT && (frame & 1 << I) ? maskOf(P0) : 0) |
+           Bits<PORT, I + 1, P...>::of(frame);
+  }
+};
+
+constexpr bool valid(){
+  return true;
+}
+
+template <class... T> constexpr bool valid(uint8_t pin, T... rest){
+  return portOf(pin) != PORT_NONE && valid(rest...);
+}
+
+//Set the motor pins of one port, leaving its other pins alone
+template <uint8_t USED> inline void put(volatile uint8_t &port, uint8_t on){
+  if (USED){
+    port = (port & ~USED) | on;
+  }
+}
+
+}
+
+template <uint8_t... P>
+class MotorPins {
+  static_assert(sizeof...(P) >= 1 && sizeof...(P) <= 8, "a frame is one byte");
+  static_assert(motor_detail::valid(P...), "not a pin of PORTB, C or D");
+
+  template <uint8_t PORT> struct Port : motor_detail::Bits<PORT, 0, P...> {};
+
+  static uint16_t shown; //the frame on the pins, or 0x100 before the first
+
+public:
+  static const uint8_t N = sizeof...(P);
+  static const uint8_t ALL = (1 << N) - 1; //every motor on
+
+  //A frame as the bits of each port
+  struct Ports {
+    uint8_t b, c, d;
+  };
+
+  static Ports ports(uint8_t frame){
+    Ports p = { Port<motor_detail::PORT_B>::of(frame),
+                Port<motor_detail::PORT_C>::of(frame),
+                Port<motor_detail::PORT_D>::of(frame) };
+    return p;
+  }
+
+  //Set the motor pins to p. Interrupts have to be off (as they are in an
+  //interrupt handler).
+  static void write(const Ports &p){
+    motor_detail::put<Port<motor_detail::PORT_B>::used>(PORTB, p.b);
+    motor_detail::put<Port<motor_detail::PORT_C>::used>(PORTC, p.c);
+    motor_detail::put<Port<motor_detail::PORT_D>::used>(PORTD, p.d);
+  }
+
+  //Turn on the motors whose bits are set in frame and the rest off
+  static void show(uint8_t frame){
+    if (frame == shown){
+      return;
+    }
+    shown = frame;
+
+    Ports p = ports(frame);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      write(p);
+    }
+  }
+
+  //The frame last shown
+  static uint8_t frame(){
+    return shown;
+  }
+};
+
+template <uint8_t... P> uint16_t MotorPins<P...>::shown = 0x100;
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef ONSET_H
+#define ONSET_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "sector.h" //for the index sequence
+#include "softpwm.h"
+
+/*
+ * Overdrive for the belt motors as they start, so a new heading is felt
+ * sooner.
+ *
+ * An ERM vibration motor doesn't buzz at full strength the moment it is
+ * switched on: it takes tens of milliseconds to spin up, and longer the
+ * lower the PWM intensity it is being run at. Onset<PWM, TAU_MS> sits in
+ * front of a SoftPwm (softpwm.h) and takes the same requests, but when a
+ * motor is to go up to a higher intensity it runs it fully on for a while
+ * first (the kick) and only then drops it to the intensity asked for (the
+ * hold).
+ *
+ * The kick is as long as full drive takes to bring the motor from the
+ * speed of the old intensity to that of the new one, with the motor's
+ * speed taken to follow its average drive with time constant TAU_MS:
+ * TAU_MS * ln(1 / (1 - v/LEVELS)) from standstill to intensity v. That is
+ * worked out for every intensity at compile time; at run time a kick is a
+ * table lookup and a subtraction. Going fully on needs no kick, and going
+ * down doesn't get one (the motor can only coast down); a kick under way
+ * is cut short if its motor is turned down.
+ *
+ * update() has to be called often (every pass of loop()): it ends the
+ * kicks whose time is up. Each change of a motor's drive is also put in a
+ * small log, read with next(), so the timing can be printed and checked
+ * against the simulation in sim/.
+ */
+
+namespace onset_detail {
+
+//ln(1 / (1 - x)) from its series x + x^2/2 + x^3/3 + ..., 0 <= x < 1
+constexpr double lnInv(double x, double xk = 0, uint8_t k = 0){
+  return k == 0 ? lnInv(x, x, 1) :
+         k > 96 ? 0 : xk / k + lnInv(x, xk * x, k + 1);
+}
+
+//How long full drive takes to spin a motor up from standstill to the speed
+//of intensity v, in ms
+constexpr uint16_t kickMs(uint8_t v, uint8_t levels, uint16_t tau){
+  return v >= levels ? 0 : (uint16_t)(tau * lnInv((double)v / levels) + 0.5);
+}
+
+template <uint8_t LEVELS, uint16_t TAU, class S> struct Kicks;
+template <uint8_t LEVELS, uint16_t TAU, uint16_t... I>
+struct Kicks<LEVELS, TAU, sector_detail::Seq<I...> > {
+  static const uint16_t ms[sizeof...(I)];
+};
+template <uint8_t LEVELS, uint16_t TAU, uint16_t... I>
+const uint16_t Kicks<LEVELS, TAU, sector_detail::Seq<I...> >::ms[sizeof...(I)]
+  PROGMEM = { kickMs(I, LEVELS, TAU)... };
+
+}
+
+template <class PWM, uint16_t TAU_MS = 25>
+class Onset {
+public:
+  static const uint8_t N = PWM::N;
+  static const uint8_t LEVELS = PWM::LEVELS;
+
+  //One change of a motor's drive (see next())
+  struct Event {
+    uint16_t ms; //millis(), low 16 bits
+    uint8_t motor;
+    uint8_t drive; //intensity the motor is now run at
+    uint8_t hold; //intensity asked for
+  };
+
+private:
+  typedef onset_detail::Kicks<LEVELS, TAU_MS,
+    typename sector_detail::MakeSeq<LEVELS + 1>::type> Kicks;
+
+  static const uint8_t LOG_N = 32;
+
+  static uint8_t hold[N], drive[N];
+  static uint16_t kickEnd[N]; //millis() when each kick is over
+  static uint8_t kicking; //bit i: motor i is being kicked
+  static bool enabled;
+  static Event events[LOG_N]; //the log
+  static uint8_t logHead, logLen;
+
+  static uint16_t kick(uint8_t v){
+    return pgm_read_word(&Kicks::ms[v]);
+  }
+
+  //Pass the drive on to the PWM, and log the motors in changed and those
+  //whose drive changed
+  static void apply(uint16_t now, uint8_t changed){
+    for (uint8_t i = 0; i < N; i++){
+      uint8_t d = kicking & 1 << i ? LEVELS : hold[i];
+      if (d == drive[i] && !(changed & 1 << i)){
+        continue;
+      }
+      drive[i] = d;
+      if (logLen < LOG_N){ //when it's full, the newest are lost
+        Event &e = events[(logHead + logLen++) % LOG_N];
+        e.ms = now;
+        e.motor = i;
+        e.drive = d;
+        e.hold = hold[i];
+      }
+    }
+    PWM::set(drive);
+  }
+
+public:
+  //Run motor i at intensity v[i], 0 to LEVELS, kicking the ones that go up
+  static void set(const uint8_t *v){
+    uint16_t now = millis();
+    uint8_t changed = 0;
+
+    for (uint8_t i = 0; i < N; i++){
+      if (v[i] == hold[i]){
+        continue;
+      }
+      changed |= 1 << i;
+      if (v[i] < hold[i] || v[i] == LEVELS || !enabled){
+        kicking &= ~(1 << i);
+      }
+      else {
+        if (!(kicking & 1 << i)){
+          kickEnd[i] = now;
+        }
+        kickEnd[i] += kick(v[i]) - kick(hold[i]);
+        kicking |= 1 << i;
+      }
+      hold[i] = v[i];
+    }
+    if (changed){
+      apply(now, changed);
+    }
+  }
+
+  //End the kicks that are over. Call from loop().
+  static void update(){
+    uint16_t now = millis();
+    uint8_t over = 0;
+
+    for (uint8_t i = 0; i < N; i++){
+      if (kicking & 1 << i && (int16_t)(now - kickEnd[i]) >= 0){
+        over |= 1 << i;
+      }
+    }
+    if (over){
+      kicking &= ~over;
+      apply(now, 0);
+    }
+  }
+
+  //Every motor at intensity v
+  static void all(uint8_t v){
+    uint8_t l[N];
+
+    memset(l, v, N);
+    set(l);
+  }
+
+  //Motor i at intensity v, and the rest off
+  static void one(uint8_t i, uint8_t v = LEVELS){
+    uint8_t l[N];
+
+    memset(l, 0, N);
+    l[i] = v;
+    set(l);
+  }
+
+  //Intensity v at heading, between two motors (see PWM::bearingLevels())
+  static void bearing(brad_t heading, uint8_t v = LEVELS){
+    uint8_t l[N];
+
+    PWM::bearingLevels(heading, v, l);
+    set(l);
+  }
+
+  //Kick motors up to speed (the default) or not, to compare
+  static void overdrive(bool on){
+    enabled = on;
+  }
+
+  //The oldest change of drive not yet read, if there is one
+  static bool next(Event *e){
+    if (!logLen){
+      return false;
+    }
+    *e = events[logHead];
+    logHead = (logHead + 1) % LOG_N;
+    logLen--;
+    return true;
+  }
+};
+
+template <class P, uint16_t T> uint8_t Onset<P, T>::hold[Onset<P, T>::N];
+template <class P, uint16_t T> uint8_t Onset<P, T>::drive[Onset<P, T>::N];
+template <class P, uint16_t T> uint16_t Onset<P, T>::kickEnd[Onset<P, T>::N];
+template <class P, uint16_t T> uint8_t Onset<P, T>::kicking = 0;
+template <class P, uint16_t T> bool Onset<P, T>::enabled = true;
+template <class P, uint16_t T>
+typename Onset<P, T>::Event Onset<P, T>::events[Onset<P, T>::LOG_N];
+template <class P, uint16_t T> uint8_t Onset<P, T>::logHead = 0;
+template <class P, uint16_t T> uint8_t Onset<P, T>::logLen = 0;
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SECTOR_H
+#define SECTOR_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/*
+ * Heading-to-motor lookup, built by the compiler.
+ *
+ * SectorMap<N, HYST, BITS> splits the circle into N equal sectors (one per
+ * motor), sector 0 centred on north and the rest following clockwise.
+ * Headings are binary radians, 65536 to the circle, as a uint16_t. The
+ * table has 2^BITS entries, one per bin, and a heading is looked up by its
+ * top BITS bits: one shift and one load, no float and no division.
+ *
+ * The low nibble of an entry is the sector the middle of the bin is in. The
+ * high nibble is the sector to stay on if that is the one we were on: the
+ * neighbouring sector when the bin is within HYST brads of a sector edge,
+ * the bin's own sector otherwise. That is the hysteresis band that stops
+ * two motors taking turns when the heading sits on the line between them.
+ * It is rounded to whole bins (256 brads, 1.4 degrees, for BITS = 8).
+ *
+ * Everything is constexpr, so the table is computed at compile time and
+ * lands in flash; changing the motor count or the band is a matter of
+ * changing the template arguments.
+ */
+
+namespace sector_detail {
+
+//0, 1, ..., n-1 as a template parameter pack (std::make_index_sequence
+//is C++14, and the Arduino IDE compiles with -std=gnu++11)
+template <uint16_t... I> struct Seq {};
+template <uint16_t Count, uint16_t... I>
+struct MakeSeq : MakeSeq<Count - 1, Count - 1, I...> {};
+template <uint16_t... I> struct MakeSeq<0, I...> {
+  typedef Seq<I...> type;
+};
+
+//Where the middle of bin i is, counted in 1/65536ths of a sector from the
+//start of sector 0 (half a sector anticlockwise of north)
+constexpr uint32_t binPos(uint8_t n, uint8_t bits, uint16_t i){
+  return (((uint32_t)i << (16 - bits)) + (1UL << (15 - bits))) * n + 32768UL;
+}
+
+constexpr uint8_t entry(uint8_t n, uint8_t sector, uint16_t off, uint32_t band){
+  return (off < band ? (sector + n - 1) % n :
+          65536UL - off < band ? (sector + 1) % n : sector) << 4 | sector;
+}
+
+constexpr uint8_t binEntry(uint8_t n, uint16_t hyst, uint8_t bits, uint16_t i){
+  return entry(n, (binPos(n, bits, i) >> 16) % n,
+               binPos(n, bits, i) & 0xffff, (uint32_t)hyst * n);
+}
+
+template <uint8_t N, uint16_t HYST, uint8_t BITS, class S> struct Table;
+template <uint8_t N, uint16_t HYST, uint8_t BITS, uint16_t... I>
+struct Table<N, HYST, BITS, Seq<I...> > {
+  static const uint8_t bins[sizeof...(I)];
+};
+template <uint8_t N, uint16_t HYST, uint8_t BITS, uint16_t... I>
+const uint8_t Table<N, HYST, BITS, Seq<I...> >::bins[sizeof...(I)] PROGMEM = {
+  binEntry(N, HYST, BITS, I)...
+};
+
+}
+
+template <uint8_t N, uint16_t HYST = 0, uint8_t BITS = 8>
+class SectorMap {
+  static_assert(N >= 1 && N <= 16, "the sector has to fit in a nibble");
+  static_assert(BITS >= 1 && BITS <= 8, "at most 256 table entries");
+  static_assert((uint32_t)HYST * 2 * N < 65536UL, "band wider than a sector");
+
+  typedef sector_detail::Table<N, HYST, BITS,
+    typename sector_detail::MakeSeq<(1 << BITS)>::type> Table;
+
+public:
+  //Sector for a heading, with no hysteresis
+  static uint8_t lookup(uint16_t heading){
+    return pgm_read_byte(&Table::bins[heading >> (16 - BITS)]) & 0x0f;
+  }
+
+  //Sector for a heading, staying on prev if it is just across the edge
+  static uint8_t lookup(uint16_t heading, uint8_t prev){
+    uint8_t e = pgm_read_byte(&Table::bins[heading >> (16 - BITS)]);
+    return (e >> 4) == prev ? prev : (e & 0x0f);
+  }
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+//Stand-in for <Arduino.h>, with just what the headers under test use; the
+//simulation provides millis() and its own clock
+
+#include <stdint.h>
+#include <string.h>
+
+unsigned long millis();
+
+#endif
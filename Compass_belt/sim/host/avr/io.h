@@ -0,0 +1,16 @@
+#ifndef SIM_IO_H
+#define SIM_IO_H
+
+//Stand-in for <avr/io.h>: the registers motors.h and softpwm.h use, as
+//plain variables the simulation defines and looks at
+
+#include <stdint.h>
+
+extern volatile uint8_t PORTB, PORTC, PORTD;
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, TCNT2, TIMSK2;
+
+#define WGM21 1
+#define CS22 2
+#define OCIE2A 1
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SIM_PGMSPACE_H
+#define SIM_PGMSPACE_H
+
+//Stand-in for <avr/pgmspace.h>: on the host, program memory is just
+//ordinary read-only data
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SIM_ATOMIC_H
+#define SIM_ATOMIC_H
+
+//Stand-in for <util/atomic.h>: the simulation has no interrupts to hold
+//off, so the block just runs once
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (uint8_t _once = 1; _once; _once = 0)
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * onset-sim -- how soon a motor is felt, with and without the kick
+ *
+ * Runs the belt's motor code (../motors.h, ../softpwm.h and ../onset.h,
+ * compiled for the host against the stand-ins in host/) on a simulated
+ * clock, calling the PWM interrupt handler at the rate Timer 2 would. Each
+ * motor pin drives a model of an ERM motor: its speed follows the pin with
+ * a time constant of -t ms (25 unless told otherwise, which is what Onset
+ * assumes).
+ *
+ * Every MOVE_MS (the sketch's motorPeriod) the heading takes a random step
+ * and is put on the belt with Drive::bearing() at intensity -v (12 of the
+ * 16 unless told otherwise). For each motor that is to go up, the onset
+ * latency is the time from the request until the motor is at 90% of the
+ * speed for its new intensity; a motor that is changed again first counts
+ * as never getting there. The same walk is run with the kick and without,
+ * and the latency of each is reported.
+ *
+ * With -l, every change of drive is printed as the sketch prints it with
+ * LOG_ONSET: "onset <ms> <motor> <drive> <hold>". With -r, lines like that
+ * are read from stdin instead (a log taken from the belt) and run through
+ * the motor model, each motor driven at its average PWM duty, with the
+ * latency reported the same way.
+ *
+ * The model is only as good as the one time constant: real motors also
+ * have to get over static friction, so they start slower than this.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../motors.h"
+#include "../softpwm.h"
+#include "../onset.h"
+
+#define MOVE_MS 500 //as motorPeriod in Compass_belt.ino
+#define MOVES 400
+
+volatile uint8_t PORTB, PORTC, PORTD;
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, TCNT2, TIMSK2;
+
+static double simUs; //the simulated clock
+
+unsigned long millis(){
+  return (unsigned long)(simUs / 1000);
+}
+
+//The pins of Compass_belt.ino
+static const uint8_t pins[] = { 13, 12, 11, 10, 4, 5, 6, 7 };
+typedef MotorPins<13, 12, 11, 10, 4, 5, 6, 7> Motors;
+typedef SoftPwm<Motors> Pwm;
+typedef Onset<Pwm> Drive;
+
+static const uint8_t N = Motors::N;
+
+//The motors, and the onsets being timed
+struct Model {
+  double speed[N]; //0 to 1
+  double a; //how far speed goes towards the drive in one step
+  uint8_t hold[N]; //intensity asked for
+  bool waiting[N]; //hold went up, and the motor isn't there yet
+  double since[N]; //when it went up, in us
+  long n, never;
+  double sum, max;
+};
+
+static void modelInit(Model *m, double tauMs, double stepUs){
+  memset(m, 0, sizeof(*m));
+  m->a = 1 - exp(-stepUs / (tauMs * 1000));
+}
+
+//Motor i has been asked for intensity v
+static void request(Model *m, uint8_t i, uint8_t v){
+  if (v == m->hold[i]){
+    return;
+  }
+  if (m->waiting[i]){
+    m->never++;
+    m->waiting[i] = false;
+  }
+  if (v > m->hold[i]){
+    m->waiting[i] = true;
+    m->since[i] = simUs;
+  }
+  m->hold[i] = v;
+}
+
+//One step of the model, with motor i driven at duty drive[i] (0 to 1)
+static void step(Model *m, const double *drive){
+  for (uint8_t i = 0; i < N; i++){
+    m->speed[i] += (drive[i] - m->speed[i]) * m->a;
+    if (m->waiting[i] &&
+        m->speed[i] >= 0.9 * m->hold[i] / Pwm::LEVELS){
+      double ms = (simUs - m->since[i]) / 1000;
+      m->waiting[i] = false;
+      m->n++;
+      m->sum += ms;
+      if (ms > m->max){
+        m->max = ms;
+      }
+    }
+  }
+}
+
+static void report(const char *what, const Model *m){
+  printf("%s: %ld onsets\n", what, m->n + m->never);
+  printf("   latency: %.1f ms mean, %.1f ms max, %ld never\n",
+         m->n ? m->sum / m->n : 0.0, m->max, m->never);
+}
+
+static void printLog(){
+  Drive::Event e;
+
+  while (Drive::next(&e)){
+    printf("onset %u %u %u %u\n", e.ms, e.motor, e.drive, e.hold);
+  }
+}
+
+//The random walk, with or without the kick
+static void walk(bool kick, uint8_t level, double tauMs, bool log){
+  double tickUs = 64.0 * (OCR2A + 1) / (F_CPU / 1e6), drive[N];
+  brad_t heading = 0;
+  uint8_t l[N];
+  Model m;
+
+  modelInit(&m, tauMs, tickUs);
+  srand(1);
+  Drive::overdrive(kick);
+  for (int move = 0; move < MOVES; move++){
+    heading += (rand() % 121 - 60) * 65536L / 360;
+    Pwm::bearingLevels(heading, level, l);
+    for (uint8_t i = 0; i < N; i++){
+      request(&m, i, l[i]);
+    }
+    Drive::bearing(heading, level);
+
+    for (double end = simUs + MOVE_MS * 1000.0; simUs < end; ){
+      simUs += tickUs;
+      Drive::update(); //as loop() does, many times a tick
+      Pwm::tick();
+      for (uint8_t i = 0; i < N; i++){
+        drive[i] = pins[i] < 8 ? PORTD >> pins[i] & 1 :
+                                 PORTB >> (pins[i] - 8) & 1;
+      }
+      step(&m, drive);
+    }
+    if (log){
+      printLog();
+    }
+    else {
+      Drive::Event e;
+      while (Drive::next(&e))
+        ;
+    }
+  }
+
+  //Off, and long enough for the motors to stop before the next run
+  Drive::all(0);
+  simUs += 10 * MOVE_MS * 1000.0;
+  Drive::update();
+  if (log){
+    printLog();
+  }
+  report(kick ? "kick, then hold" : "hold only", &m);
+}
+
+//Run the model on a log from the belt
+static int replay(double tauMs){
+  const double stepUs = 250;
+  double drive[N] = { 0 }, end;
+  unsigned ms, motor, d, h;
+  long base = 0, last = -1, t;
+  char line[80];
+  Model m;
+
+  modelInit(&m, tauMs, stepUs);
+  simUs = -1;
+  while (fgets(line, sizeof(line), stdin)){
+    if (sscanf(line, "onset %u %u %u %u", &ms, &motor, &d, &h) != 4 ||
+        motor >= N){
+      continue;
+    }
+    t = base + ms;
+    if (t < last){ //the log's millis() are 16 bits
+      base += 65536;
+      t += 65536;
+    }
+    last = t;
+    if (simUs < 0){
+      simUs = t * 1000.0;
+    }
+    for (; simUs < t * 1000.0; simUs += stepUs){
+      step(&m, drive);
+    }
+    request(&m, motor, h);
+    drive[motor] = (double)d / Pwm::LEVELS;
+  }
+  if (last < 0){
+    fprintf(stderr, "no \"onset\" lines on stdin\n");
+    return 1;
+  }
+  for (end = simUs + MOVE_MS * 1000.0; simUs < end; simUs += stepUs){
+    step(&m, drive);
+  }
+  report("replayed", &m);
+  return 0;
+}
+
+static void usage(const char *name){
+  fprintf(stderr, "usage: %s [-l] [-r] [-t ms] [-v level]\n"
+          "   -l        print every change of drive\n"
+          "   -r        replay a log from the belt, read from stdin\n"
+          "   -t ms     the motors' time constant (default 25)\n"
+          "   -v level  hold intensity, 1 to %u (default 12)\n",
+          name, Pwm::LEVELS);
+}
+
+int main(int argc, char *argv[]){
+  double tauMs = 25;
+  int opt, level = 12;
+  bool log = false, replaying = false;
+
+  while ((opt = getopt(argc, argv, "lrt:v:")) != -1){
+    switch (opt){
+      case 'l': log = true; break;
+      case 'r': replaying = true; break;
+      case 't': if ((tauMs = atof(optarg)) > 0) break;
+                usage(argv[0]); return 1;
+      case 'v': if ((level = atoi(optarg)) >= 1 && level <= Pwm::LEVELS) break;
+                //else...
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (replaying){
+    return replay(tauMs);
+  }
+
+  Pwm::begin();
+  printf("%u motors, %u intensities, hold %d; motor time constant %.0f ms\n",
+         N, Pwm::LEVELS, level, tauMs);
+  walk(true, level, tauMs, log);
+  walk(false, level, tauMs, log);
+  return 0;
+}
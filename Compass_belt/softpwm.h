@@ -0,0 +1,166 @@
+#ifndef SOFTPWM_H
+#define SOFTPWM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "fixtrig.h"
+
+/*
+ * Software PWM for the belt motors, so each one can run at any of LEVELS
+ * intensities rather than just on or off.
+ *
+ * SoftPwm<MOTORS, BITS, HZ> drives the motors of MOTORS (a MotorPins<...>,
+ * see motors.h) with LEVELS = 2^BITS steps of intensity, from 0 (off) to
+ * LEVELS (fully on), HZ PWM periods a second. Timer 2 interrupts LEVELS
+ * times per period (4 kHz with the defaults), and each time
+ * the handler, tick(), writes the next entry of a phase table to the ports
+ * and moves on. The table holds each phase of the period as port bits, all
+ * worked out by set() when the intensities change, so tick() takes the same
+ * few dozen cycles whatever the intensities are and however many motors
+ * there are. Timer 2 is also what tone() uses; the sketch doesn't.
+ *
+ * A motor at level v is on for v phases of each period. They are spread out
+ * rather than in one run (phase p is on if p, with its bits reversed, is
+ * less than v), so at half intensity the motor is switched at half the
+ * interrupt rate instead of the PWM rate.
+ *
+ * bearing() shares one intensity between the two motors either side of a
+ * heading, in proportion to how close it is to each: the belt then feels as
+ * if there were a motor in between. With eight motors and 16 levels that is
+ * 128 bearings.
+ *
+ * The sketch has to hook tick() up to the timer itself:
+ *
+ *   ISR(TIMER2_COMPA_vect){
+ *     Pwm::tick();
+ *   }
+ */
+
+template <class MOTORS, uint8_t BITS = 4, uint16_t HZ = 250>
+class SoftPwm {
+  static_assert(BITS >= 1 && BITS <= 6, "at most 64 phases");
+
+public:
+  static const uint8_t LEVELS = 1 << BITS;
+  static const uint8_t N = MOTORS::N;
+
+private:
+  //Timer 2 at F_CPU/64 in CTC mode, interrupting LEVELS*HZ times a second
+  static const uint32_t TOP = F_CPU / 64 / ((uint32_t)LEVELS * HZ) - 1;
+  static_assert(TOP >= 15 && TOP <= 255, "interrupt rate out of Timer 2's range");
+
+  typedef typename MOTORS::Ports Ports;
+
+  static Ports table[2][LEVELS]; //the phase table, and the next one
+  static volatile uint8_t live; //which of the two tick() is using
+  static uint8_t phase;
+  static uint8_t level[N]; //what the live table was built from
+
+  //p with its BITS bits in reverse order
+  static uint8_t reversed(uint8_t p){
+    uint8_t r = 0;
+    for (uint8_t i = 0; i < BITS; i++){
+      r = r << 1 | (p & 1);
+      p >>= 1;
+    }
+    return r;
+  }
+
+public:
+  //Start the timer. Until set() is called, the motors are off. While it
+  //runs, the motors are the timer's: MOTORS::show() mustn't be used.
+  static void begin(){
+    TCCR2A = 1 << WGM21; //CTC: count to OCR2A, then start again
+    TCCR2B = 1 << CS22; //F_CPU/64
+    OCR2A = TOP;
+    TCNT2 = 0;
+    TIMSK2 |= 1 << OCIE2A;
+  }
+
+  //Stop the timer, with all the motors off
+  static void end(){
+    Ports off = MOTORS::ports(0);
+
+    TIMSK2 &= ~(1 << OCIE2A);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      MOTORS::write(off);
+    }
+  }
+
+  //Run motor i at intensity v[i], 0 to LEVELS
+  static void set(const uint8_t *v){
+    if (!memcmp(v, level, N)){
+      return;
+    }
+    memcpy(level, v, N);
+
+    Ports *next = table[!live];
+    for (uint8_t p = 0; p < LEVELS; p++){
+      uint8_t r = reversed(p), frame = 0;
+      for (uint8_t i = 0; i < N; i++){
+        if (v[i] > r){
+          frame |= 1 << i;
+        }
+      }
+      next[p] = MOTORS::ports(frame);
+    }
+    live = !live; //one byte, so tick() sees one table or the other
+  }
+
+  //Every motor at intensity v
+  static void all(uint8_t v){
+    uint8_t l[N];
+
+    memset(l, v, N);
+    set(l);
+  }
+
+  //Motor i at intensity v, and the rest off
+  static void one(uint8_t i, uint8_t v = LEVELS){
+    uint8_t l[N];
+
+    memset(l, 0, N);
+    l[i] = v;
+    set(l);
+  }
+
+  //The intensities for v at heading, shared between the motors either
+  //side of it. Motor 0 is at north and the rest follow clockwise, as in
+  //SectorMap.
+  static void bearingLevels(brad_t heading, uint8_t v, uint8_t *l){
+    uint32_t pos = (uint32_t)heading * N; //motor number, in 65536ths
+    uint8_t i = pos >> 16;
+    uint8_t w = ((pos & 0xffff) * v + 0x8000) >> 16;
+
+    memset(l, 0, N);
+    l[i] = v - w;
+    l[(i + 1) % N] = w;
+  }
+
+  //Intensity v at heading (see bearingLevels())
+  static void bearing(brad_t heading, uint8_t v = LEVELS){
+    uint8_t l[N];
+
+    bearingLevels(heading, v, l);
+    set(l);
+  }
+
+  //The interrupt handler: the next phase of the period
+  static void tick(){
+    MOTORS::write(table[live][phase]);
+    phase = (phase + 1) & (LEVELS - 1);
+  }
+};
+
+template <class M, uint8_t B, uint16_t H>
+typename M::Ports SoftPwm<M, B, H>::table[2][SoftPwm<M, B, H>::LEVELS];
+template <class M, uint8_t B, uint16_t H>
+volatile uint8_t SoftPwm<M, B, H>::live = 0;
+template <class M, uint8_t B, uint16_t H>
+uint8_t SoftPwm<M, B, H>::phase = 0;
+template <class M, uint8_t B, uint16_t H>
+uint8_t SoftPwm<M, B, H>::level[SoftPwm<M, B, H>::N];
+
+#endif
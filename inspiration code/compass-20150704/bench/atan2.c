@@ -0,0 +1,158 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* atan2-bench -- compare the CORDIC and table-driven fxp_atan2()
+
+Measures accuracy against libm atan2() over two input sets:
+
+   circle -- every direction (in 1/16 brad steps) at radii typical of a
+      magnetometer reading (MAG_MIN to well past MAG_MAX; see validate.c)
+   full -- pseudo-random {x,y} pairs drawn from the whole int16 domain
+
+then times both implementations over the full-domain set.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+#include "fixedpt.h"
+
+#define NPTS 65536
+#define REPS 200
+#define CIRCLE (2*FIXEDPT_BRAD_SEMICIRC)
+
+typedef fixedpt_t (*atan2_fn)(fixedpt_t, fixedpt_t);
+
+typedef struct { double max, sumsq; long n; } err_t;
+
+static fixedpt_t xs[NPTS], ys[NPTS];
+
+/*** wrap() -- reduce an angle difference (in brads) to a half-circle
+
+Returns the argument reduced modulo a full circle into the range
+[-FIXEDPT_BRAD_SEMICIRC, FIXEDPT_BRAD_SEMICIRC).
+***/
+static double wrap(double d) {
+   d = fmod(d + FIXEDPT_BRAD_SEMICIRC, CIRCLE);
+   if(d < 0) d += CIRCLE;
+   return d - FIXEDPT_BRAD_SEMICIRC;
+}
+
+/*** exact() -- reference atan2() in brads, in [0, CIRCLE) ***/
+static double exact(const fixedpt_t y, const fixedpt_t x) {
+   double a = atan2(y, x) * FIXEDPT_BRAD_SEMICIRC / M_PI;
+   return a < 0 ? a + CIRCLE : a;
+}
+
+static void err_add(err_t * const e, const double d) {
+   if(fabs(d) > e->max) e->max = fabs(d);
+   e->sumsq += d*d; e->n++;
+}
+
+/*** accuracy() -- report error of both implementations over one point set
+
+Arguments:
+   lbl -- name of the point set, for the report
+   x, y -- coordinates of the points
+   n -- number of points
+***/
+static void accuracy(const char * const lbl, const fixedpt_t * const x,
+ const fixedpt_t * const y, const int n) {
+   err_t ec = {0}, el = {0}, ed = {0};
+   fixedpt_t c, l;
+   double ref;
+   int i;
+
+   for(i = 0; i < n; i++) {
+      if(x[i] == 0 && y[i] == 0) continue; /* direction is undefined */
+      ref = exact(y[i], x[i]);
+      c = fxp_atan2_cordic(y[i], x[i]);
+      l = fxp_atan2_lut(y[i], x[i]);
+      err_add(&ec, wrap(c - ref));
+      err_add(&el, wrap(l - ref));
+      err_add(&ed, wrap(l - c));
+   }
+
+#define DEG(b) ((b) * 180.0 / FIXEDPT_BRAD_SEMICIRC)
+   printf("%s (%ld points):\n", lbl, ec.n);
+   printf("   cordic: max err %.4f deg (%.2f brad), rms %.4f deg\n",
+    DEG(ec.max), ec.max, DEG(sqrt(ec.sumsq / ec.n)));
+   printf("   lut:    max err %.4f deg (%.2f brad), rms %.4f deg\n",
+    DEG(el.max), el.max, DEG(sqrt(el.sumsq / el.n)));
+   printf("   lut vs. cordic: max diff %.4f deg (%.0f brad)\n",
+    DEG(ed.max), ed.max);
+}
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*** timing() -- report time per call for one implementation
+
+Calls the function once for each of the NPTS full-domain points, REPS
+times over, and prints the mean time (and, on x86, TSC cycles) per call.
+***/
+static void timing(const char * const lbl, const atan2_fn fn) {
+   volatile fixedpt_t sink;
+   fixedpt_t acc = 0;
+   double t0;
+   int i, r;
+#ifdef HAVE_TSC
+   uint64_t c0;
+#endif
+
+   t0 = now_ns();
+#ifdef HAVE_TSC
+   c0 = __rdtsc();
+#endif
+   for(r = 0; r < REPS; r++)
+      for(i = 0; i < NPTS; i++) acc += fn(ys[i], xs[i]);
+#ifdef HAVE_TSC
+   c0 = __rdtsc() - c0;
+#endif
+   t0 = now_ns() - t0;
+   sink = acc; (void)sink;
+
+   printf("   %-7s %6.2f ns/op", lbl, t0 / ((double)REPS * NPTS));
+#ifdef HAVE_TSC
+   printf("  %6.1f cycles/op", (double)c0 / ((double)REPS * NPTS));
+#endif
+   printf("\n");
+}
+
+int main(void) {
+   static fixedpt_t cx[NPTS], cy[NPTS];
+   static const int radii[] = { 0x00DA, 0x0200, 0x0368, 0x0800 };
+   int i, j, n = 0;
+   double a;
+
+   for(j = 0; j < sizeof(radii)/sizeof(radii[0]); j++) {
+      for(i = 0; i < CIRCLE; i += 16) {
+         a = i * M_PI / FIXEDPT_BRAD_SEMICIRC;
+         cx[n] = lround(radii[j] * cos(a));
+         cy[n] = lround(radii[j] * sin(a));
+         n++;
+      }
+   }
+   accuracy("circle", cx, cy, n);
+
+   srand(1);
+   for(i = 0; i < NPTS; i++) {
+      xs[i] = (fixedpt_t)(rand() & 0xffff);
+      ys[i] = (fixedpt_t)(rand() & 0xffff);
+   }
+   accuracy("full", xs, ys, NPTS);
+
+   printf("timing (host CPU):\n");
+   timing("cordic", fxp_atan2_cordic);
+   timing("lut", fxp_atan2_lut);
+
+   return 0;
+}
@@ -0,0 +1,127 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* batch-bench -- check and time the batch routines in ../host/fixedpt_n.c
+
+For each instruction set the CPU supports, runs fxp_atan2_n(),
+fxp_dist_n() and rot_posn_n() over large pseudo-random arrays, checks that
+every result is identical to what the one-at-a-time firmware routine
+gives, and reports the time per element. The array lengths are not a
+multiple of 16, so the leftover-element code is exercised too.
+
+Exits non-zero if any result differs.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "fixedpt.h"
+#include "rotate.h"
+#include "fixedpt_n.h"
+
+#define NPTS 1000003
+#define REPS 20
+#define DIST_MAX 26754 /* 3 * DIST_MAX^2 fits in 31 bits; see fxp_dist() */
+
+static fixedpt_t xs[NPTS], ys[NPTS], zs[NPTS]; /* any values */
+static fixedpt_t da[NPTS], db[NPTS], dc[NPTS];  /* fxp_dist() inputs */
+static fixedpt_t ref[2][NPTS], out[3][NPTS];
+
+static const char * const names[] = { "scalar", "sse4.1", "avx2" };
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static fixedpt_t rnd(const int lim) {
+   return (fixedpt_t)(rand() % (2*lim + 1) - lim);
+}
+
+/*** check() -- count elements of o[] that differ from r[] ***/
+static long check(const fixedpt_t * const o, const fixedpt_t * const r) {
+   long i, bad = 0;
+
+   for(i = 0; i < NPTS; i++) if(o[i] != r[i]) bad++;
+   return bad;
+}
+
+static void report(const char * const fn, const int lvl, const long bad,
+ const double ns) {
+   printf("   %-8s %-12s %6.2f ns/elem  %s", names[lvl], fn,
+    ns / ((double)REPS * NPTS), bad ? "MISMATCH" : "exact");
+   if(bad) printf(" (%ld differ)", bad);
+   printf("\n");
+}
+
+int main(void) {
+   rotation_t rot;
+   hmc5883l_pos_t p;
+   double t;
+   long bad, fails = 0;
+   int i, j, lvl, r;
+
+   /* Matrix entries anywhere in [-1,1], so that the wraparound cases in
+      rot_posn() get exercised as well as realistic ones. */
+   srand(1);
+   for(i = 0; i < 3; i++)
+      for(j = 0; j < 3; j++) rot.r[i][j] = rnd(FIXEDPT_ONE);
+
+   for(i = 0; i < NPTS; i++) {
+      xs[i] = (fixedpt_t)(rand() & 0xffff);
+      ys[i] = (fixedpt_t)(rand() & 0xffff);
+      zs[i] = (fixedpt_t)(rand() & 0xffff);
+      da[i] = rnd(DIST_MAX); db[i] = rnd(DIST_MAX); dc[i] = rnd(DIST_MAX);
+   }
+   /* a few points on or near the axes, which fxp_atan2() treats
+      specially */
+   for(i = 0; i < 64; i++) { xs[i] = rnd(3); ys[i] = rnd(3); }
+
+   for(i = 0; i < NPTS; i++) {
+      ref[0][i] = fxp_atan2(ys[i], xs[i]);
+      ref[1][i] = fxp_dist(da[i], db[i], dc[i]);
+   }
+
+   printf("batch routines (%d elements):\n", NPTS);
+   for(lvl = FXP_N_SCALAR; lvl <= FXP_N_AVX2; lvl++) {
+      if(fxp_n_select(lvl) != lvl) {
+         printf("   %-8s not supported here\n", names[lvl]);
+         continue;
+      }
+
+      t = now_ns();
+      for(r = 0; r < REPS; r++) fxp_atan2_n(out[0], ys, xs, NPTS);
+      t = now_ns() - t;
+      report("fxp_atan2_n", lvl, bad = check(out[0], ref[0]), t);
+      fails += bad;
+
+      t = now_ns();
+      for(r = 0; r < REPS; r++) fxp_dist_n(out[1], da, db, dc, NPTS);
+      t = now_ns() - t;
+      report("fxp_dist_n", lvl, bad = check(out[1], ref[1]), t);
+      fails += bad;
+
+      /* rot_posn_n() works in place, so time it on fresh copies each
+         time, and check the copies from the last repetition. */
+      t = 0;
+      for(r = 0; r < REPS; r++) {
+         memcpy(out[0], xs, sizeof(xs));
+         memcpy(out[1], ys, sizeof(ys));
+         memcpy(out[2], zs, sizeof(zs));
+         t -= now_ns();
+         rot_posn_n(out[0], out[1], out[2], &rot, NPTS);
+         t += now_ns();
+      }
+      for(i = 0, bad = 0; i < NPTS; i++) {
+         p.x = xs[i]; p.y = ys[i]; p.z = zs[i];
+         rot_posn(&p, &rot);
+         if(out[0][i] != p.x || out[1][i] != p.y || out[2][i] != p.z) bad++;
+      }
+      report("rot_posn_n", lvl, bad, t);
+      fails += bad;
+   }
+
+   return fails ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* frame-bench -- count the display bus traffic of matrix8x8_drawP()
+
+First checks that the 16 point frames in ../frame_tbl.h are the images
+compass.c used to put together stroke by stroke, converted to controller
+bit order. Then feeds ../matrix8x8/matrix8x8.c the frames compass.c would
+draw for a
+made-up walk: a heading that wanders and sometimes turns, with sensor
+noise on top, one frame per PIPE_BLOCK-sample block after the sector
+table's hysteresis. The bus is replaced by a uWireM_queue() that records
+every transfer and checks that the display RAM it would leave behind is
+the frame just drawn. One transfer in FAIL_EVERY fails (the display RAM
+is left alone and err is set), and the frame after it must put things
+right. Reports how many frames went out at all, the bus
+bytes per frame and per second with the frame cache, and the same for
+sending every frame whole as matrix8x8_drawP() used to.
+
+The frame rate, and so the per-second figures and the loop rate, come
+from SAMPLE_HZ below, which is worked out from bus timing rather than
+measured on a device; only the per-frame figures are measured here.
+Exits non-zero if any frame in the table is wrong, or if the display RAM
+ever disagrees with the frame drawn.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <avr/pgmspace.h>
+#include <uWireM/uWireM.h>
+#include <matrix8x8/matrix8x8.h>
+#include "fixedpt.h"
+#include "sector_tbl.h"
+#include "frame_tbl.h"
+
+#define FRAME_SAMPLES 4   /* firmware PIPE_BLOCK */
+#define SAMPLE_HZ 125.0   /* estimated firmware sample rate */
+#define FAIL_EVERY 997    /* one transfer in this many fails */
+#define BUS_HZ 100000.0
+#define NFRAMES 200000
+
+static uint8_t _ram[16];   /* what the HT16K33 display RAM would hold */
+static long _bytes, _xfers, _fails;
+static int _failed;        /* the last transfer failed */
+
+uint8_t uWireM_queue(uWireM_txn_t * const t) {
+   uint8_t a, i;
+
+   /* byte 1 is the display RAM address to start at; the rest is data */
+   _bytes += t->len;
+   _failed = ++_xfers % FAIL_EVERY == 0;
+   if(_failed) {
+      _fails++;
+      t->err = USI_TWI_NO_ACK_ON_DATA;
+   } else {
+      a = t->buf[1] & 0x0f;
+      for(i = 2; i < t->len; i++, a = (a + 1) & 0x0f) _ram[a] = t->buf[i];
+      t->err = 0;
+   }
+   t->busy = 0;
+   if(t->done) t->done(t);
+   return TRUE;
+}
+
+uint8_t uWireM_xfer(uint8_t * const buf, const uint8_t len) {
+   static uWireM_txn_t t;
+
+   t.buf = buf; t.len = len; t.done = NULL;
+   return uWireM_queue(&t);
+}
+
+/*** point_img() -- the image compass.c drew for one of the 16 points
+
+The strokes compass.c drew before the frames were built ahead of time:
+NORTH/SOUTH across, EAST/WEST down the sides, with a second one for the
+three-letter points.
+***/
+static void point_img(uint8_t * const img, const uint8_t pt) {
+   static const uint8_t flags[16] = {
+      0x01, 0x13, 0x11, 0x31, 0x10, 0x34, 0x14, 0x1c,
+      0x04, 0x4c, 0x44, 0xc4, 0x40, 0xc1, 0x41, 0x43,
+   };
+   const uint8_t f = flags[pt];
+
+   memset(img, 0, 8);
+   if(f & 0x01) img[5] = 0b01111100;
+   if(f & 0x02) img[3] = 0b01111100;
+   if(f & 0x04) img[6] = 0b01111100;
+   if(f & 0x08) img[4] = 0b01111100;
+   if(f & 0x10) img[7] = 0b11110000;
+   if(f & 0x20) img[2] = 0b11110000;
+   if(f & 0x40) img[7] = 0b00001111;
+   if(f & 0x80) img[2] = 0b00001111;
+}
+
+static double gauss(void) {
+   double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+   double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+   return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+int main(void) {
+   uint8_t img[8], pt, prev = 0, e;
+   double hdg = 0, rate = 0, fps = SAMPLE_HZ / FRAME_SAMPLES, full_bytes;
+   fixedpt_t h;
+   long f, sent, bad = 0;
+   int i, row;
+
+   for(pt = 0; pt < FRAME_POINTS; pt++) {
+      point_img(img, pt);
+      for(row = 0; row < 8; row++)
+         if(pgm_read_byte(&_frame_tbl[pt][row]) != matrix8x8_pixels(img[row]))
+            bad++;
+   }
+   if(bad) {
+      printf("frame_tbl.h: %ld rows differ from the point images\n", bad);
+      return 1;
+   }
+
+   srand(1);
+   matrix8x8_clear();
+   _bytes = _xfers = 0;
+
+   for(f = 0; f < NFRAMES; f++) {
+      for(i = 0; i < FRAME_SAMPLES; i++) {
+         /* Mostly walking straight; now and then a turn of up to 90
+            degrees/s. Sensor noise of a degree or so on top. */
+         if(rand() % 400 == 0) rate = (rand() % 2 ? 1 : -1) * 90.0 * rand() /
+          RAND_MAX;
+         else if(rand() % 100 == 0) rate = 0;
+         hdg += (rate + 5 * gauss()) / SAMPLE_HZ;
+         h = (fixedpt_t)lround(fmod(hdg + gauss() + 720, 360.0) *
+          FIXEDPT_BRAD_SEMICIRC / 180.0);
+
+         e = pgm_read_byte(_sector_tbl + ((ufixedpt_t)h >> SECTOR_TBL_SHIFT));
+         if((e >> 4) == prev) pt = prev;
+         else pt = e & 0x0f;
+         prev = pt;
+      }
+
+      _failed = 0;
+      matrix8x8_drawP(_frame_tbl[pt]);
+      if(_failed) continue; /* the next frame has to make up for it */
+      for(row = 0; row < 8; row++)
+         if(_ram[row << 1] != pgm_read_byte(&_frame_tbl[pt][row])) {
+            bad++;
+            break;
+         }
+   }
+
+   sent = _xfers;
+   full_bytes = 18.0 * NFRAMES;
+   printf("display traffic (%d frames, %.1f frames/s estimated):\n",
+    NFRAMES, fps);
+   printf("   frames sent:   %ld (%.1f%%), %ld of them failed\n", sent,
+    100.0 * sent / NFRAMES, _fails);
+   printf("   %-14s %6.2f bytes/frame %8.1f bytes/s %5.2f%% of bus\n",
+    "whole frames", full_bytes / NFRAMES, full_bytes / NFRAMES * fps,
+    100.0 * full_bytes / NFRAMES * fps * 9 / BUS_HZ);
+   printf("   %-14s %6.2f bytes/frame %8.1f bytes/s %5.2f%% of bus\n",
+    "changed rows", (double)_bytes / NFRAMES, (double)_bytes / NFRAMES * fps,
+    100.0 * _bytes / NFRAMES * fps * 9 / BUS_HZ);
+   /* The sensor has to wait for the bus while a frame is going out, so
+      each frame's bus time (9 bits per byte, and about two bit times for
+      start and stop) is added to the time per loop. */
+   printf("   loop rate (est.): %.1f/s whole frames, %.1f/s changed rows\n",
+    1 / (1 / fps + (full_bytes * 9 + NFRAMES * 2.0) / NFRAMES / BUS_HZ),
+    1 / (1 / fps + (_bytes * 9 + sent * 2.0) / NFRAMES / BUS_HZ));
+   printf("   display RAM: %s\n", bad ? "MISMATCH" : "always matches frame");
+   return bad ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* heading-bench -- compare heading() with an affine version of it
+
+heading() subtracts the calibration offset from each reading, rotates the
+result with rot_posn() and passes it to fxp_polar(). The offset can instead
+be folded into the rotation, once per calibration, so that each adjusted
+coordinate is one dot product plus a constant (kept at the width of the
+products, so that the result is the same). This program checks that the
+folded form gives identical results (angle, magnitude and tilt) for random
+calibrations and readings, then times both ways. The firmware keeps the
+subtract-then-rotate form, which reuses rot_posn(); the folded one would
+need a routine of its own, and on the host it saves only a few percent.
+
+Exits non-zero if any result differs.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "fixedpt.h"
+#include "rotate.h"
+#include "quat.h"
+#include "calibrate.h"
+#include "heading.h"
+
+#define NCAL 64
+#define NPTS 16384
+#define REPS 50
+
+static hmc5883l_pos_t pts[NPTS];
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static fixedpt_t rnd(const int lim) {
+   return (fixedpt_t)(rand() % (2*lim + 1) - lim);
+}
+
+/* One row of the folded transform: the output is m . (x,y,z) + c, with c
+   on the scale of the products. */
+typedef struct {
+   fixedpt_t m[3];
+   fxp_sq_t c;
+} row_t;
+
+/*** row_set() -- fold the offset into one row of the rotation
+
+The rotation matrix is applied by columns (see rot_posn()), so row i of the
+transform is column i of the matrix. The offset becomes the constant
+-(m . xlate).
+***/
+static void row_set(row_t * const row, const heading_xform_t * const hx,
+ const int i) {
+   row->m[0] = hx->rot.r[0][i];
+   row->m[1] = hx->rot.r[1][i];
+   row->m[2] = hx->rot.r[2][i];
+   row->c = -((fxp_sq_t)row->m[0] * hx->xlate.x +
+    (fxp_sq_t)row->m[1] * hx->xlate.y + (fxp_sq_t)row->m[2] * hx->xlate.z);
+}
+
+/*** row_apply() -- m . pos + c, shifted down once, as fxp_dot3() does ***/
+static fixedpt_t row_apply(const row_t * const r,
+ const hmc5883l_pos_t * const pos) {
+   return ((fxp_sq_t)r->m[0] * pos->x + (fxp_sq_t)r->m[1] * pos->y +
+    (fxp_sq_t)r->m[2] * pos->z + r->c) >> FIXEDPT_FRACBITS;
+}
+
+/*** affine_heading() -- heading() with the offset folded in ***/
+static fixedpt_t affine_heading(const hmc5883l_pos_t * const pos,
+ const row_t * const rows, fxp_polar_t * const pol) {
+   fxp_polar(pol, row_apply(&rows[0], pos), row_apply(&rows[1], pos),
+    row_apply(&rows[2], pos));
+   return pol->angle;
+}
+
+/*** rnd_cal() -- make up a calibration
+
+The rotation is built from three elemental rotations, as calibrate() does,
+and the offset is of the size hard-iron interference gives.
+***/
+static void rnd_cal(calibration_t * const c) {
+   quat_t e;
+   int i;
+
+   QUAT_IDENTITY(c->orient);
+   for(i = 0; i < 3; i++) {
+      quat_elem(rnd(1000), rnd(1000) | 1, i, &e);
+      quat_compose(&(c->orient), &e);
+   }
+   quat_norm(&(c->orient));
+   c->xlate.x = rnd(300); c->xlate.y = rnd(300); c->xlate.z = rnd(300);
+}
+
+/*** rnd_pts() -- make up readings for a calibration
+
+Points with magnitude 0.15 to 0.85 Ga (at 1090 LSb/Ga) in any direction,
+plus the calibration's offset.
+***/
+static void rnd_pts(const calibration_t * const c) {
+   double r, ang, el;
+   int i;
+
+   for(i = 0; i < NPTS; i++) {
+      r = 160 + 760.0 * rand() / RAND_MAX;
+      ang = 2 * M_PI * rand() / RAND_MAX;
+      el = M_PI * rand() / RAND_MAX - M_PI / 2;
+      pts[i].x = c->xlate.x + lround(r * cos(el) * cos(ang));
+      pts[i].y = c->xlate.y + lround(r * cos(el) * sin(ang));
+      pts[i].z = c->xlate.z + lround(r * sin(el));
+   }
+}
+
+int main(void) {
+   calibration_t cal;
+   heading_xform_t hx;
+   row_t rows[3];
+   fxp_polar_t a, b;
+   volatile fixedpt_t sink;
+   fixedpt_t acc = 0;
+   double t_old = 0, t_new = 0, t;
+   long bad = 0;
+   int c, i, k;
+
+   srand(1);
+   for(c = 0; c < NCAL; c++) {
+      rnd_cal(&cal);
+      heading_set(&hx, &cal);
+      for(i = 0; i < 3; i++) row_set(&rows[i], &hx, i);
+      rnd_pts(&cal);
+
+      for(i = 0; i < NPTS; i++) {
+         heading(&pts[i], &hx, &a);
+         affine_heading(&pts[i], rows, &b);
+         if(a.angle != b.angle || a.z != b.z || a.mag2 != b.mag2) bad++;
+      }
+
+      t = now_ns();
+      for(k = 0; k < REPS; k++) {
+         for(i = 0; i < NPTS; i++) acc += heading(&pts[i], &hx, &a);
+      }
+      t_old += now_ns() - t;
+
+      t = now_ns();
+      for(k = 0; k < REPS; k++) {
+         for(i = 0; i < NPTS; i++) acc += affine_heading(&pts[i], rows, &b);
+      }
+      t_new += now_ns() - t;
+   }
+   sink = acc; (void)sink;
+
+   printf("heading() (%d calibrations x %d readings):\n", NCAL, NPTS);
+   printf("   results: %s", bad ? "MISMATCH" : "identical");
+   if(bad) printf(" (%ld differ)", bad);
+   printf("\n");
+   printf("timing (host CPU):\n");
+   printf("   heading() (subtract+rot_posn+polar) %6.2f ns/sample\n",
+    t_old / ((double)NCAL * REPS * NPTS));
+   printf("   offset folded into rotation         %6.2f ns/sample\n",
+    t_new / ((double)NCAL * REPS * NPTS));
+   return bad ? 1 : 0;
+}
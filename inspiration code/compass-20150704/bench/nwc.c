@@ -0,0 +1,177 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* nwc-bench -- replay a recorded turn through get_nwc(), old and new
+
+get_nwc() (in ../calibrate.c, which is compiled into this program so that
+its static functions can be reached) used to take three square roots per
+reading; it now compares squared distances, with the test for a new S
+done by further(). This program checks both halves of that change:
+
+1. It makes up random readings, N and S points in a 12-bit sensor's range
+   and compares further() with dist_N - dist_NS > dist_S/8 worked out in
+   long double. Cases within 1e-9 of a tie are counted but not judged.
+
+2. It replays a recorded turn (one "X Y Z" reading per line; by default
+   ../../../z_spin.txt) through get_nwc() and through a copy of the
+   square-root version, and prints the N, W and C each one picks (and S,
+   for the old one) and how many readings it took to finish.
+
+Exits non-zero if further() is ever wrong, or if the two loops pick a
+different N, W or C.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "../calibrate.c"
+
+#define NTRIPLES 10000000L
+#define TIE 1e-9L
+
+/* Stand-ins for the sensor, button and display: readings come from a
+   file, the button is never pressed, and nothing is drawn. */
+static FILE *_rec;
+static long _nread;
+
+int hmc5883l_read(hmc5883l_pos_t * const p) {
+   int x, y, z;
+
+   if(fscanf(_rec, " %d%*[ \t,]%d%*[ \t,]%d", &x, &y, &z) != 3)
+      return HMC5883L_ERR_I2C;
+   p->x = x; p->y = y; p->z = z;
+   _nread++;
+   return HMC5883L_ERR_OK;
+}
+
+int hmc5883l_test(hmc5883l_pos_t * const p) { (void)p; return 0; }
+int button(void) { return 0; }
+void matrix8x8_draw(const uint8_t * const img) { (void)img; }
+
+#define DIST(a,b) fxp_dist(a.x - b.x, a.y - b.y, a.z - b.z)
+
+/*** old_nwc() -- get_nwc() as it was, with a square root per distance
+
+Also returns S, which get_nwc() keeps to itself.
+***/
+static int old_nwc(nwc_t * const p, hmc5883l_pos_t * const pos_S) {
+   fixedpt_t dist_N, dist_NS, dist_S, diff, best;
+   int32_t ctr_x = 0L, ctr_y = 0L, ctr_z = 0L;
+   hmc5883l_pos_t pos_prev, pos;
+   int n, rtn;
+
+   if((rtn = hmc5883l_read(&(p->n))) != HMC5883L_ERR_OK) return rtn;
+   poscp(*pos_S, p->n);
+   poscp(pos_prev, p->n);
+   n = 0;
+   dist_NS = 0;
+   best = 0;
+
+   do {
+      if((rtn = hmc5883l_read(&(pos))) != HMC5883L_ERR_OK) return rtn;
+
+      dist_N = DIST(pos, p->n);
+      dist_S = DIST(pos, (*pos_S));
+
+      if(DIST(pos, pos_prev) > DELTA) {
+         ctr_x+=pos.x; ctr_y+=pos.y; ctr_z+=pos.z;
+         n++;
+         poscp(pos_prev, pos);
+      }
+
+      if(dist_N - dist_NS > (dist_S >> 3)) {
+         poscp(*pos_S, pos);
+         best = dist_NS = dist_N; dist_S = 0;
+      }
+
+      diff = fxp_abs(dist_N - dist_S);
+      if(diff < best) {
+         best = diff;
+         poscp(p->w, pos);
+      }
+   } while((dist_N >> 1) > DELTA || (dist_NS >> 2) < DELTA);
+
+   p->c.x = ctr_x / n;
+   p->c.y = ctr_y / n;
+   p->c.z = ctr_z / n;
+
+   return 0;
+}
+
+static fixedpt_t rnd(void) { return (fixedpt_t)(rand() % 4096 - 2048); }
+
+static void rnd_pos(hmc5883l_pos_t * const p) {
+   p->x = rnd(); p->y = rnd(); p->z = rnd();
+}
+
+/*** check_further() -- compare further() with the test on real distances
+
+Returns the number of wrong answers.
+***/
+static long check_further(void) {
+   hmc5883l_pos_t pos, n, s;
+   fxp_usq_t dn, dns, ds;
+   long double d;
+   long i, ties = 0, wrong = 0, yes = 0;
+
+   srand(1);
+   for(i = 0; i < NTRIPLES; i++) {
+      rnd_pos(&pos); rnd_pos(&n);
+      /* S near N half the time, where the margin is smallest */
+      if(i & 1) rnd_pos(&s);
+      else { s.x = n.x + rnd() / 16; s.y = n.y + rnd() / 16; s.z = n.z; }
+      dn = DIST2(pos, n); dns = DIST2(s, n); ds = DIST2(pos, s);
+      d = sqrtl(dn) - sqrtl(dns) - sqrtl(ds) / 8;
+      if(fabsl(d) < TIE) { ties++; continue; }
+      if((d > 0) != (further(dn, dns, ds) != 0)) wrong++;
+      if(d > 0) yes++;
+   }
+   printf("further() against long double (%ld cases, %ld new S):\n",
+    NTRIPLES, yes);
+   printf("   wrong: %ld   ties skipped: %ld\n", wrong, ties);
+   return wrong;
+}
+
+static void show(const char * const what, const hmc5883l_pos_t * const p) {
+   printf(" %s %5d %5d %5d", what, p->x, p->y, p->z);
+}
+
+int main(int argc, char * const argv[]) {
+   const char * const name = argc > 1 ? argv[1] : "../../../z_spin.txt";
+   nwc_t a, b;
+   hmc5883l_pos_t s;
+   long na, nb;
+   int bad;
+
+   bad = check_further() != 0;
+
+   if(!(_rec = fopen(name, "r"))) { perror(name); return 1; }
+   _nread = 0;
+   if(old_nwc(&a, &s)) {
+      fprintf(stderr, "%s: turn not finished\n", name);
+      return 1;
+   }
+   na = _nread;
+   rewind(_rec);
+   _nread = 0;
+   if(get_nwc(&b)) {
+      fprintf(stderr, "%s: turn not finished\n", name);
+      return 1;
+   }
+   nb = _nread;
+   fclose(_rec);
+
+   printf("%s:\n", name);
+   printf("   sqrt:   "); show("N", &a.n); show("W", &a.w); show("S", &s);
+   show("C", &a.c); printf("  %ld readings\n", na);
+   printf("   square: "); show("N", &b.n); show("W", &b.w);
+   show("C", &b.c); printf("  %ld readings\n", nb);
+
+   if(a.n.x != b.n.x || a.n.y != b.n.y || a.n.z != b.n.z ||
+    a.w.x != b.w.x || a.w.y != b.w.y || a.w.z != b.w.z ||
+    a.c.x != b.c.x || a.c.y != b.c.y || a.c.z != b.c.z) {
+      printf("   MISMATCH\n");
+      bad = 1;
+   }
+   return bad;
+}
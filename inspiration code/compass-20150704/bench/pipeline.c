@@ -0,0 +1,241 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* pipe-bench -- check and time the block pipeline, or replay a recording
+
+With no file argument, makes up random calibrations, sensitivity ratios
+and readings, runs them through pipe_run() a block at a time and through
+tempcomp(), heading() and validate() one sample at a time, checks that
+the angle, magnitude, tilt and error flags are identical, then times both
+ways. Exits non-zero if any result differs.
+
+With a file argument, replays a recorded session through the same
+pipeline the firmware runs, as fast as it will go. The file has one raw
+reading per line, as three integers (X Y Z, separated by white space or
+commas). Each reading is printed with its heading and tilt in degrees,
+its magnitude in LSb and its error flags. Nothing is known about the
+sensor that made the recording, so the orientation is taken to be the
+identity and the temperature compensation to be none; -o gives the
+hard-iron offset to subtract, if known.
+
+Usage: pipe-bench [-o x,y,z] [file]
+
+This is built with a much bigger PIPE_BLOCK than the firmware uses (see
+Makefile); the results do not depend on the block size.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "fixedpt.h"
+#include "quat.h"
+#include "calibrate.h"
+#include "heading.h"
+#include "tempcomp.h"
+#include "validate.h"
+#include "pipeline.h"
+
+#define NCAL 64
+#define NBLK 128
+#define REPS 50
+
+static pipe_block_t blks[NBLK];
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static fixedpt_t rnd(const int lim) {
+   return (fixedpt_t)(rand() % (2*lim + 1) - lim);
+}
+
+/*** one_sample() -- the per-sample chain the pipeline replaces ***/
+static uint8_t one_sample(hmc5883l_pos_t pos, const tempcomp_t * const tc,
+ const heading_xform_t * const hx, fxp_polar_t * const pol) {
+   tempcomp(&pos, tc);
+   heading(&pos, hx, pol);
+   return validate(pol);
+}
+
+/*** rnd_setup() -- make up a calibration, ratios and readings
+
+The calibration is as in heading-bench. The sensitivity ratios are within
+10% of one, as a temperature swing gives. The readings have magnitude 0.15
+to 0.85 Ga, so that some fail validate(), and one in 64 is marked as a
+failed sensor read.
+***/
+static void rnd_setup(heading_xform_t * const hx, tempcomp_t * const tc) {
+   calibration_t c;
+   hmc5883l_pos_t cur;
+   quat_t e;
+   double r, ang, el;
+   int b, i;
+
+   QUAT_IDENTITY(c.orient);
+   for(i = 0; i < 3; i++) {
+      quat_elem(rnd(1000), rnd(1000) | 1, i, &e);
+      quat_compose(&(c.orient), &e);
+   }
+   quat_norm(&(c.orient));
+   c.xlate.x = rnd(300); c.xlate.y = rnd(300); c.xlate.z = rnd(300);
+   heading_set(hx, &c);
+
+   c.scale.x = 400 + rnd(40); c.scale.y = 400 + rnd(40);
+   c.scale.z = 400 + rnd(40);
+   cur.x = 400 + rnd(40); cur.y = 400 + rnd(40); cur.z = 400 + rnd(40);
+   tempcomp_set(tc, &cur, &(c.scale));
+
+   for(b = 0; b < NBLK; b++) {
+      blks[b].n = PIPE_BLOCK;
+      for(i = 0; i < PIPE_BLOCK; i++) {
+         r = 160 + 760.0 * rand() / RAND_MAX;
+         ang = 2 * M_PI * rand() / RAND_MAX;
+         el = M_PI * rand() / RAND_MAX - M_PI / 2;
+         blks[b].pos[i].x = c.xlate.x + lround(r * cos(el) * cos(ang));
+         blks[b].pos[i].y = c.xlate.y + lround(r * cos(el) * sin(ang));
+         blks[b].pos[i].z = c.xlate.z + lround(r * sin(el));
+         blks[b].err[i] = (rand() & 63) ? 0 : PIPE_ERR_I2C;
+      }
+   }
+}
+
+static int bench(void) {
+   static hmc5883l_pos_t raw[NBLK][PIPE_BLOCK];
+   static uint8_t flags[NBLK][PIPE_BLOCK];
+   heading_xform_t hx;
+   tempcomp_t tc;
+   fxp_polar_t pol;
+   pipe_block_t w;
+   volatile fixedpt_t sink;
+   fixedpt_t acc = 0;
+   double t_one = 0, t_blk = 0, t;
+   long bad = 0;
+   int c, b, i, k;
+
+   srand(1);
+   for(c = 0; c < NCAL; c++) {
+      rnd_setup(&hx, &tc);
+      for(b = 0; b < NBLK; b++) {
+         for(i = 0; i < PIPE_BLOCK; i++) {
+            raw[b][i] = blks[b].pos[i]; flags[b][i] = blks[b].err[i];
+         }
+         pipe_run(blks + b, &tc, &hx);
+         for(i = 0; i < PIPE_BLOCK; i++) {
+            k = flags[b][i] | one_sample(raw[b][i], &tc, &hx, &pol);
+            w.pol[0] = blks[b].pol[i];
+            if(k != blks[b].err[i]) bad++;
+            else if(!(k & PIPE_ERR_I2C) && (pol.angle != w.pol[0].angle ||
+             pol.z != w.pol[0].z || pol.mag2 != w.pol[0].mag2))
+               bad++;
+         }
+      }
+
+      t = now_ns();
+      for(k = 0; k < REPS; k++) {
+         for(b = 0; b < NBLK; b++) {
+            for(i = 0; i < PIPE_BLOCK; i++) {
+               one_sample(raw[b][i], &tc, &hx, &pol);
+               acc += pol.angle;
+            }
+         }
+      }
+      t_one += now_ns() - t;
+
+      t = now_ns();
+      for(k = 0; k < REPS; k++) {
+         for(b = 0; b < NBLK; b++) {
+            w.n = PIPE_BLOCK;
+            for(i = 0; i < PIPE_BLOCK; i++) {
+               w.pos[i] = raw[b][i]; w.err[i] = 0;
+            }
+            pipe_run(&w, &tc, &hx);
+            acc += w.pol[PIPE_BLOCK - 1].angle;
+         }
+      }
+      t_blk += now_ns() - t;
+   }
+   sink = acc; (void)sink;
+
+   printf("pipe_run() (%d calibrations x %d readings, blocks of %d):\n",
+    NCAL, NBLK * PIPE_BLOCK, PIPE_BLOCK);
+   printf("   results: %s", bad ? "MISMATCH" : "identical");
+   if(bad) printf(" (%ld differ)", bad);
+   printf("\n");
+   printf("timing (host CPU):\n");
+   printf("   one sample at a time    %6.2f ns/sample\n",
+    t_one / ((double)NCAL * REPS * NBLK * PIPE_BLOCK));
+   printf("   pipe_run()              %6.2f ns/sample\n",
+    t_blk / ((double)NCAL * REPS * NBLK * PIPE_BLOCK));
+   return bad ? 1 : 0;
+}
+
+/*** flush() -- run a block of recorded readings through and print it ***/
+static void flush(pipe_block_t * const b, const tempcomp_t * const tc,
+ const heading_xform_t * const hx) {
+   uint8_t i;
+   double mag;
+
+   pipe_run(b, tc, hx);
+   for(i = 0; i < b->n; i++) {
+      mag = sqrt(b->pol[i].mag2);
+      printf("%8.2f %6.0f %7.2f  0x%02x\n",
+       b->pol[i].angle * 180.0 / FIXEDPT_BRAD_SEMICIRC, mag,
+       mag ? asin(b->pol[i].z / mag) * 180 / M_PI : 0.0, b->err[i]);
+   }
+   b->n = 0;
+}
+
+static int replay(const char * const name, const calibration_t * const c) {
+   heading_xform_t hx;
+   tempcomp_t tc;
+   pipe_block_t b;
+   FILE *f;
+   char line[80];
+   int x, y, z;
+
+   if(!(f = fopen(name, "r"))) { perror(name); return 1; }
+   heading_set(&hx, c);
+   tempcomp_set(&tc, &(c->scale), &(c->scale));
+
+   b.n = 0;
+   while(fscanf(f, " %d%*[ \t,]%d%*[ \t,]%d", &x, &y, &z) == 3) {
+      b.pos[b.n].x = x; b.pos[b.n].y = y; b.pos[b.n].z = z;
+      b.err[b.n] = 0;
+      if(++b.n == PIPE_BLOCK) flush(&b, &tc, &hx);
+   }
+   if(b.n) flush(&b, &tc, &hx);
+
+   if(!feof(f)) {
+      fprintf(stderr, "%s: not a reading: %s", name,
+       fgets(line, sizeof(line), f) ? line : "?\n");
+      fclose(f);
+      return 1;
+   }
+   fclose(f);
+   return 0;
+}
+
+int main(int argc, char * const argv[]) {
+   calibration_t c;
+   int opt, x, y, z;
+
+   QUAT_IDENTITY(c.orient);
+   c.xlate.x = c.xlate.y = c.xlate.z = 0;
+   c.scale.x = c.scale.y = c.scale.z = 1;
+
+   while((opt = getopt(argc, argv, "o:")) != -1) {
+      if(opt == 'o' && sscanf(optarg, "%d,%d,%d", &x, &y, &z) == 3) {
+         c.xlate.x = x; c.xlate.y = y; c.xlate.z = z;
+      } else {
+         fprintf(stderr, "usage: %s [-o x,y,z] [file]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   if(optind < argc) return replay(argv[optind], &c);
+   return bench();
+}
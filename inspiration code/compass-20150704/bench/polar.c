@@ -0,0 +1,103 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* polar-bench -- check fxp_polar() and fxp_sincos() against libm
+
+fxp_polar() finds the heading and squared magnitude that heading() and
+validate() use, with one fxp_atan2() and one fxp_dist2(). This program
+checks the angle against libm and the squared magnitude against double
+arithmetic, over points of magnetometer-like size and direction, and
+times it.
+
+It also checks fxp_sincos(), which goes the other way, against libm at
+every angle in a full circle, and times it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "fixedpt.h"
+
+#define NPTS 65536
+#define REPS 100
+#define CIRCLE (2*FIXEDPT_BRAD_SEMICIRC)
+#define DEG(b) ((b) * 180.0 / FIXEDPT_BRAD_SEMICIRC)
+
+static fixedpt_t xs[NPTS], ys[NPTS], zs[NPTS];
+
+static double wrap(double d) {
+   d = fmod(d + FIXEDPT_BRAD_SEMICIRC, CIRCLE);
+   if(d < 0) d += CIRCLE;
+   return d - FIXEDPT_BRAD_SEMICIRC;
+}
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+   double ang, el, r, e, max_ang = 0, max_mag = 0, t0;
+   double max_sin = 0, max_cos = 0;
+   volatile fixedpt_t sink;
+   fixedpt_t acc = 0, sn, cs;
+   fxp_polar_t pol;
+   int i, k;
+
+   /* Points with magnitude 0.15 to 0.85 Ga (at 1090 LSb/Ga), any heading,
+      and up to 40 degrees of tilt either way: */
+   srand(1);
+   for(i = 0; i < NPTS; i++) {
+      r = 160 + 760.0 * rand() / RAND_MAX;
+      ang = 2 * M_PI * rand() / RAND_MAX;
+      el = (80.0 * rand() / RAND_MAX - 40.0) * M_PI / 180;
+      xs[i] = lround(r * cos(el) * cos(ang));
+      ys[i] = lround(r * cos(el) * sin(ang));
+      zs[i] = lround(r * sin(el));
+   }
+
+   for(i = 0; i < NPTS; i++) {
+      fxp_polar(&pol, ys[i], xs[i], zs[i]);
+      ang = atan2(ys[i], xs[i]) * FIXEDPT_BRAD_SEMICIRC / M_PI;
+      r = (double)xs[i]*xs[i] + (double)ys[i]*ys[i] + (double)zs[i]*zs[i];
+      if((e = fabs(wrap(pol.angle - ang))) > max_ang) max_ang = e;
+      if((e = fabs(pol.mag2 - r)) > max_mag) max_mag = e;
+   }
+   printf("fxp_polar() accuracy (%d points):\n", NPTS);
+   printf("   angle: max err %.4f deg\n", DEG(max_ang));
+   printf("   mag2:  max err %.0f\n", max_mag);
+
+   t0 = now_ns();
+   for(k = 0; k < REPS; k++) {
+      for(i = 0; i < NPTS; i++) {
+         fxp_polar(&pol, ys[i], xs[i], zs[i]);
+         acc += pol.angle + pol.z + pol.mag2;
+      }
+   }
+   t0 = now_ns() - t0;
+   printf("   timing %6.2f ns/sample\n", t0 / ((double)REPS * NPTS));
+
+   for(i = 0; i < CIRCLE; i++) {
+      fxp_sincos(i, &sn, &cs);
+      ang = i * M_PI / FIXEDPT_BRAD_SEMICIRC;
+      if((e = fabs(sn - sin(ang) * FIXEDPT_ONE)) > max_sin) max_sin = e;
+      if((e = fabs(cs - cos(ang) * FIXEDPT_ONE)) > max_cos) max_cos = e;
+   }
+   t0 = now_ns();
+   for(k = 0; k < REPS; k++) {
+      for(i = 0; i < NPTS; i++) {
+         fxp_sincos(xs[i], &sn, &cs);
+         acc += sn + cs;
+      }
+   }
+   t0 = now_ns() - t0;
+   sink = acc; (void)sink;
+
+   printf("fxp_sincos() accuracy (%d angles):\n", CIRCLE);
+   printf("   sin:   max err %.3f LSb\n", max_sin);
+   printf("   cos:   max err %.3f LSb\n", max_cos);
+   printf("   timing %6.2f ns/call\n", t0 / ((double)REPS * NPTS));
+   return 0;
+}
@@ -0,0 +1,365 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* fxp-sweep -- exhaustive accuracy sweep and timing of fixedpt.c
+
+Evaluates fxp_atan2(), fxp_dist(), fxp_div(), fxp_scale() and
+fxp_recip_mul(a, fxp_recip(num, den)) (swept like fxp_scale(a, num,
+den)) at every pair of int16 values for their first two arguments,
+compares each result with the same function computed in double precision
+by libm, and prints a histogram of the errors. The third argument of
+fxp_dist(), fxp_scale() and fxp_recip() is taken from a short list of
+values (see funcs[], below); sweeping it too would take 65536 times as
+long.
+
+The work is split by rows (values of the first argument) among threads,
+one per CPU by default. For each function, it also reports:
+
+   o- the smallest and largest (signed) error, and the arguments giving
+      the largest magnitude -- a good place to start looking when a change
+      breaks something
+   o- for fxp_atan2(), the largest error in each octant of the result, so
+      that a mistake in one of the octant folds stands out
+   o- how many points were skipped because they're outside the function's
+      domain (division by zero, or a sum of squares too big for
+      fxp_dist()), and how many had an exact result that doesn't fit in a
+      fixedpt_t (those are counted but not in the histogram)
+   o- the time per call, measured on one thread with no libm reference
+      alongside
+
+Usage: fxp-sweep [-j threads] [-s stride] [function ...]
+
+-s N only evaluates every Nth value of each of the first two arguments,
+for a quick check (-s 16 is 256 times faster than the full sweep). With no
+function names, all of them are swept.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fixedpt.h"
+
+#if FIXEDPT_BITS != 16
+#error fxp-sweep covers the 16-bit fixedpt_t only
+#endif
+
+#define NBUCKETS 18   /* see bucket() */
+#define NTIME (1<<24) /* calls per function when timing */
+#define CIRCLE (2*FIXEDPT_BRAD_SEMICIRC)
+
+/* results of evaluating one point: */
+#define PT_OK 0    /* error was found */
+#define PT_SKIP 1  /* arguments outside the function's domain */
+#define PT_RANGE 2 /* exact result doesn't fit in a fixedpt_t */
+
+typedef struct {
+   const char *name;
+   const char *unit;       /* unit of the error */
+   const int *third;       /* values for the third argument */
+   int nthird;
+   int (*eval)(const int a, const int b, const int c, double * const err,
+    int * const oct);
+   fixedpt_t (*call)(const int a, const int b, const int c);
+} func_t;
+
+typedef struct {
+   uint64_t n, skip, range, hist[NBUCKETS];
+   double min, max, worst, oct[8];
+   int wa, wb, wc;         /* arguments giving the largest |error| */
+} stats_t;
+
+typedef struct {
+   const func_t *f;
+   int id, nthreads, stride;
+   stats_t s;
+} job_t;
+
+/*** wrap() -- reduce an angle difference (in brads) to a half-circle ***/
+static double wrap(double d) {
+   d = fmod(d + FIXEDPT_BRAD_SEMICIRC, CIRCLE);
+   if(d < 0) d += CIRCLE;
+   return d - FIXEDPT_BRAD_SEMICIRC;
+}
+
+/* The evaluators. Each computes the function at one point and the exact
+   answer, and sets *err to the difference (in the function's output
+   units). *oct is the octant of the answer, or zero if that doesn't
+   apply. */
+
+static int ev_atan2(const int y, const int x, const int c,
+ double * const err, int * const oct) {
+   double ref;
+
+   if(x == 0 && y == 0) return PT_SKIP; /* direction is undefined */
+   ref = atan2(y, x) * FIXEDPT_BRAD_SEMICIRC / M_PI;
+   if(ref < 0) ref += CIRCLE;
+   *oct = (int)(ref / (FIXEDPT_BRAD_SEMICIRC/4)) & 7;
+   *err = wrap(fxp_atan2(y, x) - ref);
+   return PT_OK;
+}
+
+static int ev_dist(const int a, const int b, const int c,
+ double * const err, int * const oct) {
+   const int64_t sq = (int64_t)a*a + (int64_t)b*b + (int64_t)c*c;
+   double ref;
+
+   /* fxp_dist() needs the sum of squares to fit in 31 bits. */
+   if(sq > INT32_MAX) return PT_SKIP;
+   ref = sqrt((double)sq);
+   if(ref > INT16_MAX) return PT_RANGE;
+   *err = fxp_dist(a, b, c) - ref;
+   return PT_OK;
+}
+
+static int ev_div(const int a, const int b, const int c,
+ double * const err, int * const oct) {
+   double ref;
+
+   /* The intermediate (a << 16) / b traps for -32768/-1. */
+   if(b == 0 || (a == INT16_MIN && b == -1)) return PT_SKIP;
+   ref = (double)a / b * FIXEDPT_ONE;
+   if(ref < INT16_MIN || ref >= INT16_MAX + 1.0) return PT_RANGE;
+   *err = fxp_div(a, b) - ref;
+   return PT_OK;
+}
+
+static int ev_scale(const int a, const int mul, const int div,
+ double * const err, int * const oct) {
+   double ref;
+
+   ref = (double)a * mul / div;
+   if(ref < INT16_MIN || ref >= INT16_MAX + 1.0) return PT_RANGE;
+   *err = fxp_scale(a, mul, div) - ref;
+   return PT_OK;
+}
+
+static int ev_recip(const int a, const int num, const int den,
+ double * const err, int * const oct) {
+   double ref;
+
+   /* Rounding, and the multiplier's own error, can carry a result within
+      a unit of the limits over them. */
+   ref = (double)a * num / den;
+   if(ref < INT16_MIN + 1 || ref > INT16_MAX - 1) return PT_RANGE;
+   *err = fxp_recip_mul(a, fxp_recip(num, den)) - ref;
+   return PT_OK;
+}
+
+static fixedpt_t call_atan2(const int a, const int b, const int c) {
+   return fxp_atan2(a, b);
+}
+static fixedpt_t call_dist(const int a, const int b, const int c) {
+   return fxp_dist(a, b, c);
+}
+static fixedpt_t call_div(const int a, const int b, const int c) {
+   return fxp_div(a, b);
+}
+static fixedpt_t call_scale(const int a, const int b, const int c) {
+   return fxp_scale(a, b, c);
+}
+static fixedpt_t call_recip(const int a, const int b, const int c) {
+   return fxp_recip_mul(a, fxp_recip(b, c));
+}
+
+/* Third arguments. For fxp_dist(), zero (as in rot_find()) and a typical
+   Z reading; for fxp_scale(), the sort of divisors tempcomp() sees plus
+   some awkward ones. */
+static const int none[] = { 0 };
+static const int dist_c[] = { 0, 500 };
+static const int scale_div[] = { 1, -3, 1090, 1200, FIXEDPT_ONE, 32767 };
+
+static const func_t funcs[] = {
+   { "fxp_atan2", "brad", none, 1, ev_atan2, call_atan2 },
+   { "fxp_dist", "LSb", dist_c, sizeof(dist_c)/sizeof(dist_c[0]),
+     ev_dist, call_dist },
+   { "fxp_div", "LSb", none, 1, ev_div, call_div },
+   { "fxp_scale", "LSb", scale_div, sizeof(scale_div)/sizeof(scale_div[0]),
+     ev_scale, call_scale },
+   { "fxp_recip", "LSb", scale_div, sizeof(scale_div)/sizeof(scale_div[0]),
+     ev_recip, call_recip },
+};
+#define NFUNCS (sizeof(funcs)/sizeof(funcs[0]))
+
+/*** bucket() -- histogram bucket for an error magnitude
+
+Bucket 0 is |e| < 0.5; bucket k (1 to NBUCKETS-2) is 2^(k-2) <= |e| <
+2^(k-1); the last bucket is everything bigger.
+***/
+static int bucket(const double e) {
+   int k;
+   double lim = 0.5;
+
+   for(k = 0; k < NBUCKETS-1; k++, lim *= 2) if(e < lim) return k;
+   return NBUCKETS-1;
+}
+
+static void *sweep(void * const arg) {
+   job_t * const j = arg;
+   stats_t * const s = &j->s;
+   double e, ae;
+   int a, b, i, r, oct;
+
+   for(a = INT16_MIN + j->id * j->stride; a <= INT16_MAX;
+    a += j->nthreads * j->stride) {
+      for(i = 0; i < j->f->nthird; i++) {
+         for(b = INT16_MIN; b <= INT16_MAX; b += j->stride) {
+            oct = 0;
+            r = j->f->eval(a, b, j->f->third[i], &e, &oct);
+            if(r == PT_SKIP) { s->skip++; continue; }
+            if(r == PT_RANGE) { s->range++; continue; }
+            s->n++;
+            if(e < s->min) s->min = e;
+            if(e > s->max) s->max = e;
+            ae = fabs(e);
+            if(ae > s->worst) {
+               s->worst = ae;
+               s->wa = a; s->wb = b; s->wc = j->f->third[i];
+            }
+            if(ae > s->oct[oct]) s->oct[oct] = ae;
+            s->hist[bucket(ae)]++;
+         }
+      }
+   }
+   return NULL;
+}
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*** timing() -- time per call of a function, in ns
+
+Calls the function NTIME times, cycling through a few thousand
+pseudo-random points from its domain.
+***/
+static double timing(const func_t * const f) {
+   static int as[4096], bs[4096], cs[4096];
+   volatile fixedpt_t sink;
+   fixedpt_t acc = 0;
+   double e, t;
+   int i, oct;
+
+   srand(1);
+   for(i = 0; i < 4096; ) {
+      as[i] = (int16_t)rand(); bs[i] = (int16_t)rand();
+      cs[i] = f->third[rand() % f->nthird];
+      if(f->eval(as[i], bs[i], cs[i], &e, &oct) != PT_SKIP) i++;
+   }
+
+   t = now_ns();
+   for(i = 0; i < NTIME; i++) acc += f->call(as[i&4095], bs[i&4095], cs[i&4095]);
+   t = now_ns() - t;
+   sink = acc; (void)sink;
+   return t / NTIME;
+}
+
+static void report(const func_t * const f, const stats_t * const s,
+ const int nthreads, const double secs) {
+   char lbl[32];
+   double lo, hi;
+   int k;
+
+   printf("%s (%llu points, %llu skipped, %llu out of range; "
+    "%d threads, %.1f s):\n", f->name, (unsigned long long)s->n,
+    (unsigned long long)s->skip, (unsigned long long)s->range, nthreads, secs);
+   if(!s->n) return;
+   printf("   error (%s): min %.3f, max %.3f; largest at (%d, %d", f->unit,
+    s->min, s->max, s->wa, s->wb);
+   if(f->nthird > 1) printf(", %d", s->wc);
+   printf(")\n");
+   for(k = 0; k < NBUCKETS; k++) {
+      if(!s->hist[k]) continue;
+      lo = k ? ldexp(1, k-2) : 0; hi = ldexp(1, k-1);
+      if(k < NBUCKETS-1) snprintf(lbl, sizeof(lbl), "[%g, %g)", lo, hi);
+      else snprintf(lbl, sizeof(lbl), "[%g, -)", lo);
+      printf("      %-16s %12llu  %8.4f%%\n", lbl,
+       (unsigned long long)s->hist[k], 100.0 * s->hist[k] / s->n);
+   }
+   if(f->eval == ev_atan2) {
+      printf("   max |error| by octant:");
+      for(k = 0; k < 8; k++) printf(" %.2f", s->oct[k]);
+      printf("\n");
+   }
+}
+
+int main(int argc, char * const argv[]) {
+   long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   int stride = 1, opt, i, t, want[NFUNCS], any = 0;
+   pthread_t *tid;
+   job_t *job;
+   stats_t s;
+   double t0;
+
+   while((opt = getopt(argc, argv, "j:s:")) != -1) {
+      switch(opt) {
+         case 'j': nthreads = atol(optarg); break;
+         case 's': stride = atoi(optarg); break;
+         default:
+            fprintf(stderr,
+             "usage: %s [-j threads] [-s stride] [function ...]\n", argv[0]);
+            return 1;
+      }
+   }
+   if(nthreads < 1) nthreads = 1;
+   if(stride < 1) stride = 1;
+
+   for(i = 0; i < NFUNCS; i++) want[i] = optind >= argc;
+   for(; optind < argc; optind++) {
+      for(i = 0; i < NFUNCS; i++) {
+         if(!strcmp(argv[optind], funcs[i].name)) { want[i] = 1; break; }
+      }
+      if(i == NFUNCS) {
+         fprintf(stderr, "%s: unknown function %s\n", argv[0], argv[optind]);
+         return 1;
+      }
+   }
+
+   tid = malloc(nthreads * sizeof(*tid));
+   job = malloc(nthreads * sizeof(*job));
+   if(!tid || !job) { perror(argv[0]); return 1; }
+
+   for(i = 0; i < NFUNCS; i++) {
+      if(!want[i]) continue;
+      if(any++) printf("\n");
+
+      t0 = now_ns();
+      for(t = 0; t < nthreads; t++) {
+         memset(&job[t], 0, sizeof(job[t]));
+         job[t].f = &funcs[i];
+         job[t].id = t; job[t].nthreads = nthreads; job[t].stride = stride;
+         if(pthread_create(&tid[t], NULL, sweep, &job[t])) {
+            perror(argv[0]);
+            return 1;
+         }
+      }
+
+      memset(&s, 0, sizeof(s));
+      for(t = 0; t < nthreads; t++) {
+         const stats_t * const js = &job[t].s;
+         int k;
+
+         pthread_join(tid[t], NULL);
+         s.n += js->n; s.skip += js->skip; s.range += js->range;
+         for(k = 0; k < NBUCKETS; k++) s.hist[k] += js->hist[k];
+         for(k = 0; k < 8; k++) if(js->oct[k] > s.oct[k]) s.oct[k] = js->oct[k];
+         if(js->min < s.min) s.min = js->min;
+         if(js->max > s.max) s.max = js->max;
+         if(js->worst > s.worst || (t == 0 && js->n)) {
+            s.worst = js->worst;
+            s.wa = js->wa; s.wb = js->wb; s.wc = js->wc;
+         }
+      }
+
+      report(&funcs[i], &s, nthreads, (now_ns() - t0) / 1e9);
+      printf("   timing (one thread): %.2f ns/op\n", timing(&funcs[i]));
+   }
+
+   free(tid); free(job);
+   return 0;
+}
@@ -13,22 +13,30 @@ Tests if the input button is pressed. If so:
    o- illuminate all the segments in the display (as both a confirmation
       that the input was recognized, and as a lamp test)
    o- wait for a debounce period
-   o- wait until button is released
+   o- wait until button is released, blanking the display once it has
+      been held for BTN_LONG_MS (so the user knows to let go)
    o- wait for a second debounce period
 
-Returns 0 if no button press was detected, or returns non-0 if the button
-was pressed and released.
+Returns 0 if no button press was detected. If the button was pressed and
+released, returns BTN_LONG if it was held for at least BTN_LONG_MS, or
+BTN_SHORT otherwise. (Both are non-0, so callers that don't care how long
+the press was can just test for that.)
 ***/
 int button(void) {
    uint8_t img[8];
+   uint16_t held;
 
    if(!BTN_PRESSED) return 0;
    memset(img, 0xff, 8); matrix8x8_draw(img); /* lamp test */
    _delay_ms(DEBOUNCE_DOWN); /* wait for contacts to settle closed */
-   while(BTN_PRESSED); /* wait for button to be released */
+
+   /* wait for button to be released, timing it up to BTN_LONG_MS */
+   for(held = DEBOUNCE_DOWN; BTN_PRESSED; _delay_ms(1)) {
+      if(held < BTN_LONG_MS && ++held == BTN_LONG_MS) matrix8x8_clear();
+   }
    _delay_ms(DEBOUNCE_UP); /* wait for contacts to settle open */
 
-   return 1;
+   return held < BTN_LONG_MS ? BTN_SHORT : BTN_LONG;
 }
 
 /*** button_sleep() -- wait for fixed delay or button press
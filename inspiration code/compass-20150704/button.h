@@ -14,6 +14,11 @@
 
 #define BTN_PRESSED ((BTN_PIN & BTN_PINBIT) == 0)
 
+/* non-0 return values from button(): */
+#define BTN_SHORT 1 /* pressed and released */
+#define BTN_LONG  2 /* held down for at least BTN_LONG_MS */
+#define BTN_LONG_MS 1500
+
 int button(void);
 int button_sleep(const int ms);
 
@@ -4,18 +4,51 @@
 #include <avr/pgmspace.h>
 #include <hmc5883l/hmc5883l.h>
 #include <matrix8x8/matrix8x8.h>
-#include "rotate.h"
+#include "quat.h"
 #include "calibrate.h"
 #include "button.h"
 
 typedef struct { hmc5883l_pos_t n, w, c; } nwc_t;
 
-#if FIXEDPT_FRACBITS < 6
-#error This code assumes FIXEDPT_FRACBITS is at least 6.
-#endif
-#define DELTA ((fixedpt_t)(1 << (FIXEDPT_FRACBITS-6)))
+/* DELTA is the smallest movement counted as a new point on the calibration
+   circle: about 0.03Ga, or 32 counts at the usual gain. Readings are raw
+   sensor counts whatever FIXEDPT_FRACBITS is, so it's derived from the
+   gain rather than from the fixed-point format. */
+#define DELTA ((fixedpt_t)(0.03 * HMC5883L_GAIN))
 
-#define DIST(a,b) fxp_dist(a.x - b.x, a.y - b.y, a.z - b.z)
+/* DIST2() is the squared distance between two points. get_nwc() only
+   compares distances, so it works with squares throughout and never needs
+   a square root. */
+#define DIST2(a,b) fxp_dist2(a.x - b.x, a.y - b.y, a.z - b.z)
+
+/*** further() -- test a reading against the current S, with squares
+
+Takes the squares of three distances (as from fxp_dist2()): dn from the
+reading to N, dns from S to N, and ds from the reading to S. Returns non-0
+if the reading is further from N than S is by more than an eighth of its
+distance to S, i.e. if dist_N - dist_NS > dist_S/8, without a square root.
+
+Both sides of 8*dist_N > 8*dist_NS + dist_S are positive, so squaring
+them gives the same test: 64*dn > 64*dns + 16*dist_NS*dist_S + ds. Let L
+be 64*(dn - dns) - ds; then the test holds just when L > 0 and
+L^2 > 256*dns*ds.
+
+Readings from a 12-bit sensor give squares below 2^26, so L^2 fits in 64
+bits and the result is exact. Bigger squares are scaled down first, which
+keeps the arithmetic in range at the cost of exactness.
+***/
+static uint8_t further(fxp_usq_t dn, fxp_usq_t dns, fxp_usq_t ds) {
+   uint64_t l;
+
+   while((dn | dns | ds) >= (fxp_usq_t)1 << 26) {
+      dn >>= 2; dns >>= 2; ds >>= 2;
+   }
+   if(dn <= dns) return 0;
+   l = (uint64_t)(dn - dns) << 6;
+   if(l <= ds) return 0;
+   l -= ds;
+   return l * l > ((uint64_t)dns * ds) << 8;
+}
 
 /*** get_nwc() -- obtain points N, W and C used as basis for calibration
 
@@ -38,10 +71,10 @@ Returns:
    0 -- success
   <0 -- one of the HMC5883L_ERR_* values (other than HMC5883L_ERR_OK)
       indicating a failure due to a magnetic sensor problem
-  >0 -- user cancelled operation
+  >0 -- user cancelled operation (CAL_CANCEL)
 ***/
 static int get_nwc(nwc_t * const p) {
-   fixedpt_t dist_N, dist_NS, dist_S, diff, best;
+   fxp_usq_t dist_N, dist_NS, dist_S, diff, best;
    int32_t ctr_x = 0L, ctr_y = 0L, ctr_z = 0L;
    hmc5883l_pos_t pos_S, pos_prev, pos;
    int n, rtn;
@@ -51,23 +84,25 @@ static int get_nwc(nwc_t * const p) {
    poscp(pos_S, p->n);
    poscp(pos_prev, p->n);
    n = 0;
-   dist_NS = FIXEDPT_ZERO; /* N and S are the same, so distance is zero */
-   best = FIXEDPT_ZERO;
+   dist_NS = 0; /* N and S are the same, so distance is zero */
+   best = 0;
 
    do { /* calibration loop */
-      if(button()) return 1; /* button pressed -> cancel calibration */
+      /* button pressed -> cancel calibration */
+      if(button()) return CAL_CANCEL;
 
       /* take a reading */
       if((rtn = hmc5883l_read(&(pos))) != HMC5883L_ERR_OK) return rtn;
 
-      /* Find the distances from the point just read to the current N and S: */
-      dist_N = DIST(pos, p->n);
-      dist_S = DIST(pos, pos_S);
+      /* Find the (squared) distances from the point just read to the
+         current N and S: */
+      dist_N = DIST2(pos, p->n);
+      dist_S = DIST2(pos, pos_S);
 
       /* If the current point is more than a fixed distance away from
          pos_prev, add it to the points averaged to find the center and
          let it be the new pos_prev: */
-      if(DIST(pos, pos_prev) > DELTA) {
+      if(DIST2(pos, pos_prev) > FXP_SQ(DELTA)) {
          ctr_x+=pos.x; ctr_y+=pos.y; ctr_z+=pos.z;
          n++;
          poscp(pos_prev, pos);
@@ -81,21 +116,28 @@ static int get_nwc(nwc_t * const p) {
          curve. If N is near the minor axis of a highly-eccentric ellipse,
          then there are two points at a maximum distance from N, and we
          want to find the first one. Because of jitter, the second one may
-         look (slightly) further away... */
-      if(dist_N - dist_NS > (dist_S >> 3)) {
+         look (slightly) further away...
+
+         The test is dist_N - dist_NS > dist_S/8, done on the squares by
+         further(). */
+      if(further(dist_N, dist_NS, dist_S)) {
          poscp(pos_S, pos);
-         best = dist_NS = dist_N; dist_S = FIXEDPT_ZERO;
+         best = dist_NS = dist_N; dist_S = 0;
       }
 
-      diff = fxp_abs(dist_N - dist_S);
+      /* W is the point equidistant from N and S. |dist_N^2 - dist_S^2| is
+         zero at the same places |dist_N - dist_S| is, so the point that
+         comes closest is (near enough) the same. */
+      diff = dist_N > dist_S ? dist_N - dist_S : dist_S - dist_N;
       if(diff < best) {
          best = diff;
          poscp(p->w, pos);
       }
 
    /* End the calibration loop when the most recent reading is close to
-      the original position and the distance from N to S is big. */
-   } while((dist_N >> 1) > DELTA || (dist_NS >> 2) < DELTA);
+      the original position (within 2*DELTA) and the distance from N to S
+      is big (at least 4*DELTA). */
+   } while(dist_N > FXP_SQ(2*DELTA) || dist_NS < FXP_SQ(4*DELTA));
 
    p->c.x = ctr_x / n;
    p->c.y = ctr_y / n;
@@ -107,22 +149,24 @@ static int get_nwc(nwc_t * const p) {
 /*** elem_rot() -- find and perform an elemental rotation
 
 Finds and performs an elemental rotation, rotating the N and W points
-and (optionally) multiplying an existing rotation matrix.
+and adding the rotation to the orientation found so far.
 
-The first four arguments are as per rot_find(), which see.
+The first three arguments are as per rot_find(), which see.
+
+Argument four is a pointer to the orientation, which will be followed by
+the new rotation (see quat_compose()).
 
 Argument five is a pointer to an nwc_t. The N and W points inside will
 be transformed using the rotation found.
-
-Argument six is a pointer to a rotation matrix to be multiplied by the
-new rotation, or NULL if no such multiplication is needed.
 ***/
 static void elem_rot(const fixedpt_t a, const fixedpt_t b, const int idx,
- rotation_t * const dst, nwc_t * const nwc, rotation_t * const prod) {
-   rot_find(a, b, idx, dst);
-   rot_posn(&(nwc->n), dst);
-   rot_posn(&(nwc->w), dst);
-   if(prod) rot_mult(prod, dst);
+ quat_t * const q, nwc_t * const nwc) {
+   quat_t e;
+
+   quat_elem(a, b, idx, &e);
+   quat_rotate(&(nwc->n), &e);
+   quat_rotate(&(nwc->w), &e);
+   quat_compose(q, &e);
 }
 
 /*** calibrate() -- find translation and rotation data for magnetometer
@@ -149,10 +193,9 @@ Returns:
    0 -- success
   <0 -- one of the HMC5883L_ERR_* values (other than HMC5883L_ERR_OK)
       indicating a failure due to a magnetic sensor problem
-  >0 -- user cancelled operation
+  >0 -- user cancelled operation (CAL_CANCEL)
 ***/
 int calibrate(calibration_t * const p) {
-   rotation_t r;
    nwc_t nwc;
    uint8_t img[8];
    int rtn;
@@ -181,25 +224,43 @@ int calibrate(calibration_t * const p) {
    nwc.n.x -= nwc.c.x; nwc.n.y -= nwc.c.y; nwc.n.z -= nwc.c.z;
    nwc.w.x -= nwc.c.x; nwc.w.y -= nwc.c.y; nwc.w.z -= nwc.c.z;
 
+   QUAT_IDENTITY(p->orient);
+
    /* If N is closer to the Y axis than to the Z axis... */
    if(fxp_abs(nwc.n.x) > fxp_abs(nwc.n.z)) {
       /* Find Rz to put N above/below the positive Y axis on the YZ plane: */
-      elem_rot(-(nwc.n.x), nwc.n.y, 2, &(p->rotate), &nwc, NULL);
+      elem_rot(-(nwc.n.x), nwc.n.y, 2, &(p->orient), &nwc);
 
       /* Find Rx to put N on the positive Y axis: */
-      elem_rot(nwc.n.z, nwc.n.y, 0, &r, &nwc, &(p->rotate));
+      elem_rot(nwc.n.z, nwc.n.y, 0, &(p->orient), &nwc);
 
    } else { /* N is closer to the Z axis than the X axis */
       /* Find Rx to put N to the left/right of the positive Y axis on the
          XY plane: */
-      elem_rot(nwc.n.z, nwc.n.y, 0, &(p->rotate), &nwc, NULL);
+      elem_rot(nwc.n.z, nwc.n.y, 0, &(p->orient), &nwc);
 
       /* Find Rz to put N on the positive Y axis: */
-      elem_rot(-(nwc.n.x), nwc.n.y, 2, &r, &nwc, &(p->rotate));
+      elem_rot(-(nwc.n.x), nwc.n.y, 2, &(p->orient), &nwc);
    }
 
    /* Find Ry to put W on the negative-X half of the XY plane. */
-   elem_rot(nwc.w.z, -(nwc.w.x), 1, &r, &nwc, &(p->rotate));
+   elem_rot(nwc.w.z, -(nwc.w.x), 1, &(p->orient), &nwc);
+   quat_norm(&(p->orient));
 
    return 0;
 }
+
+/*** calibrate_rezero() -- make the current heading north
+
+Turns the calibration about the yaw axis so that a reading which gave
+heading hdg (in binary radians, as from heading()) now gives zero. The
+translation and the tilt part of the rotation are left alone, so there is
+no need to turn a full circle again.
+
+Arguments:
+   p -- pointer to the calibration data, which are updated
+   hdg -- the heading that should become north
+***/
+void calibrate_rezero(calibration_t * const p, const fixedpt_t hdg) {
+   quat_yaw(&(p->orient), hdg);
+}
@@ -4,14 +4,21 @@
 #define CALIBRATE_H
 
 #include <hmc5883l/hmc5883l.h>
-#include "rotate.h"
+#include "quat.h"
 
 typedef struct {
    hmc5883l_pos_t scale; /* self-test for temperature compensation */
    hmc5883l_pos_t xlate;
-   rotation_t rotate;
+   quat_t orient;        /* sensor-to-belt rotation */
+   uint8_t format;       /* set by stored_cal_set(); see stored_cal.c */
+   uint8_t check;
 } calibration_t;
 
+/* positive return values from calibrate(): */
+#define CAL_CANCEL 1 /* user cancelled calibration */
+
 int calibrate(calibration_t * const p) __attribute__((nonnull(1)));
+void calibrate_rezero(calibration_t * const p, const fixedpt_t hdg)
+ __attribute__((nonnull(1)));
 
 #endif /* ifndef CALIBRATE_H */
@@ -15,23 +15,25 @@
 #include "stored_cal.h"
 #include "tempcomp.h"
 #include "validate.h"
+#include "pipeline.h"
+#include "sector_tbl.h"
+#include "frame_tbl.h"
 
 #define BRIGHTNESS 10 /* 0=dim, 15=max */
-#define ARC (FIXEDPT_BRAD_SEMICIRC >> 4) /* one 32nd of a circle */
 #define TCOMP_PERIOD 6000
 
+#if SECTOR_N != FRAME_POINTS
+#error frame_tbl.h needs SECTOR_N to be the number of points it has frames for
+#endif
+
 /*** flash_err() -- blink "ERR" indicator at 1Hz; stop on button press
 
 Flashes the "ERR" indication on and off at 1Hz until the user presses
 the button.
 ***/
 static void flash_err(void) {
-   uint8_t img[8];
-
-   memset(img, 0, 8);
-   img[2] = 0b10000000; img[3] = 0b10000000; img[4] = 0b10000000;
    while(1) {
-      matrix8x8_draw(img);
+      matrix8x8_drawP(_frame_tbl[FRAME_ERR]);
       if(button_sleep(500)) return;
       matrix8x8_clear();
       if(button_sleep(500)) return;
@@ -41,19 +43,22 @@ static void flash_err(void) {
 int main(void) {
    int rtn;
    calibration_t calib;
-   hmc5883l_pos_t p, tcal;
-   fixedpt_t hdg, prev = 0;
+   heading_xform_t hx;
+   hmc5883l_pos_t tcal;
+   tempcomp_t tc;
+   pipe_block_t blk;
+   fixedpt_t hdg;
    uint16_t tcomp_cnt = 0;
-   uint8_t img[8];
+   uint8_t i, pt, prev = 0, rezero = 0, frame;
 
-   power_timer1_disable();  /* turn off to save power */
-   power_adc_disable();     /* likewise */
+   power_adc_disable();     /* turn off to save power */
    BTN_DDR &= ~BTN_DDRBIT;  /* make button pin an input */
    BTN_PORT |= BTN_PORTBIT; /* activate internal pull-up on button pin */
 
    uWireM_init();              /* set up I2C communication library */
+   sei();                      /* ...which runs the bus from interrupts */
    matrix8x8_init(BRIGHTNESS); /* set up 8x8 LED matrix */
-   hmc5883l_init();            /* set up magnetometer */
+   hmc5883l_init();            /* set up magnetometer (and Timer1) */
 
    /* If there is no calibration data in the EEPROM, force calibration
       before we proceed: */
@@ -61,15 +66,22 @@ int main(void) {
       while(calibrate(&calib)) flash_err();
       stored_cal_set(&calib);
       memcpy(&tcal, &(calib.scale), sizeof(hmc5883l_pos_t));
+      tempcomp_set(&tc, &tcal, &(calib.scale));
       tcomp_cnt = TCOMP_PERIOD;
    }
+   heading_set(&hx, &calib);
 
    while(1) {
-      if(button()) { /* if button is pressed, attempt re-calibration */
+      /* A long press means the way the user is facing is to be north;
+         any other press starts a re-calibration. */
+      if((rtn = button()) == BTN_LONG) rezero = 1;
+      else if(rtn) {
          /* attempt calibration; store in EEPROM on success */
          if((rtn = calibrate(&calib)) == 0) {
             stored_cal_set(&calib);
+            heading_set(&hx, &calib);
             memcpy(&tcal, &(calib.scale), sizeof(hmc5883l_pos_t));
+            tempcomp_set(&tc, &tcal, &(calib.scale));
             tcomp_cnt = TCOMP_PERIOD;
          } else { /* calibration failed */
             stored_cal_get(&calib); /* get previous settings */
@@ -80,85 +92,83 @@ int main(void) {
          }
       }
 
-      memset(img, 0, 8);
-
-      /* get a raw compass reading; detect and display any errors */
-      if((rtn = hmc5883l_read(&p)) == HMC5883L_ERR_SATURATED) {
-         img[3]=0b00000010; img[4]=0b00000010; /* "INTF" */
-         img[5]=0b00000010; img[6]=0b00000010;
-         matrix8x8_draw(img);
-         continue; 
-      } else if(rtn != HMC5883L_ERR_OK) {
-         img[2] = 0b10000000; img[3] = 0b10000000; img[4] = 0b10000000;
-         matrix8x8_draw(img); /* "ERR" */
-         continue; 
+      /* Get a block of raw readings. Stop early if one fails, so that
+         the error is shown without delay. Each hmc5883l_poll() that
+         returns a reading starts the next measurement, so the sensor is
+         busy with the first reading of the next block while this one is
+         processed and displayed below. */
+      for(blk.n = 0; blk.n < PIPE_BLOCK; ) {
+         i = blk.n;
+         while((rtn = hmc5883l_poll(blk.pos + i)) == HMC5883L_ERR_BUSY);
+         blk.n++;
+         if(rtn == HMC5883L_ERR_OK)
+            blk.err[i] = 0;
+         else {
+            blk.err[i] = rtn == HMC5883L_ERR_SATURATED ? PIPE_ERR_SAT :
+             PIPE_ERR_I2C;
+            break;
+         }
       }
 
       /* If we haven't gotten temperature compensation data in a while,
-         get some and reset the counter. Otherwise, decrement the counter. */
-      if(tcomp_cnt == 0) {
+         get some and reset the counter. Otherwise, count down the
+         readings just taken. */
+      if(tcomp_cnt < blk.n) {
          if(hmc5883l_test(&tcal) != HMC5883L_ERR_OK) {
-            img[2] = 0b10000000; img[3] = 0b10000000; img[4] = 0b10000000;
-            matrix8x8_draw(img); /* "ERR" */
+            matrix8x8_drawP(_frame_tbl[FRAME_ERR]);
             continue;
          }
+         tempcomp_set(&tc, &tcal, &(calib.scale));
          tcomp_cnt = TCOMP_PERIOD;
-      } else tcomp_cnt--;
-
-      /* temperature-compensate the raw reading */
-      tempcomp(&p, &tcal, &(calib.scale));
-
-      /* Offset and rotate reading per calibration data. Calculate
-         heading. */
-      hdg = heading(&p, &calib);
+      } else tcomp_cnt -= blk.n;
+
+      /* Temperature-compensate, offset and rotate each reading per
+         calibration data, calculate heading (and, along the way,
+         magnitude and tilt), and validate the result. */
+      pipe_run(&blk, &tc, &hx);
+
+      /* Only the newest reading is displayed, but every good one goes
+         through the hysteresis below, as if it had been. */
+      for(i = 0; i < blk.n; i++) {
+         if(blk.err[i]) continue;
+         hdg = blk.pol[i].angle;
+
+         /* Look up which of the 16 points the heading is nearest. The
+            table adds a slight hysteresis, to prevent display flickering
+            when we're just on the border between two adjacent points:
+            near a border, it says to stay on the previous point if that's
+            the one on the other side. */
+         pt = pgm_read_byte(_sector_tbl +
+          ((ufixedpt_t)hdg >> SECTOR_TBL_SHIFT));
+         if((pt >> 4) == prev) pt = prev;
+         else pt &= 0x0f;
+         prev = pt;
+      }
 
-      /* Validate adjusted reading and display error indication if
-         warranted: */
-      if((rtn = validate(&p)) != VLD_ERR_OK) {
-         if(rtn & VLD_ERR_TILT) {
-            img[2] |= 0b00000001; img[3] |= 0b00000001;
-            img[4] |= 0b00000001; img[5] |= 0b00000001;
-         }
-         if(rtn & VLD_ERR_INTF) {
-            img[3] |= 0b00000010; img[4] |= 0b00000010; /* "INTF" */
-            img[5] |= 0b00000010; img[6] |= 0b00000010;
+      /* Display error indication for the newest reading if warranted: */
+      if((rtn = blk.err[blk.n - 1]) != 0) {
+         /* A failed read shows "ERR" alone. Otherwise, the frame for
+            the warnings is FRAME_ERR with a bit set for each. */
+         frame = FRAME_ERR;
+         if(!(rtn & PIPE_ERR_I2C)) {
+            if(rtn & VLD_ERR_TILT) frame |= FRAME_TILT;
+            if(rtn & (VLD_ERR_INTF | PIPE_ERR_SAT)) frame |= FRAME_INTF;
          }
-         matrix8x8_draw(img);
+         matrix8x8_drawP(_frame_tbl[frame]);
          continue;
       }
 
-#ifdef FORGET_THIS_FOR_NOW
-      // FIXME: put something sensible on top line
-      img[0] = ((hdg >> 4) & 0x00ff);
-#endif /* ifdef FORGET_THIS_FOR_NOW */
-
-      /* Add a slight hysteresis to the heading to prevent display flickering
-         when we're just on the border between two adjacent readings: */
-      if(fxp_abs(prev-hdg) < (ARC >> 3)) hdg = prev;
-      else prev = hdg;
-
-      if(hdg <= ARC*7 || hdg > ARC*25) { /* Northerly 7 directions */
-         img[5]=0b01111100; /* NORTH */
-         /* If NNE or NNW, add the extra "NORTH" prefix... */
-         if((hdg > ARC*29 && hdg <= ARC*31) ||
-          (hdg > ARC && hdg <= ARC*3)) img[3] = 0b01111100;
-
-      } else if(hdg > ARC*9 && hdg <= ARC*23) { /* Southerly 7 */
-         img[6]=0b01111100; /* SOUTH */
-         if((hdg > ARC*13 && hdg <= ARC*15) ||
-          (hdg > ARC*17 && hdg <= ARC*19)) img[4] = 0b01111100; /* S prefix */
-      }
-
-      if(hdg > ARC && hdg <= ARC*15) { /* Easterly 7 */
-         img[7]=0b11110000; /* EAST */
-         if((hdg > ARC*5 && hdg <= ARC*7) ||
-          (hdg > ARC*9 && hdg <= ARC*11)) img[2] = 0b11110000; /* E prefix */
-      } else if(hdg > ARC*17 && hdg <= ARC*31) { /* Westerly 7 */
-         img[7]=0b00001111; /* WEST */
-         if((hdg > ARC*21 && hdg <= ARC*23) ||
-          (hdg > ARC*25 && hdg <= ARC*27)) img[2] = 0b00001111; /* W prefix */
+      /* Re-zero north on the first good reading after being asked to: */
+      if(rezero) {
+         calibrate_rezero(&calib, hdg);
+         stored_cal_set(&calib);
+         heading_set(&hx, &calib);
+         rezero = 0;
+         continue;
       }
 
-      matrix8x8_draw(img);
+      /* The frames for the points are in the same order as the sectors,
+         ready to send as they are. */
+      matrix8x8_drawP(_frame_tbl[pt]);
    }
 }
@@ -0,0 +1,50 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef CORDIC_TBL_H
+#define CORDIC_TBL_H
+
+/* This table is shared by fixedpt.c and the host-side batch kernels in
+   host/fixedpt_n.c, which must step through exactly the same angles. It
+   expects <avr/pgmspace.h> and fixedpt.h to have been included already. */
+
+/* Table of coefficients used for CORDIC atan2() implementation. Values
+   are atan(2^(-i)) in binary radians (where a semicircle is
+   FIXEDPT_BRAD_SEMICIRC), times four. Note that _tbl[0] is never used, but
+   shifting all the elements costs more than two bytes elsewhere... */
+/* The entries are written as radians and converted by the compiler, so
+   they follow FIXEDPT_FRACBITS. Iterations past i = FIXEDPT_FRACBITS would
+   add less than one brad, so that is where the table stops. (At the
+   default FIXEDPT_FRACBITS of 11, these come out as 0x4000, 0x25c8, 0x13f6,
+   ... 0x000a, exactly as the table used to be written by hand.) */
+#define CORDIC_ENT(rad) \
+ ((fixedpt_t)((rad) * (4.0 * FIXEDPT_BRAD_SEMICIRC / 3.14159265358979324) + 0.5))
+#if FIXEDPT_FRACBITS > 23
+#error CORDIC table needs more entries for this FIXEDPT_FRACBITS
+#endif
+/* http://arduino.cc/en/Reference/PROGMEM says: "Some cryptic bugs are
+   generated by using ordinary datatypes for program memory calls." Vague,
+   and prog_int16_t doesn't seem to be in the headers anymore as of
+   24 May 2014. So, we'll just use fixedpt_t here: */
+static const fixedpt_t _tbl[] PROGMEM = {
+   CORDIC_ENT(7.8539816339744831e-01), CORDIC_ENT(4.6364760900080612e-01),
+   CORDIC_ENT(2.4497866312686414e-01), CORDIC_ENT(1.2435499454676144e-01),
+   CORDIC_ENT(6.2418809995957349e-02), CORDIC_ENT(3.1239833430268277e-02),
+   CORDIC_ENT(1.5623728620476831e-02), CORDIC_ENT(7.8123410601011113e-03),
+   CORDIC_ENT(3.9062301319669718e-03), CORDIC_ENT(1.9531225164788188e-03),
+   CORDIC_ENT(9.7656218955931946e-04), CORDIC_ENT(4.8828121119489829e-04),
+#if FIXEDPT_FRACBITS > 11
+   CORDIC_ENT(2.4414062014936177e-04), CORDIC_ENT(1.2207031189367021e-04),
+   CORDIC_ENT(6.1035156174208773e-05), CORDIC_ENT(3.0517578115526096e-05),
+#endif
+#if FIXEDPT_FRACBITS > 15
+   CORDIC_ENT(1.5258789061315762e-05), CORDIC_ENT(7.6293945311019700e-06),
+   CORDIC_ENT(3.8146972656064961e-06), CORDIC_ENT(1.9073486328101870e-06),
+#endif
+#if FIXEDPT_FRACBITS > 19
+   CORDIC_ENT(9.5367431640596084e-07), CORDIC_ENT(4.7683715820308884e-07),
+   CORDIC_ENT(2.3841857910155797e-07), CORDIC_ENT(1.1920928955078068e-07),
+#endif
+};
+#define CORDIC_ITER (sizeof(_tbl)/sizeof(_tbl[0]))
+
+#endif /* ifndef CORDIC_TBL_H */
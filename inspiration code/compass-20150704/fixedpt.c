@@ -3,10 +3,20 @@
 #include <stdint.h>
 #include <avr/pgmspace.h>
 #include "fixedpt.h"
+#include "cordic_tbl.h"
+#if FIXEDPT_BITS == 16
+#include "atan_tbl.h"
+#endif
 
 /* fxp_t is an integer type wider than fixedpt_t, used internally to store
-   intermediate values. */
+   intermediate values. pgm_read_fxp() reads a fixedpt_t from PROGMEM. */
+#if FIXEDPT_BITS == 16
 typedef int32_t fxp_t;
+#define pgm_read_fxp(p) ((fixedpt_t)pgm_read_word(p))
+#else
+typedef int64_t fxp_t;
+#define pgm_read_fxp(p) ((fixedpt_t)pgm_read_dword(p))
+#endif
 
 /*** fxp_mul() -- multiply two fixed-point values
 
@@ -18,6 +28,20 @@ CONSTFUNC fixedpt_t fxp_mul(const fixedpt_t a, const fixedpt_t b) {
    return (((fxp_t)a) * ((fxp_t)b)) >> FIXEDPT_FRACBITS;
 }
 
+/*** fxp_dot3() -- find the dot product of two three-element vectors
+
+Returns a0*b0 + a1*b1 + a2*b2, where the arguments are fixed-point values.
+The products are added at full width and shifted back down once, so the
+result is truncated only once (where three fxp_mul() calls would truncate
+three times, for up to three times the error), and there is one shift
+instead of three. There is no overflow detection.
+***/
+CONSTFUNC fixedpt_t fxp_dot3(const fixedpt_t a0, const fixedpt_t b0,
+ const fixedpt_t a1, const fixedpt_t b1, const fixedpt_t a2, const fixedpt_t b2) {
+   return ((fxp_t)a0 * (fxp_t)b0 + (fxp_t)a1 * (fxp_t)b1 +
+    (fxp_t)a2 * (fxp_t)b2) >> FIXEDPT_FRACBITS;
+}
+
 /*** fxp_div() -- divide one fixed-point value by another
 
 Divides the fixed-point value represented by the first argument by that
@@ -26,7 +50,8 @@ truncated rather than rounded, and there is no overflow detection nor
 protection against division by zero.
 ***/
 CONSTFUNC fixedpt_t fxp_div(const fixedpt_t a, const fixedpt_t b) {
-   return ((((fxp_t)a) << 16) / ((fxp_t)b)) >> (16-FIXEDPT_FRACBITS);
+   return ((((fxp_t)a) << FIXEDPT_BITS) / ((fxp_t)b)) >>
+    (FIXEDPT_BITS-FIXEDPT_FRACBITS);
 }
 
 /*** fxp_scale() -- multiply fixed-point number by a ratio
@@ -45,21 +70,50 @@ CONSTFUNC fixedpt_t fxp_scale(const fixedpt_t a, const fixedpt_t mul,
    return (fxp_t)a * (fxp_t)mul / (fxp_t)div;
 }
 
-/* Table of coefficients used for CORDIC atan2() implementation. Values
-   are atan(2^(-i)) in binary radians (where a semicircle is
-   FIXEDPT_BRAD_SEMICIRC). Note that _tbl[0] is never used, but shifting
-   all the elements costs more than two bytes elsewhere... */
-/* http://arduino.cc/en/Reference/PROGMEM says: "Some cryptic bugs are
-   generated by using ordinary datatypes for program memory calls." Vague,
-   and prog_int16_t doesn't seem to be in the headers anymore as of
-   24 May 2014. So, we'll just use fixedpt_t here: */
-static const fixedpt_t _tbl[] PROGMEM = {
-   0x4000, 0x25c8, 0x13f6, 0x0a22, 0x0516, 0x028c,
-   0x0146, 0x00a3, 0x0051, 0x0029, 0x0014, 0x000a,
-   // 0x0005, 0x0003, 0x0001, 0x0001
-};
-
-/*** fxp_atan2() -- compute inverse tangent in binary radians
+/*** fxp_recip() -- find a ratio for repeated use by fxp_recip_mul()
+
+Finds num/den as a fixed-point multiplier and a shift, so that
+fxp_recip_mul(a, fxp_recip(num, den)) is (nearly) fxp_scale(a, num, den)
+with no division. The multiplier is normalized to use all the bits of a
+fixedpt_t, so the ratio is accurate to about one part in 2^(FIXEDPT_BITS-2)
+however big or small it is.
+
+The arguments are integers, or fixed-point values with the same number of
+fraction bits: only their ratio matters. To get 1/den as a fixed-point
+value (as for fxp_div()), pass FIXEDPT_ONE for num.
+
+Returns the ratio. There is no protection against division by zero, and
+the ratio must be less than 2^(FIXEDPT_BITS-1) in magnitude.
+***/
+CONSTFUNC fxp_recip_t fxp_recip(const fixedpt_t num, const fixedpt_t den) {
+   const fxp_t ud = den < 0 ? -(fxp_t)den : den;
+   fxp_t n = num < 0 ? -(fxp_t)num : num, q;
+   fxp_recip_t r;
+
+   /* Shift the numerator up until the quotient has FIXEDPT_BITS-1 bits,
+      but no further than fxp_recip_mul() can shift back down. */
+   for(r.shift = 0; n < ud << (FIXEDPT_BITS-2) && r.shift < 2*FIXEDPT_BITS-2;
+    r.shift++) n <<= 1;
+   q = (n + (ud >> 1)) / ud; /* rounded */
+   if(q >= (fxp_t)1 << (FIXEDPT_BITS-1)) q = ((fxp_t)1 << (FIXEDPT_BITS-1)) - 1;
+   r.mul = (num < 0) != (den < 0) ? -q : q;
+   return r;
+}
+
+/*** fxp_recip_mul() -- multiply a fixed-point value by a ratio
+
+Multiplies the first argument by the ratio (from fxp_recip()) given as the
+second. Returns the product, rounded to the nearest value. There is no
+overflow detection.
+***/
+CONSTFUNC fixedpt_t fxp_recip_mul(const fixedpt_t a, const fxp_recip_t r) {
+   fxp_t p = (fxp_t)a * r.mul;
+
+   if(r.shift) p += (fxp_t)1 << (r.shift - 1);
+   return p >> r.shift;
+}
+
+/*** fxp_atan2_cordic() -- compute inverse tangent in binary radians
 
 Finds the angle (in binary radians, where FIXEDPT_BRAD_SEMICIRC is a half-
 circle) from the positive X axis to the point defined by {x,y}.
@@ -68,8 +122,11 @@ The arguments are the y and x coordinates, *in that order*, as fixed-point
 values.
 
 Returns a fixed-point value representing atan(y/x) (in the correct octant).
+
+This is the CORDIC implementation; fxp_atan2() refers to it unless
+FIXEDPT_ATAN2_LUT is set.
 ***/
-CONSTFUNC fixedpt_t fxp_atan2(fixedpt_t y, fixedpt_t x) {
+CONSTFUNC fixedpt_t fxp_atan2_cordic(fixedpt_t y, fixedpt_t x) {
     fixedpt_t phi=0, i, tmp, dphi=0;
 
     /* Implementation adapted from fixed-point CORDIC described here:
@@ -88,23 +145,179 @@ CONSTFUNC fixedpt_t fxp_atan2(fixedpt_t y, fixedpt_t x) {
     // centered on the origin.)
 
     /* Perform the CORDIC approximation */
-    for(i=1; i<12; i++) {
+    for(i=1; i<CORDIC_ITER; i++) {
         if(y>=0) {
             tmp= x + (y>>i);
             y  = y - (x>>i);
             x  = tmp;
-            dphi += pgm_read_word(_tbl+i);
+            dphi += pgm_read_fxp(_tbl+i);
         } else {
             tmp= x - (y>>i);
             y  = y + (x>>i);
             x  = tmp;
-            dphi -= pgm_read_word(_tbl+i);
+            dphi -= pgm_read_fxp(_tbl+i);
         }
     }
 
     return phi + (dphi>>2);
 }
 
+#if FIXEDPT_BITS == 16
+/*** fxp_atan2_lut() -- compute inverse tangent using a lookup table
+
+Same arguments and return value as fxp_atan2_cordic(), which see.
+
+The point {x,y} is folded into the first octant (so that 0 <= y <= x), the
+ratio y/x is found by a short shift-and-subtract division, and atan() of
+that ratio is found by linear interpolation in _atan_tbl[]. The table
+holds atan(i/ATAN_TBL_SEGS) for i in 0..ATAN_TBL_SEGS, in binary radians
+scaled up by ATAN_TBL_XBITS bits; it is generated by mkatan at build time
+so that it always matches FIXEDPT_BRAD_SEMICIRC.
+
+Unlike the CORDIC version, accuracy does not depend on the magnitude of
+{x,y}, only on its direction. All the arithmetic is 16 bits wide.
+***/
+CONSTFUNC fixedpt_t fxp_atan2_lut(fixedpt_t y, fixedpt_t x) {
+    uint16_t ux, uy, q, a, t0;
+    uint8_t i, swap;
+
+    if(y==0) return x>=0 ? 0 : FIXEDPT_BRAD_SEMICIRC; /* edge case */
+
+    /* Fold {x,y} into the first octant, remembering how to unfold: */
+    ux = x < 0 ? -(uint16_t)x : x;
+    uy = y < 0 ? -(uint16_t)y : y;
+    if((swap = (uy > ux))) { q = ux; ux = uy; uy = q; }
+
+    /* Keep 2*ux inside 16 bits (only matters for x or y == -32768): */
+    if(ux & 0x8000) { ux >>= 1; uy >>= 1; }
+
+    /* Let q = floor(uy/ux * 2^ATAN_TBL_QBITS). Since uy <= ux, the
+       quotient has no integer part and we only need to develop the
+       fraction bits we're going to use. */
+    for(i = 0, q = 0; i < ATAN_TBL_QBITS; i++) {
+        uy <<= 1; q <<= 1;
+        if(uy >= ux) { uy -= ux; q |= 1; }
+    }
+
+    /* The top bits of q select the table segment; the low
+       ATAN_TBL_FBITS bits interpolate within it. */
+    i = q >> ATAN_TBL_FBITS;
+    t0 = pgm_read_word(_atan_tbl+i);
+    a = t0 + (((pgm_read_word(_atan_tbl+i+1) - t0) *
+     (q & ((1 << ATAN_TBL_FBITS) - 1))) >> ATAN_TBL_FBITS);
+#if ATAN_TBL_XBITS > 0
+    a = (a + (1 << (ATAN_TBL_XBITS-1))) >> ATAN_TBL_XBITS;
+#endif
+
+    /* Unfold back to the original octant. The result is taken modulo a
+       full circle (2*FIXEDPT_BRAD_SEMICIRC, a power of two). */
+    if(swap) a = FIXEDPT_BRAD_SEMICIRC/2 - a;
+    if(x < 0) a = FIXEDPT_BRAD_SEMICIRC - a;
+    if(y < 0) a = -a;
+    return a & (2*FIXEDPT_BRAD_SEMICIRC - 1);
+}
+#endif /* if FIXEDPT_BITS == 16 */
+
+/*** fxp_polar() -- find heading, magnitude and tilt of a vector
+
+Converts the point {x,y,z} to the form heading() and validate() use: the
+angle from fxp_atan2(), and the squared distance from fxp_dist2(). The
+magnitude is only ever compared with limits, and the tilt with an angle
+(see validate()), so there is no need for the square root or for the
+division by it that finding them would take.
+
+Arguments:
+   p -- pointer to structure into which the results are written
+   y, x, z -- the coordinates of the point. Note the order, which matches
+      fxp_atan2(): p->angle is atan2(y,x).
+
+The results are:
+   p->angle -- atan2(y,x) in binary radians, as from fxp_atan2()
+   p->z -- z, unchanged; the sine of the angle between the vector and the
+      XY plane is z/sqrt(p->mag2)
+   p->mag2 -- squared distance from the origin to the point, exactly
+***/
+void fxp_polar(fxp_polar_t * const p, fixedpt_t y, fixedpt_t x, fixedpt_t z) {
+    p->angle = fxp_atan2(y, x);
+    p->z = z;
+    p->mag2 = fxp_dist2(x, y, z);
+}
+
+/* CORDIC_GAIN is the factor by which the pseudo-rotations in fxp_sincos()
+   (below) stretch a vector. It is the product of sqrt(1 + 2^(-2i)) for
+   each iteration i; past a dozen or so iterations it no longer changes in
+   any digit that matters. It is only used in constant expressions, so no
+   floating point code is generated. */
+#define CORDIC_GAIN 1.16443535
+
+/* CORDIC_SINCOS_X0 is the starting length for rotation mode: a vector
+   one quarter of the fixedpt_t range long, shrunk in advance by the gain
+   the pseudo-rotations will add. */
+#define CORDIC_SINCOS_SHIFT (FIXEDPT_BITS-2-FIXEDPT_FRACBITS)
+#define CORDIC_SINCOS_X0 \
+ ((fixedpt_t)(((fxp_t)1 << (FIXEDPT_BITS-2)) / CORDIC_GAIN + 0.5))
+
+/*** fxp_sincos() -- find sine and cosine of an angle by CORDIC rotation
+
+Finds the sine and cosine of an angle using the same table of
+pseudo-rotations as fxp_atan2_cordic(), run the other way: a vector starts
+on the X axis and is turned, one table step at a time, until it has turned
+through the angle. Its coordinates are then the cosine and sine.
+
+Arguments:
+   angle -- the angle in binary radians (where FIXEDPT_BRAD_SEMICIRC is a
+      half-circle). Any value may be given; it is taken modulo a full
+      circle.
+   s, c -- pointers to where the sine and cosine are written, as
+      fixed-point values (FIXEDPT_ONE is 1.0)
+
+Each result is within a couple of LSb of the true value. The vector is
+carried at a quarter of the fixedpt_t range rather than at FIXEDPT_ONE,
+so that the rounding in the shifts stays well below one LSb of the
+result.
+***/
+void fxp_sincos(fixedpt_t angle, fixedpt_t * const s, fixedpt_t * const c) {
+    fixedpt_t x = CORDIC_SINCOS_X0, y = 0, z, tmp;
+    ufixedpt_t u;
+    uint8_t i, q;
+
+    /* Split the angle into a number of quarter turns (q, modulo four) and
+       what's left over, which is within 45 degrees either way. Quarter
+       turns are exact, and are put back at the end. The table is scaled
+       up by four, so the leftover angle is too. */
+    u = (ufixedpt_t)angle + FIXEDPT_BRAD_SEMICIRC/4;
+    q = (u >> (FIXEDPT_FRACBITS+2)) & 3;
+    z = ((fixedpt_t)(u & (FIXEDPT_BRAD_SEMICIRC/2 - 1)) -
+     FIXEDPT_BRAD_SEMICIRC/4) << 2;
+
+    /* As in fxp_atan2_cordic(), the iterations start at i=1, which covers
+       +/-54 degrees. */
+    for(i = 1; i < CORDIC_ITER; i++) {
+        if(z >= 0) {
+            tmp = x - (y>>i);
+            y   = y + (x>>i);
+            x   = tmp;
+            z  -= pgm_read_fxp(_tbl+i);
+        } else {
+            tmp = x + (y>>i);
+            y   = y - (x>>i);
+            x   = tmp;
+            z  += pgm_read_fxp(_tbl+i);
+        }
+    }
+
+    /* Back to FIXEDPT_FRACBITS, rounding to nearest: */
+    x = (x + (1 << (CORDIC_SINCOS_SHIFT-1))) >> CORDIC_SINCOS_SHIFT;
+    y = (y + (1 << (CORDIC_SINCOS_SHIFT-1))) >> CORDIC_SINCOS_SHIFT;
+
+    switch(q) {
+       case 0: *s = y;  *c = x;  break;
+       case 1: *s = x;  *c = -y; break;
+       case 2: *s = -y; *c = -x; break;
+       default: *s = -x; *c = y; break;
+    }
+}
+
 /*** fxp_dist() -- find distance from origin to point in three-space
 
 Given the cartesian coordinates of a point in three-space (X, Y and Z
@@ -117,14 +330,15 @@ Returns the result as a fixedpt_t.
 ***/
 CONSTFUNC fixedpt_t fxp_dist(const fixedpt_t a,
  const fixedpt_t b, const fixedpt_t c) {
-    fxp_t x, res=0, bit;
+    fxp_usq_t x, res=0, bit;
 
-    /* let x be the square of the distance (as a fixed-point 32-bit number
-       with FIXEDPT_FRACBITS*2 bits to the right of the binary point) */
-    x = (fxp_t)a * (fxp_t)a + (fxp_t)b * (fxp_t)b + (fxp_t)c * (fxp_t)c;
+    /* let x be the square of the distance (as an unsigned fixed-point
+       32-bit number with FIXEDPT_FRACBITS*2 bits to the right of the
+       binary point) */
+    x = fxp_dist2(a, b, c);
 
     /* let bit be the highest power of four <= x */
-    for(bit = 1L<<30; bit > x; bit >>= 2);
+    for(bit = (fxp_usq_t)1 << (2*FIXEDPT_BITS-2); bit > x; bit >>= 2);
 
     while(bit) {
         if(x >= res + bit) {
@@ -136,6 +350,21 @@ CONSTFUNC fixedpt_t fxp_dist(const fixedpt_t a,
     return res;
 }
 
+/*** fxp_dist2() -- find squared distance from origin to point in three-space
+
+Same arguments as fxp_dist(), which see.
+
+Returns the square of the distance, with FIXEDPT_FRACBITS*2 bits to the
+right of the binary point. There is no rounding and no square root. The
+result is unsigned, so that it can't overflow: each square fits in an
+fxp_sq_t, but their sum may not.
+***/
+CONSTFUNC fxp_usq_t fxp_dist2(const fixedpt_t a,
+ const fixedpt_t b, const fixedpt_t c) {
+    return (fxp_usq_t)((fxp_sq_t)a * a) + (fxp_usq_t)((fxp_sq_t)b * b) +
+     (fxp_usq_t)((fxp_sq_t)c * c);
+}
+
 /*** fxp_abs() -- get absolute value of fixed-point number
 
 Returns the absolute value of the fixed-point number passed as an argument.
@@ -13,42 +13,146 @@
    variables). */
 #define CONSTFUNC __attribute__((const))
 
+/* The fixed-point format is chosen at compile time. FIXEDPT_BITS is the
+   total width: 16 (the default, for the AVR) or 32 (for host tools that
+   want more precision from the same source). Both it and FIXEDPT_FRACBITS
+   can be overridden with -D in CFLAGS. */
+#ifndef FIXEDPT_BITS
+#define FIXEDPT_BITS 16
+#endif
+
+#if FIXEDPT_BITS == 16
 typedef int16_t fixedpt_t; /* our fixed point type uses 16 total bits */
+typedef uint16_t ufixedpt_t;
+#elif FIXEDPT_BITS == 32
+typedef int32_t fixedpt_t;
+typedef uint32_t ufixedpt_t;
+#else
+#error FIXEDPT_BITS must be 16 or 32
+#endif
 
-/* Of the 16 bits we have, the high 1 bit is a sign bit, the low
-   FIXEDPT_FRACBITS are the fractional part and middle (15-FIXEDPT_FRACBITS)
-   are the integer part. */
-/* IMPORTANT: If you change FIXEDPT_FRACBITS, you'll need to also reconsider
-   the value of FIXEDPT_BRAD_SEMICIRC as well as the table of constants
-   in fxp_atan2(). Also be careful of scaling, overflow and magic constants
-   in the calling program! */
+/* Of the FIXEDPT_BITS bits we have, the high 1 bit is a sign bit, the low
+   FIXEDPT_FRACBITS are the fractional part and the middle
+   (FIXEDPT_BITS-1-FIXEDPT_FRACBITS) are the integer part. */
+/* The atan tables, the CORDIC gain and the thresholds in validate.c and
+   calibrate.c are all derived from these settings by the compiler (or, for
+   the fxp_atan2_lut() table, by mkatan at build time), so changing them
+   needs no hand-made constants. Do still be careful of scaling and
+   overflow in the calling program! */
+#ifndef FIXEDPT_FRACBITS
 #define FIXEDPT_FRACBITS 11
+#endif
+
+/* A semicircle is eight units (see below), and the CORDIC table holds
+   angles of up to a quarter circle scaled up by four, so we need at least
+   four integer bits. */
+#if FIXEDPT_FRACBITS + 4 > FIXEDPT_BITS - 1
+#error FIXEDPT_FRACBITS is too big for FIXEDPT_BITS
+#endif
 
 #define FIXEDPT_ZERO 0
-#define FIXEDPT_ONE (1 << FIXEDPT_FRACBITS)
+#define FIXEDPT_ONE ((fixedpt_t)1 << FIXEDPT_FRACBITS)
 
 /* Our trig functions will use binary radians, where half a circle is
    FIXEDPT_BRAD_SEMICIRC. */
 #define FIXEDPT_BRAD_SEMICIRC (FIXEDPT_ONE * 8)
 
+/* FIXEDPT_BRAD() converts a constant angle in degrees to binary radians.
+   It is meant for constant expressions (which the compiler evaluates),
+   not for run-time values. */
+#define FIXEDPT_BRAD(deg) ((fixedpt_t)((deg) * FIXEDPT_BRAD_SEMICIRC / 180.0 + 0.5))
+
+/* There are two implementations of fxp_atan2(), which heading() uses
+   (through fxp_polar()). The CORDIC version is the smallest, and the
+   default. The table-driven version uses an interpolated lookup table
+   (generated at build time by mkatan from the settings above) and trades
+   about a hundred bytes of flash for accuracy: its worst case is about
+   0.01 degree, against more than a degree for CORDIC. Its speed on the
+   AVR has not been measured. Define FIXEDPT_ATAN2_LUT as 1 (e.g., with
+   -DFIXEDPT_ATAN2_LUT=1 in CFLAGS) to select the table-driven version.
+   See bench/ to compare the two. */
+#ifndef FIXEDPT_ATAN2_LUT
+#define FIXEDPT_ATAN2_LUT 0
+#endif
+#if FIXEDPT_ATAN2_LUT && FIXEDPT_BITS != 16
+#error the table-driven fxp_atan2() is only available with 16-bit fixedpt_t
+#endif
+
 /* You can add, subtract and shift fixed-point values like you would
 for any other integer. (Just be careful of overflow.) You can also multiply
 and divide by (but not add/subtract) normal integers.
 
 To multiply or divide two fixed-point values, use fxp_mul() or fxp_div().
 Note that these involve a real 32-bit signed multiply or divide (respectively),
-so should be considered moderately expensive. */
+so should be considered moderately expensive. To add up three products (as
+in a matrix multiply), fxp_dot3() is cheaper and more accurate than three
+fxp_mul() calls. */
 
 CONSTFUNC fixedpt_t fxp_mul(const fixedpt_t a, const fixedpt_t b);
 CONSTFUNC fixedpt_t fxp_div(const fixedpt_t a, const fixedpt_t b);
 CONSTFUNC fixedpt_t fxp_scale(const fixedpt_t a, const fixedpt_t mul,
  const fixedpt_t div);
+CONSTFUNC fixedpt_t fxp_dot3(const fixedpt_t a0, const fixedpt_t b0,
+ const fixedpt_t a1, const fixedpt_t b1, const fixedpt_t a2, const fixedpt_t b2);
+
+/* Division is slow (there's no hardware divider), so when many values
+   are to be multiplied by the same ratio, find the ratio once with
+   fxp_recip() and apply it with fxp_recip_mul(), which only multiplies
+   and shifts. */
+typedef struct {
+   fixedpt_t mul;  /* the ratio is mul / 2^shift */
+   uint8_t shift;
+} fxp_recip_t;
+
+CONSTFUNC fxp_recip_t fxp_recip(const fixedpt_t num, const fixedpt_t den);
+CONSTFUNC fixedpt_t fxp_recip_mul(const fixedpt_t a, const fxp_recip_t r);
 
-CONSTFUNC fixedpt_t fxp_atan2(fixedpt_t x, fixedpt_t y);
+CONSTFUNC fixedpt_t fxp_atan2_cordic(fixedpt_t y, fixedpt_t x);
+CONSTFUNC fixedpt_t fxp_atan2_lut(fixedpt_t y, fixedpt_t x);
+#if FIXEDPT_ATAN2_LUT
+#define fxp_atan2 fxp_atan2_lut
+#else
+#define fxp_atan2 fxp_atan2_cordic
+#endif
 CONSTFUNC fixedpt_t fxp_dist(const fixedpt_t a,
  const fixedpt_t b, const fixedpt_t c);
 CONSTFUNC fixedpt_t fxp_abs(const fixedpt_t x);
 
+/* fxp_sq_t holds the product of two fixedpt_t values. fxp_dist2() returns
+   the square of the distance, exactly, in the unsigned fxp_usq_t: a sum of
+   three squares can reach 3*32768^2, which is more than an int32_t holds.
+   Where distances are only compared with each other or with a threshold,
+   compare their squares instead and skip the square root. FXP_SQ()
+   squares a threshold (a constant one is squared by the compiler). Note
+   that the squares have twice as many fraction bits as a fixedpt_t. */
+#if FIXEDPT_BITS == 16
+typedef int32_t fxp_sq_t;
+typedef uint32_t fxp_usq_t;
+#else
+typedef int64_t fxp_sq_t;
+typedef uint64_t fxp_usq_t;
+#endif
+CONSTFUNC fxp_usq_t fxp_dist2(const fixedpt_t a,
+ const fixedpt_t b, const fixedpt_t c);
+#define FXP_SQ(x) ((fxp_usq_t)(x) * (fxp_usq_t)(x))
+
+/* fxp_polar() returns what is needed of a vector's direction, length and
+   tilt, without a square root or a division: */
+typedef struct {
+   fixedpt_t angle; /* atan2(y,x) in brads, as from fxp_atan2() */
+   fixedpt_t z;     /* height above the XY plane, as given */
+   fxp_usq_t mag2;  /* squared distance from the origin, from fxp_dist2() */
+} fxp_polar_t;
+
+void fxp_polar(fxp_polar_t * const p, fixedpt_t y, fixedpt_t x, fixedpt_t z)
+ __attribute__((nonnull(1)));
+
+/* fxp_sincos() goes the other way: given an angle in brads, it finds the
+   sine and cosine (as fixed-point values) together, for building rotations
+   without floating point. */
+void fxp_sincos(fixedpt_t angle, fixedpt_t * const s, fixedpt_t * const c)
+ __attribute__((nonnull(2,3)));
+
 #define fxp(x) (truncf((x)*(1 << FIXEDPT_FRACBITS)))
 #define flt(x) (((float)(x)) / (1 << FIXEDPT_FRACBITS))
 
@@ -5,28 +5,65 @@
 #include <string.h>
 #include <hmc5883l/hmc5883l.h>
 #include "rotate.h"
+#include "quat.h"
 #include "calibrate.h"
 #include "heading.h"
 
+/*** heading_set() -- prepare calibration data for heading()
+
+Call this whenever the calibration data changes (after calibrate() or
+stored_cal_get()).
+
+Arguments:
+   hx -- pointer to heading_xform_t into which the transform is written
+   calib -- pointer to the calibration data, as from calibrate()
+***/
+void heading_set(heading_xform_t * const hx,
+ const calibration_t * const calib) {
+   poscp(hx->xlate, calib->xlate);
+   quat_to_rot(&(calib->orient), &(hx->rot));
+}
+
+/*** heading_polar() -- find the polar form of an adjusted reading
+
+The arithmetic of heading() (which see), for it and for pipe_heading() to
+share: the offset is subtracted from a copy of the reading, the copy is
+rotated, and the polar form of the result is written to pol.
+***/
+void heading_polar(const hmc5883l_pos_t * const pos,
+ const heading_xform_t * const hx, fxp_polar_t * const pol) {
+   hmc5883l_pos_t p;
+
+   p.x = pos->x - hx->xlate.x;
+   p.y = pos->y - hx->xlate.y;
+   p.z = pos->z - hx->xlate.z;
+   rot_posn(&p, &(hx->rot));
+
+   fxp_polar(pol, p.x, p.y, p.z);
+}
+
 /*** heading() -- transform magnetometer reading into compass heading
 
 Takes a reading from a three-axis magnetometer and transforms it into
 a scalar compass heading using calibration data obtained previously.
 
 The first argument is a pointer to a structure representing the raw
-magnetometer reading. The contents of this structure will be shifted
-and rotated according to the calibration data.
+magnetometer reading. It is not modified.
 
-The second argument is a pointer to a structure containing the calibration
-data previously obtained using calibrate().
+The second argument is a pointer to the calibration data previously
+obtained using calibrate(), as prepared by heading_set(). The offset is
+subtracted and the rotation applied to a copy of the reading. (The math is
+in heading_polar(), which pipe_heading() shares.)
+
+The third argument is a pointer to a structure into which the polar form
+of the adjusted reading (heading, magnitude and tilt) is written, so that
+validate() can use it without redoing the math.
 
 Returns a heading (in binary radians to the right of geographic north).
 Multiply by 180.0/FIXEDPT_BRAD_SEMICIRC to get degrees.
 ***/
-fixedpt_t heading(hmc5883l_pos_t * const pos,
- const calibration_t * const calib) {
-   pos->x -= calib->xlate.x; pos->y -= calib->xlate.y; pos->z -= calib->xlate.z;
-   rot_posn(pos, &(calib->rotate));
-
-   return fxp_atan2(pos->x, pos->y);
+fixedpt_t heading(const hmc5883l_pos_t * const pos,
+ const heading_xform_t * const hx, fxp_polar_t * const pol) {
+   heading_polar(pos, hx, pol);
+   return pol->angle;
 }
@@ -5,9 +5,22 @@
 
 #include <hmc5883l/hmc5883l.h>
 #include "calibrate.h"
+#include "rotate.h"
 #include "fixedpt.h"
 
-fixedpt_t heading(hmc5883l_pos_t * const pos,
+/* The calibration in the form heading() uses, from heading_set(): the
+   offset to subtract from each reading, and the rotation (see rot_posn())
+   worked out once from the calibration's quaternion. */
+typedef struct {
+   hmc5883l_pos_t xlate;
+   rotation_t rot;
+} heading_xform_t;
+
+void heading_set(heading_xform_t * const hx,
  const calibration_t * const calib);
+void heading_polar(const hmc5883l_pos_t * const pos,
+ const heading_xform_t * const hx, fxp_polar_t * const pol);
+fixedpt_t heading(const hmc5883l_pos_t * const pos,
+ const heading_xform_t * const hx, fxp_polar_t * const pol);
 
 #endif /* ifndef HEADING_H */
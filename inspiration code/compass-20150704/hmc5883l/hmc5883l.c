@@ -1,7 +1,8 @@
 /* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
    This is free software -- see COPYING for details.           */
 #include <stdlib.h>
-#include <util/delay.h>
+#include <avr/io.h>
+#include <avr/power.h>
 #include <uWireM/uWireM.h>
 #include "hmc5883l.h"
 
@@ -79,50 +80,276 @@ static __attribute__((pure)) int16_t val(const uint8_t * const p) {
    return x;
 }
 
-/*** hmc5883l_read() -- read sensor values from HMC5883L
+/* Status register bits: */
+#define SR_RDY 0x01 /* data ready */
+
+/* RDY can't say on its own when a measurement is done. Reading the data
+   doesn't clear it, and nor does starting the next measurement: it only
+   drops for the 250us or so while a new result is written to the data
+   registers. Right after a trigger, it still says the last reading is
+   ready. So the status register isn't asked until MEAS_US -- the
+   (1Hz/s)/160Hz = 6250us a measurement may take -- has passed since the
+   trigger went out; from then on RDY is about this measurement. (It can
+   still read 0, if the poll lands on the write; then we poll again.) */
+#define MEAS_US 6250
+
+/* The time since the trigger is counted by Timer/Counter1, running free at
+   F_CPU/1024: 128us a tick at 8MHz, wrapping every 32.8ms. A timestamp can
+   be up to a tick late, so one more tick is waited than MEAS_US needs. A
+   wait checked more than a wrap after its trigger can only look shorter
+   than it really was (so is waited out again), never longer. */
+#define TICK_US (1024000000UL / F_CPU)
+#define MEAS_TICKS ((MEAS_US + TICK_US - 1) / TICK_US + 1)
+#if MEAS_TICKS > 255
+#error MEAS_US is too long for Timer/Counter1 to time at this F_CPU
+#endif
+
+/* Once MEAS_US is up, each status check that finds the measurement not
+   ready takes two bus transactions (about 0.4ms at 100kHz), so after
+   POLL_MAX of them something is wrong. */
+#define POLL_MAX 64
+
+/* What the sensor is doing, as far as hmc5883l_poll() knows: */
+#define ST_IDLE 0      /* nothing; hmc5883l_poll() must start a reading */
+#define ST_MEASURING 1 /* single measurement started, not yet read */
+
+static uint8_t _state = ST_IDLE, _polls;
+static volatile uint8_t _t_start; /* TCNT1 when the trigger went out */
+
+/*** due() -- check whether MEAS_US has passed since the trigger
+
+Returns non-0 if the status register can be trusted to be about the
+measurement last started, 0 if it's too soon to ask.
+***/
+static uint8_t due(void) {
+   return (uint8_t)(TCNT1 - _t_start) >= MEAS_TICKS;
+}
 
-Read the sensor values from the HMC5883L.
+/*** start() -- start a single measurement
 
-Note: Results are undefined if HMC5883L has not yet been configured
-using hmc5883l_config().
+Returns 0 on success, non-0 on failure.
+***/
+static int start(void) {
+   _state = ST_IDLE;
+   _buf[0] = uWireM_addr_send(HMC5883L_I2C_ADDR);
+   _buf[1] = REG_MR;
+   _buf[2] = 0x01;
+   if(!uWireM_xfer(_buf, 3)) return 1;
+   _t_start = TCNT1;
+   _state = ST_MEASURING;
+   _polls = 0;
+   return 0;
+}
+
+/*** convert() -- convert data registers to a reading
 
 Arguments:
    p -- pointer to data structure into which sensor data is to be stored
+   b -- transfer buffer of the data register read: b[1] to b[6] are
+      DXRA to DZRB
 
-Returns one of the HMC5883L_ERR_* values. If the return is anything other
-than HMC5883L_ERR_OK, the contents of the structure pointed to by p are
-undefined.
+Returns HMC5883L_ERR_SATURATED or HMC5883L_ERR_OK.
 ***/
-int hmc5883l_read(hmc5883l_pos_t * const p) {
+static int convert(hmc5883l_pos_t * const p, const uint8_t * const b) {
+   /* Convert raw data to numbers and put in result buffer: */
+   p->x = val(b+1); p->y = val(b+3); p->z = val(b+5);
 
-   /* Start a measurement in single measurement mode: */
-   _buf[0] = uWireM_addr_send(HMC5883L_I2C_ADDR);
-   _buf[1] = REG_MR;
-   _buf[2] = 0x01;
-   if(!uWireM_xfer(_buf, 3)) return HMC5883L_ERR_I2C;
+   /* Test for saturation along any of the axes: */
+   if(p->x == AXIS_SATURATED || p->y == AXIS_SATURATED ||
+    p->z == AXIS_SATURATED)
+      return HMC5883L_ERR_SATURATED;
 
+   return HMC5883L_ERR_OK;
+}
+
+/*** fetch() -- read the result of a finished measurement
+
+Arguments:
+   p -- pointer to data structure into which sensor data is to be stored
+
+Returns one of the HMC5883L_ERR_* values (other than HMC5883L_ERR_BUSY).
+***/
+static int fetch(hmc5883l_pos_t * const p) {
    /* Tell the device we want to start reading at DXRA (register 3): */
+   _buf[0] = uWireM_addr_send(HMC5883L_I2C_ADDR);
    _buf[1] = REG_DATA;
    if(!uWireM_xfer(_buf, 2)) return HMC5883L_ERR_I2C;
 
-   /* We could poll the status register here, but to save some space,
-      we'll just block for a minimum of (1Hz/s)/160Hz = 6250us, after
-      which we know the reading will be ready. */
-   _delay_us(6250);
-
    /* Read all six positions: */
    _buf[0] = uWireM_addr_recv(HMC5883L_I2C_ADDR);
    if(!uWireM_xfer(_buf, 7)) return HMC5883L_ERR_I2C;
 
-   /* Convert raw data to numbers and put in result buffer: */
-   p->x = val(_buf+1); p->y = val(_buf+3); p->z = val(_buf+5);
+   return convert(p, _buf);
+}
 
-   /* Test for saturation along any of the axes: */
-   if(p->x == AXIS_SATURATED || p->y == AXIS_SATURATED ||
-    p->z == AXIS_SATURATED)
-      return HMC5883L_ERR_SATURATED;
+/*** ready() -- check whether the measurement under way has finished
 
-   return HMC5883L_ERR_OK;
+Doesn't touch the bus until MEAS_US has passed since start(): before that,
+RDY may be left over from the last measurement.
+
+Returns 1 if so, 0 if not, or HMC5883L_ERR_I2C if the sensor did not
+answer or has taken implausibly long.
+***/
+static int ready(void) {
+   if(!due()) return 0;
+
+   _buf[0] = uWireM_addr_send(HMC5883L_I2C_ADDR);
+   _buf[1] = REG_SR;
+   if(!uWireM_xfer(_buf, 2)) return HMC5883L_ERR_I2C;
+
+   _buf[0] = uWireM_addr_recv(HMC5883L_I2C_ADDR);
+   if(!uWireM_xfer(_buf, 2)) return HMC5883L_ERR_I2C;
+
+   if(_buf[1] & SR_RDY) return 1;
+   return ++_polls < POLL_MAX ? 0 : HMC5883L_ERR_I2C;
+}
+
+/* hmc5883l_poll() does its bus traffic with these transactions, queued
+   with uWireM_queue() so that it never waits for the bus. The two reads
+   fill in their buffers; the rest are sent as they are. chain() is called
+   (from the bus interrupt handler) as each one finishes. */
+static void chain(uWireM_txn_t * const t);
+
+static uint8_t _b_trig[3] =
+ { uWireM_addr_send(HMC5883L_I2C_ADDR), REG_MR, 0x01 };
+static uint8_t _b_sr_ptr[2] = { uWireM_addr_send(HMC5883L_I2C_ADDR), REG_SR };
+static uint8_t _b_sr[2] = { uWireM_addr_recv(HMC5883L_I2C_ADDR) };
+static uint8_t _b_data_ptr[2] =
+ { uWireM_addr_send(HMC5883L_I2C_ADDR), REG_DATA };
+static uint8_t _b_data[7] = { uWireM_addr_recv(HMC5883L_I2C_ADDR) };
+
+static uWireM_txn_t _t_trig = { .buf = _b_trig, .len = 3, .done = chain };
+static uWireM_txn_t _t_sr_ptr = { .buf = _b_sr_ptr, .len = 2, .done = chain };
+static uWireM_txn_t _t_sr = { .buf = _b_sr, .len = 2, .done = chain };
+static uWireM_txn_t _t_data_ptr =
+ { .buf = _b_data_ptr, .len = 2, .done = chain };
+static uWireM_txn_t _t_data = { .buf = _b_data, .len = 7, .done = chain };
+
+/* Set by chain(): a reading is waiting in _b_data, or a transfer failed. */
+static volatile uint8_t _fresh, _fail;
+
+/*** chain() -- follow on from a finished hmc5883l_poll() transaction
+
+If the status register says a measurement is ready, queues the reading
+of it, and then the start of the next measurement, right away rather than
+waiting for the next hmc5883l_poll(). When a trigger has gone out, stamps
+the time, so that hmc5883l_poll() doesn't ask for the status of the new
+measurement until MEAS_US later.
+***/
+static void chain(uWireM_txn_t * const t) {
+   if(t->err) _fail = 1;
+   else if(t == &_t_trig) _t_start = TCNT1;
+   else if(t == &_t_sr) {
+      if((_b_sr[1] & SR_RDY) && !(uWireM_queue(&_t_data_ptr) &&
+       uWireM_queue(&_t_data) && uWireM_queue(&_t_trig)))
+         _fail = 1;
+   } else if(t == &_t_data) _fresh = 1;
+}
+
+/*** chain_busy() -- check if any hmc5883l_poll() transaction is queued ***/
+static uint8_t chain_busy(void) {
+   return _t_trig.busy | _t_sr_ptr.busy | _t_sr.busy | _t_data_ptr.busy |
+    _t_data.busy;
+}
+
+/*** drain() -- wait for hmc5883l_poll() transactions, then forget them
+
+Called before using the sensor any other way, so that a transfer queued
+by hmc5883l_poll() can't land in the middle.
+***/
+static void drain(void) {
+   while(chain_busy());
+   _fresh = _fail = 0;
+   _state = ST_IDLE;
+}
+
+/*** hmc5883l_poll() -- get sensor values from HMC5883L if there are any
+
+Reads the sensor values from the HMC5883L without waiting for a
+measurement to finish, or for the bus. The first call starts a single
+measurement and returns HMC5883L_ERR_BUSY; later calls return
+HMC5883L_ERR_BUSY until it is done. Until MEAS_US has passed since the
+measurement was started, a call doesn't touch the bus at all (RDY may
+still be set from the last one). After that, each call just queues the
+transfers needed to find out and returns (see uWireM_queue()); once the
+status register shows a measurement is ready, reading it and starting the
+next one are queued straight away, so that the sensor is converting while
+the caller works on the reading just returned. Calling this often enough
+therefore gives readings as fast as the sensor can make them, with none
+of the time spent waiting.
+
+Note: Results are undefined if HMC5883L has not yet been configured
+using hmc5883l_init(). hmc5883l_read() and hmc5883l_test() abandon any
+measurement started here; the next call simply starts another.
+
+Arguments:
+   p -- pointer to data structure into which sensor data is to be stored
+
+Returns one of the HMC5883L_ERR_* values. If the return is anything other
+than HMC5883L_ERR_OK or HMC5883L_ERR_SATURATED, the contents of the
+structure pointed to by p are undefined.
+***/
+int hmc5883l_poll(hmc5883l_pos_t * const p) {
+   if(chain_busy()) return HMC5883L_ERR_BUSY;
+
+   /* If the next measurement couldn't be started, start afresh next
+      time; that's no reason to throw away this one. */
+   if(_fresh) {
+      _fresh = 0;
+      _polls = 0;
+      if(_fail) _state = ST_IDLE;
+      _fail = 0;
+      return convert(p, _b_data);
+   }
+
+   if(_fail) {
+      _fail = 0;
+      _state = ST_IDLE;
+      return HMC5883L_ERR_I2C;
+   }
+
+   if(_state == ST_IDLE) {
+      if(uWireM_queue(&_t_trig)) {
+         _state = ST_MEASURING;
+         _polls = 0;
+      }
+   } else if(!due()) {
+      /* Too soon to ask: RDY may be left from the last measurement.
+         (Nothing is busy, so the trigger is done and _t_start is set.) */
+   } else if(++_polls > POLL_MAX) {
+      _state = ST_IDLE; /* give up; start afresh next time */
+      return HMC5883L_ERR_I2C;
+   } else if(uWireM_queue(&_t_sr_ptr)) uWireM_queue(&_t_sr);
+
+   return HMC5883L_ERR_BUSY;
+}
+
+/*** hmc5883l_read() -- read sensor values from HMC5883L
+
+Read the sensor values from the HMC5883L, waiting for a fresh measurement.
+
+Note: Results are undefined if HMC5883L has not yet been configured
+using hmc5883l_init().
+
+Arguments:
+   p -- pointer to data structure into which sensor data is to be stored
+
+Returns one of the HMC5883L_ERR_* values (other than HMC5883L_ERR_BUSY).
+If the return is anything other than HMC5883L_ERR_OK, the contents of the
+structure pointed to by p are undefined.
+***/
+int hmc5883l_read(hmc5883l_pos_t * const p) {
+   int rtn;
+
+   /* Start a measurement in single measurement mode, wait out the time it
+      takes, then check the status register until it's done. */
+   drain();
+   if(start()) return HMC5883L_ERR_I2C;
+   while((rtn = ready()) == 0);
+   _state = ST_IDLE;
+   if(rtn != 1) return rtn;
+
+   return fetch(p);
 }
 
 /*** conf() -- configure HMC5883L sensor
@@ -160,6 +387,9 @@ static int conf(const uint8_t bias) {
    _buf[3] = CFG_GAIN << 5;            /* REG_CRB */
    _buf[4] = 0x03;                     /* REG_MR */
 
+   /* Going idle abandons any measurement hmc5883l_poll() was waiting for. */
+   drain();
+
    /* Note that uWireM_xfer() has a reversed return; TRUE for success,
       FALSE for failure. This is a consequence of the Atmel-supplied
       I2C code underlying the uWireM library. */
@@ -176,6 +406,11 @@ Returns one of the HMC5883L_ERR_* values.
 int hmc5883l_init(void) {
    hmc5883l_pos_t buf;
 
+   /* Timer/Counter1 is the time base for MEAS_US: free-running at
+      F_CPU/1024, with no interrupts. */
+   power_timer1_enable();
+   TCCR1 = 1<<CS13 | 1<<CS11 | 1<<CS10;
+
    /* configure for normal operation (with zero bias), not self-test */
    if(conf(CFG_BIAS_NONE)) return HMC5883L_ERR_I2C;
 
@@ -238,6 +473,9 @@ int hmc5883l_test(hmc5883l_pos_t * p) {
 #else
 #error self-test limits are missing for selected CFG_GAIN value
 #endif /* if/else CFG_GAIN values */
+#if GAIN_MULT != HMC5883L_GAIN
+#error CFG_GAIN does not agree with HMC5883L_GAIN in hmc5883l.h
+#endif
 #define GAIN_DIV 390 /* LSb per Gauss for SELFTEST_POS_MIN and MAX */
 
    min = SELFTEST_POS_MIN * GAIN_MULT / GAIN_DIV;
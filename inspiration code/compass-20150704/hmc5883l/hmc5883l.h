@@ -10,10 +10,16 @@
 #define HMC5883L_ERR_I2C (-1)        /* unable to communicate with sensor */
 #define HMC5883L_ERR_SATURATED (-2)  /* field too strong; sensor saturated */
 #define HMC5883L_ERR_TESTFAIL (-3)   /* self-test failed */
+#define HMC5883L_ERR_BUSY 1          /* hmc5883l_poll(): no reading yet */
+
+/* Sensor gain in LSb per gauss; readings are in units of 1/HMC5883L_GAIN
+   gauss. This must agree with CFG_GAIN in hmc5883l.c. */
+#define HMC5883L_GAIN 1090
 
 typedef struct { fixedpt_t x, y, z; } hmc5883l_pos_t;
 
 int hmc5883l_read(hmc5883l_pos_t * const p) __attribute__((nonnull(1)));
+int hmc5883l_poll(hmc5883l_pos_t * const p) __attribute__((nonnull(1)));
 int hmc5883l_init(void);
 int hmc5883l_test(hmc5883l_pos_t * const p) __attribute__((nonnull(1)));
 
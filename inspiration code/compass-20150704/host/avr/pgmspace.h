@@ -0,0 +1,20 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef BENCH_PGMSPACE_H
+#define BENCH_PGMSPACE_H
+
+/* Stand-in for <avr/pgmspace.h> so the firmware modules can be compiled
+   and exercised on the host (by bench/ and ../compass-tst8/). On the host
+   there is only one address space, so program memory is just ordinary
+   read-only data. */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P(d, s, n) memcpy((d), (s), (n))
+
+#endif /* ifndef BENCH_PGMSPACE_H */
@@ -0,0 +1,433 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* fixedpt_n -- batch fixed-point routines for host-side log replay
+
+The firmware handles one magnetometer reading at a time, so fixedpt.c and
+rotate.c work on one value at a time too. Replaying a recorded session on
+the host means pushing hundreds of thousands of readings through the same
+code, and checking that the results match what the compass would have
+shown. This module does that a whole array at a time.
+
+Every routine here must give bit-for-bit the same answer as the firmware
+routine it stands in for -- including the places where the firmware's
+16-bit arithmetic wraps around. The SIMD versions therefore follow the
+scalar code step by step (the same octant folds, the same CORDIC table,
+the same truncation) rather than computing the same thing some better
+way. bench/batch-bench checks this.
+
+SIMD versions exist only for the default 16-bit fixedpt_t and for the
+CORDIC fxp_atan2(); other builds (and other CPUs) get the scalar loops.
+*/
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "fixedpt.h"
+#include "cordic_tbl.h"
+#include "rotate.h"
+#include "fixedpt_n.h"
+
+#if FIXEDPT_BITS == 16 && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SIMD
+#include <immintrin.h>
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+#define SEMI FIXEDPT_BRAD_SEMICIRC
+
+static int _level = -1; /* instruction set in use; -1 means not chosen yet */
+
+/* The scalar versions. The SIMD versions use these for the leftover
+   elements at the end of each array. */
+
+static void atan2_scalar(fixedpt_t * const out, const fixedpt_t * const y,
+ const fixedpt_t * const x, const size_t n) {
+   size_t k;
+
+   for(k = 0; k < n; k++) out[k] = fxp_atan2(y[k], x[k]);
+}
+
+static void dist_scalar(fixedpt_t * const out, const fixedpt_t * const a,
+ const fixedpt_t * const b, const fixedpt_t * const c, const size_t n) {
+   size_t k;
+
+   for(k = 0; k < n; k++) out[k] = fxp_dist(a[k], b[k], c[k]);
+}
+
+static void rot_scalar(fixedpt_t * const x, fixedpt_t * const y,
+ fixedpt_t * const z, const rotation_t * const rot, const size_t n) {
+   hmc5883l_pos_t p;
+   size_t k;
+
+   for(k = 0; k < n; k++) {
+      p.x = x[k]; p.y = y[k]; p.z = z[k];
+      rot_posn(&p, rot);
+      x[k] = p.x; y[k] = p.y; z[k] = p.z;
+   }
+}
+
+#ifdef HAVE_SIMD
+
+/* Conditional negation: where the mask s is all ones, returns -v;
+   where it is zero, returns v. */
+#define cneg128(v,s) _mm_sub_epi16(_mm_xor_si128((v),(s)),(s))
+#define cneg256(v,s) _mm256_sub_epi16(_mm256_xor_si256((v),(s)),(s))
+
+/* fxp_dot3() of eight (or sixteen) points with one row of a matrix. The
+   caller interleaves x with y, and z with zero; c01 holds the matrix
+   entries for x and y in each 32-bit lane, and c2 the one for z. madd
+   gives the sums of products at full 32-bit width, and one shift brings
+   each back down. The low 16 bits of the result are what fxp_dot3()
+   returns, so they are sign-extended before packing (packs_epi32 would
+   saturate). Both packs work within 128-bit lanes, matching the unpacks,
+   so the elements come out in order. */
+SSE41 static inline __m128i dot128(const __m128i xy_lo, const __m128i xy_hi,
+ const __m128i z_lo, const __m128i z_hi, const __m128i c01, const __m128i c2) {
+   __m128i lo, hi;
+
+   lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(xy_lo, c01),
+    _mm_madd_epi16(z_lo, c2)), FIXEDPT_FRACBITS);
+   hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(xy_hi, c01),
+    _mm_madd_epi16(z_hi, c2)), FIXEDPT_FRACBITS);
+   return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16),
+    _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+}
+
+AVX2 static inline __m256i dot256(const __m256i xy_lo, const __m256i xy_hi,
+ const __m256i z_lo, const __m256i z_hi, const __m256i c01, const __m256i c2) {
+   __m256i lo, hi;
+
+   lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(xy_lo, c01),
+    _mm256_madd_epi16(z_lo, c2)), FIXEDPT_FRACBITS);
+   hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(xy_hi, c01),
+    _mm256_madd_epi16(z_hi, c2)), FIXEDPT_FRACBITS);
+   return _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16),
+    _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16));
+}
+
+/* the 32-bit lane {lo, hi}, as two 16-bit values */
+#define PAIR(lo,hi) ((int32_t)((uint32_t)(uint16_t)(hi) << 16 | (uint16_t)(lo)))
+
+#if !FIXEDPT_ATAN2_LUT
+/*** atan2_sse41(), atan2_avx2() -- fxp_atan2_cordic(), 8 or 16 at a time
+
+Each step matches one in fxp_atan2_cordic(). The branches become masks:
+the octant folds select between the folded and unfolded values, and in
+the CORDIC loop the sign of y decides whether each term is added or
+subtracted.
+***/
+SSE41 static void atan2_sse41(fixedpt_t * const out,
+ const fixedpt_t * const y, const fixedpt_t * const x, const size_t n) {
+   const __m128i zero = _mm_setzero_si128();
+   __m128i x0, y0, xx, yy, m, s, t, phi, dphi, sh;
+   size_t k;
+   int i;
+
+   for(k = 0; k + 8 <= n; k += 8) {
+      xx = x0 = _mm_loadu_si128((const __m128i *)(x+k));
+      yy = y0 = _mm_loadu_si128((const __m128i *)(y+k));
+
+      /* if(y<0) { x=-x; y=-y; phi += SEMI; } */
+      m = _mm_cmpgt_epi16(zero, yy);
+      xx = _mm_blendv_epi8(xx, _mm_sub_epi16(zero, xx), m);
+      yy = _mm_blendv_epi8(yy, _mm_sub_epi16(zero, yy), m);
+      phi = _mm_and_si128(m, _mm_set1_epi16(SEMI));
+
+      /* if(x<=0) { tmp=x; x=y; y=-tmp; phi += SEMI/2; } */
+      m = _mm_cmpgt_epi16(xx, zero);
+      t = xx;
+      xx = _mm_blendv_epi8(yy, xx, m);
+      yy = _mm_blendv_epi8(_mm_sub_epi16(zero, t), yy, m);
+      phi = _mm_add_epi16(phi, _mm_andnot_si128(m, _mm_set1_epi16(SEMI/2)));
+
+      /* if(x<=y) { tmp=y-x; x+=y; y=tmp; phi += SEMI/4; } */
+      m = _mm_cmpgt_epi16(xx, yy);
+      t = xx;
+      xx = _mm_blendv_epi8(_mm_add_epi16(xx, yy), xx, m);
+      yy = _mm_blendv_epi8(_mm_sub_epi16(yy, t), yy, m);
+      phi = _mm_add_epi16(phi, _mm_andnot_si128(m, _mm_set1_epi16(SEMI/4)));
+
+      dphi = zero;
+      for(i = 1; i < (int)CORDIC_ITER; i++) {
+         sh = _mm_cvtsi32_si128(i);
+         s = _mm_srai_epi16(yy, 15); /* all ones where y<0 */
+         t = _mm_sra_epi16(xx, sh);
+         xx = _mm_add_epi16(xx, cneg128(_mm_sra_epi16(yy, sh), s));
+         yy = _mm_sub_epi16(yy, cneg128(t, s));
+         dphi = _mm_add_epi16(dphi,
+          cneg128(_mm_set1_epi16(pgm_read_word(_tbl+i)), s));
+      }
+      phi = _mm_add_epi16(phi, _mm_srai_epi16(dphi, 2));
+
+      /* if(y==0) return x>=0 ? 0 : SEMI; */
+      phi = _mm_blendv_epi8(phi,
+       _mm_and_si128(_mm_cmpgt_epi16(zero, x0), _mm_set1_epi16(SEMI)),
+       _mm_cmpeq_epi16(y0, zero));
+
+      _mm_storeu_si128((__m128i *)(out+k), phi);
+   }
+   atan2_scalar(out+k, y+k, x+k, n-k);
+}
+
+AVX2 static void atan2_avx2(fixedpt_t * const out,
+ const fixedpt_t * const y, const fixedpt_t * const x, const size_t n) {
+   const __m256i zero = _mm256_setzero_si256();
+   __m256i x0, y0, xx, yy, m, s, t, phi, dphi;
+   __m128i sh;
+   size_t k;
+   int i;
+
+   for(k = 0; k + 16 <= n; k += 16) {
+      xx = x0 = _mm256_loadu_si256((const __m256i *)(x+k));
+      yy = y0 = _mm256_loadu_si256((const __m256i *)(y+k));
+
+      m = _mm256_cmpgt_epi16(zero, yy);
+      xx = _mm256_blendv_epi8(xx, _mm256_sub_epi16(zero, xx), m);
+      yy = _mm256_blendv_epi8(yy, _mm256_sub_epi16(zero, yy), m);
+      phi = _mm256_and_si256(m, _mm256_set1_epi16(SEMI));
+
+      m = _mm256_cmpgt_epi16(xx, zero);
+      t = xx;
+      xx = _mm256_blendv_epi8(yy, xx, m);
+      yy = _mm256_blendv_epi8(_mm256_sub_epi16(zero, t), yy, m);
+      phi = _mm256_add_epi16(phi,
+       _mm256_andnot_si256(m, _mm256_set1_epi16(SEMI/2)));
+
+      m = _mm256_cmpgt_epi16(xx, yy);
+      t = xx;
+      xx = _mm256_blendv_epi8(_mm256_add_epi16(xx, yy), xx, m);
+      yy = _mm256_blendv_epi8(_mm256_sub_epi16(yy, t), yy, m);
+      phi = _mm256_add_epi16(phi,
+       _mm256_andnot_si256(m, _mm256_set1_epi16(SEMI/4)));
+
+      dphi = zero;
+      for(i = 1; i < (int)CORDIC_ITER; i++) {
+         sh = _mm_cvtsi32_si128(i);
+         s = _mm256_srai_epi16(yy, 15);
+         t = _mm256_sra_epi16(xx, sh);
+         xx = _mm256_add_epi16(xx, cneg256(_mm256_sra_epi16(yy, sh), s));
+         yy = _mm256_sub_epi16(yy, cneg256(t, s));
+         dphi = _mm256_add_epi16(dphi,
+          cneg256(_mm256_set1_epi16(pgm_read_word(_tbl+i)), s));
+      }
+      phi = _mm256_add_epi16(phi, _mm256_srai_epi16(dphi, 2));
+
+      phi = _mm256_blendv_epi8(phi,
+       _mm256_and_si256(_mm256_cmpgt_epi16(zero, x0),
+        _mm256_set1_epi16(SEMI)),
+       _mm256_cmpeq_epi16(y0, zero));
+
+      _mm256_storeu_si256((__m256i *)(out+k), phi);
+   }
+   atan2_scalar(out+k, y+k, x+k, n-k);
+}
+#endif /* if !FIXEDPT_ATAN2_LUT */
+
+/*** dist_sse41(), dist_avx2() -- fxp_dist(), 8 at a time
+
+fxp_dist() finds the integer square root, rounded down, of a sum of
+squares that fits in 31 bits. A double holds such a sum exactly, and its
+correctly-rounded square root never reaches the next integer up, so
+truncating sqrt() gives the same answer. The result is at most 46340,
+which _mm_packus_epi32() narrows to 16 bits just as fxp_dist()'s return
+does.
+
+As with fxp_dist(), sums of squares that overflow 31 bits are not
+supported. (The firmware never gets such a sum; fxp_dist() doesn't
+terminate on one.)
+***/
+SSE41 static void dist_sse41(fixedpt_t * const out,
+ const fixedpt_t * const a, const fixedpt_t * const b,
+ const fixedpt_t * const c, const size_t n) {
+   __m128i va, vb, vc, sq, r[2];
+   size_t k;
+   int h;
+
+   for(k = 0; k + 8 <= n; k += 8) {
+      for(h = 0; h < 2; h++) {
+         va = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(a+k+4*h)));
+         vb = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(b+k+4*h)));
+         vc = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(c+k+4*h)));
+         sq = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(va, va),
+          _mm_mullo_epi32(vb, vb)), _mm_mullo_epi32(vc, vc));
+         r[h] = _mm_unpacklo_epi64(
+          _mm_cvttpd_epi32(_mm_sqrt_pd(_mm_cvtepi32_pd(sq))),
+          _mm_cvttpd_epi32(_mm_sqrt_pd(_mm_cvtepi32_pd(_mm_srli_si128(sq, 8)))));
+      }
+      _mm_storeu_si128((__m128i *)(out+k), _mm_packus_epi32(r[0], r[1]));
+   }
+   dist_scalar(out+k, a+k, b+k, c+k, n-k);
+}
+
+AVX2 static void dist_avx2(fixedpt_t * const out,
+ const fixedpt_t * const a, const fixedpt_t * const b,
+ const fixedpt_t * const c, const size_t n) {
+   __m256i va, vb, vc, sq;
+   size_t k;
+
+   for(k = 0; k + 8 <= n; k += 8) {
+      va = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(a+k)));
+      vb = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(b+k)));
+      vc = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(c+k)));
+      sq = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(va, va),
+       _mm256_mullo_epi32(vb, vb)), _mm256_mullo_epi32(vc, vc));
+      _mm_storeu_si128((__m128i *)(out+k), _mm_packus_epi32(
+       _mm256_cvttpd_epi32(_mm256_sqrt_pd(
+        _mm256_cvtepi32_pd(_mm256_castsi256_si128(sq)))),
+       _mm256_cvttpd_epi32(_mm256_sqrt_pd(
+        _mm256_cvtepi32_pd(_mm256_extracti128_si256(sq, 1))))));
+   }
+   dist_scalar(out+k, a+k, b+k, c+k, n-k);
+}
+
+/*** rot_sse41(), rot_avx2() -- rot_posn(), 8 or 16 points at a time
+
+Each output coordinate is one fxp_dot3(), as in rot_posn().
+***/
+SSE41 static void rot_sse41(fixedpt_t * const x, fixedpt_t * const y,
+ fixedpt_t * const z, const rotation_t * const rot, const size_t n) {
+   const __m128i zero = _mm_setzero_si128();
+   __m128i c01[3], c2[3], vx, vy, vz, xy_lo, xy_hi, z_lo, z_hi;
+   size_t k;
+   int j;
+
+   for(j = 0; j < 3; j++) {
+      c01[j] = _mm_set1_epi32(PAIR(rot->r[0][j], rot->r[1][j]));
+      c2[j] = _mm_set1_epi32(PAIR(rot->r[2][j], 0));
+   }
+
+   for(k = 0; k + 8 <= n; k += 8) {
+      vx = _mm_loadu_si128((const __m128i *)(x+k));
+      vy = _mm_loadu_si128((const __m128i *)(y+k));
+      vz = _mm_loadu_si128((const __m128i *)(z+k));
+      xy_lo = _mm_unpacklo_epi16(vx, vy); xy_hi = _mm_unpackhi_epi16(vx, vy);
+      z_lo = _mm_unpacklo_epi16(vz, zero); z_hi = _mm_unpackhi_epi16(vz, zero);
+      _mm_storeu_si128((__m128i *)(x+k),
+       dot128(xy_lo, xy_hi, z_lo, z_hi, c01[0], c2[0]));
+      _mm_storeu_si128((__m128i *)(y+k),
+       dot128(xy_lo, xy_hi, z_lo, z_hi, c01[1], c2[1]));
+      _mm_storeu_si128((__m128i *)(z+k),
+       dot128(xy_lo, xy_hi, z_lo, z_hi, c01[2], c2[2]));
+   }
+   rot_scalar(x+k, y+k, z+k, rot, n-k);
+}
+
+AVX2 static void rot_avx2(fixedpt_t * const x, fixedpt_t * const y,
+ fixedpt_t * const z, const rotation_t * const rot, const size_t n) {
+   const __m256i zero = _mm256_setzero_si256();
+   __m256i c01[3], c2[3], vx, vy, vz, xy_lo, xy_hi, z_lo, z_hi;
+   size_t k;
+   int j;
+
+   for(j = 0; j < 3; j++) {
+      c01[j] = _mm256_set1_epi32(PAIR(rot->r[0][j], rot->r[1][j]));
+      c2[j] = _mm256_set1_epi32(PAIR(rot->r[2][j], 0));
+   }
+
+   for(k = 0; k + 16 <= n; k += 16) {
+      vx = _mm256_loadu_si256((const __m256i *)(x+k));
+      vy = _mm256_loadu_si256((const __m256i *)(y+k));
+      vz = _mm256_loadu_si256((const __m256i *)(z+k));
+      xy_lo = _mm256_unpacklo_epi16(vx, vy);
+      xy_hi = _mm256_unpackhi_epi16(vx, vy);
+      z_lo = _mm256_unpacklo_epi16(vz, zero);
+      z_hi = _mm256_unpackhi_epi16(vz, zero);
+      _mm256_storeu_si256((__m256i *)(x+k),
+       dot256(xy_lo, xy_hi, z_lo, z_hi, c01[0], c2[0]));
+      _mm256_storeu_si256((__m256i *)(y+k),
+       dot256(xy_lo, xy_hi, z_lo, z_hi, c01[1], c2[1]));
+      _mm256_storeu_si256((__m256i *)(z+k),
+       dot256(xy_lo, xy_hi, z_lo, z_hi, c01[2], c2[2]));
+   }
+   rot_scalar(x+k, y+k, z+k, rot, n-k);
+}
+
+#endif /* ifdef HAVE_SIMD */
+
+/*** best() -- find the best instruction set this CPU supports ***/
+static int best(void) {
+#ifdef HAVE_SIMD
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2")) return FXP_N_AVX2;
+   if(__builtin_cpu_supports("sse4.1")) return FXP_N_SSE41;
+#endif
+   return FXP_N_SCALAR;
+}
+
+/*** fxp_n_select() -- choose which instruction set the batch routines use
+
+The argument is one of FXP_N_SCALAR, FXP_N_SSE41 or FXP_N_AVX2. If the
+CPU (or this build) doesn't support the one asked for, the best one it
+does support is used instead.
+
+Returns the instruction set now in use. This is meant for benchmarks and
+for checking the SIMD versions against the scalar ones; programs that
+just want the answers quickly need not call it.
+***/
+int fxp_n_select(const int level) {
+   const int b = best();
+
+   _level = level < FXP_N_SCALAR ? FXP_N_SCALAR : level > b ? b : level;
+   return _level;
+}
+
+/*** fxp_atan2_n() -- compute fxp_atan2() for each of an array of points
+
+Arguments:
+   out -- array into which the n results are written
+   y, x -- arrays of the n points' coordinates (in the same order as the
+      arguments to fxp_atan2())
+   n -- number of points
+
+out[i] is set to fxp_atan2(y[i], x[i]). out may be the same array as x
+or y, but must not otherwise overlap them.
+***/
+void fxp_atan2_n(fixedpt_t * const out, const fixedpt_t * const y,
+ const fixedpt_t * const x, const size_t n) {
+   if(_level < 0) _level = best();
+#if defined(HAVE_SIMD) && !FIXEDPT_ATAN2_LUT
+   if(_level == FXP_N_AVX2) { atan2_avx2(out, y, x, n); return; }
+   if(_level == FXP_N_SSE41) { atan2_sse41(out, y, x, n); return; }
+#endif
+   atan2_scalar(out, y, x, n);
+}
+
+/*** fxp_dist_n() -- compute fxp_dist() for each of an array of points
+
+Arguments:
+   out -- array into which the n results are written
+   a, b, c -- arrays of the n points' coordinates
+   n -- number of points
+
+out[i] is set to fxp_dist(a[i], b[i], c[i]). out may be the same array as
+one of a, b and c, but must not otherwise overlap them.
+***/
+void fxp_dist_n(fixedpt_t * const out, const fixedpt_t * const a,
+ const fixedpt_t * const b, const fixedpt_t * const c, const size_t n) {
+   if(_level < 0) _level = best();
+#ifdef HAVE_SIMD
+   if(_level == FXP_N_AVX2) { dist_avx2(out, a, b, c, n); return; }
+   if(_level == FXP_N_SSE41) { dist_sse41(out, a, b, c, n); return; }
+#endif
+   dist_scalar(out, a, b, c, n);
+}
+
+/*** rot_posn_n() -- rotate each of an array of points
+
+Arguments:
+   x, y, z -- arrays of the n points' coordinates. The points are rotated
+      in place.
+   rot -- the rotation matrix, as for rot_posn()
+   n -- number of points
+
+Point i ends up where rot_posn() would have put it.
+***/
+void rot_posn_n(fixedpt_t * const x, fixedpt_t * const y,
+ fixedpt_t * const z, const rotation_t * const rot, const size_t n) {
+   if(_level < 0) _level = best();
+#ifdef HAVE_SIMD
+   if(_level == FXP_N_AVX2) { rot_avx2(x, y, z, rot, n); return; }
+   if(_level == FXP_N_SSE41) { rot_sse41(x, y, z, rot, n); return; }
+#endif
+   rot_scalar(x, y, z, rot, n);
+}
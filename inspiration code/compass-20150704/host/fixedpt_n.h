@@ -0,0 +1,31 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef FIXEDPT_N_H
+#define FIXEDPT_N_H
+
+/* Batch versions of the fixed-point routines, for host programs that
+   replay recorded sessions. These are not part of the firmware. Each
+   takes its data as separate arrays (one per coordinate) and gives
+   exactly the same result, element by element, as calling the firmware
+   routine once per element. */
+
+#include <stddef.h>
+#include "fixedpt.h"
+#include "rotate.h"
+
+/* Which instruction set the batch routines use. By default, the best one
+   the CPU supports is picked on first use. */
+#define FXP_N_SCALAR 0 /* plain loop around the firmware routine */
+#define FXP_N_SSE41 1  /* x86 SSE4.1 */
+#define FXP_N_AVX2 2   /* x86 AVX2 */
+
+int fxp_n_select(const int level);
+
+void fxp_atan2_n(fixedpt_t * const out, const fixedpt_t * const y,
+ const fixedpt_t * const x, const size_t n);
+void fxp_dist_n(fixedpt_t * const out, const fixedpt_t * const a,
+ const fixedpt_t * const b, const fixedpt_t * const c, const size_t n);
+void rot_posn_n(fixedpt_t * const x, fixedpt_t * const y,
+ fixedpt_t * const z, const rotation_t * const rot, const size_t n);
+
+#endif /* ifndef FIXEDPT_N_H */
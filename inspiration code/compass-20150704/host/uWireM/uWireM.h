@@ -0,0 +1,37 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef BENCH_UWIREM_H
+#define BENCH_UWIREM_H
+
+/* Stand-in for <uWireM/uWireM.h> so that modules which talk to the bus
+   (such as ../matrix8x8/matrix8x8.c) can be compiled on the host. The
+   declarations match the real header; the host program that links them
+   supplies uWireM_queue() and uWireM_xfer(), typically to count or check
+   what would have gone over the bus. */
+
+#include <stdint.h>
+
+#define TRUE 1
+#define FALSE 0
+#define TWI_ADR_BITS 1
+#define TWI_READ_BIT 0
+#define USI_TWI_NO_ACK_ON_DATA 0x05
+
+typedef struct uWireM_txn uWireM_txn_t;
+struct uWireM_txn {
+   uint8_t *buf;
+   uint8_t len;
+   volatile uint8_t busy;
+   uint8_t err;
+   void (*done)(uWireM_txn_t * const t);
+};
+
+#define uWireM_addr_send(x) ((x)<<TWI_ADR_BITS)
+#define uWireM_addr_recv(x) (((x)<<TWI_ADR_BITS) | 1)
+
+void uWireM_init(void);
+uint8_t uWireM_xfer(uint8_t * const buf, const uint8_t len);
+uint8_t uWireM_queue(uWireM_txn_t * const t);
+uint8_t uWireM_err(void);
+
+#endif /* ifndef BENCH_UWIREM_H */
@@ -7,6 +7,72 @@
 
 static uint8_t _buf[18];
 
+static void done(uWireM_txn_t * const t);
+
+/* Transfers are queued (see uWireM_queue()) rather than waited for, so
+   drawing a frame costs only the time to build it. The next call that
+   needs _buf waits for the previous transfer to be done with it. */
+static uWireM_txn_t _txn = { .buf = _buf, .done = done };
+
+/* The rows of the frame last sent, in controller bit order, and whether
+   they are known to be what the display holds. _valid is set when a frame
+   is queued, on the hope that it gets there; done() clears it if not. */
+static uint8_t _shown[8];
+static volatile uint8_t _valid;
+
+/*** done() -- note whether a queued transfer reached the display
+
+Called (from the bus interrupt handler) when _txn is finished. If it
+failed -- the controller didn't answer, or the bus glitched -- the display
+may not hold what _shown says, so the next frame is sent whole.
+***/
+static void done(uWireM_txn_t * const t) {
+   if(t->err) _valid = 0;
+}
+
+/*** send() -- queue the first len bytes of _buf for sending ***/
+static void send(const uint8_t len) {
+   _txn.len = len;
+   while(!uWireM_queue(&_txn));
+}
+
+/*** update() -- send the rows of a frame that differ from the display
+
+Compares a frame with the one last sent, and sends only the rows from the
+first that differs to the last that differs, in one transfer starting at
+the first one's display RAM address (the controller increments the address
+by itself). If nothing differs, nothing is sent at all -- the usual case,
+since the heading doesn't change often. If the last transfer failed, the
+whole frame is sent.
+
+The display RAM has two bytes per row, of which the 8x8 backpack uses only
+the even one; the odd ones in between are sent as zero.
+
+The argument is the frame, top row first, in controller bit order (as from
+matrix8x8_pixels()).
+***/
+static void update(const uint8_t * const rows) {
+   uint8_t first = 0, last = 7, i;
+
+   if(_valid) {
+      while(rows[first] == _shown[first])
+         if(++first == 8) return;
+      while(rows[last] == _shown[last]) last--;
+   }
+
+   /* The transfer in flight may fail while we wait for it; if so, what it
+      was sending has to go again along with the rest. */
+   while(_txn.busy);
+   if(!_valid) { first = 0; last = 7; }
+   memset(_buf, 0, sizeof(_buf));
+   _buf[0] = uWireM_addr_send(MATRIX8X8_I2C_ADDR);
+   _buf[1] = MATRIX8X8_CMD_DISPLAY_XFER | (first << 1);
+   for(i = first; i <= last; i++)
+      _buf[(i - first + 1) << 1] = _shown[i] = rows[i];
+   _valid = 1;
+   send(((last - first) << 1) + 3);
+}
+
 /*** matrix8x8_pixels() -- turn a bitmap byte into a display controller row
 
 Converts a bitmap byte (in bit order 76543210) into a byte in the bit
@@ -14,10 +80,9 @@ order the display controller expects (70123456).
 
 The argument is the bitmap byte. Returns the converted value.
 
-This function could be eliminated (saving a dozen or so bytes), but
-it would mean sacrificing a more human-readable presentation of the
-bitmap images (i.e., 0b10000000 means the leftmost pixel in the row
-is lit) or using some kind of compile-time preprocessor.
+This is only needed for images made at run time (see matrix8x8_draw());
+frames for matrix8x8_drawP() are converted when they are built, as by
+the compass's mkframes.c.
 
 The same operation could be done faster with a lookup table, but we
 really care more (a *lot* more!) about space than speed here.
@@ -41,9 +106,10 @@ would be those to set the brightness or blink mode.
 The argument is the command value to be sent.
 ***/
 void matrix8x8_cmd(const uint8_t x) {
+   while(_txn.busy);
    _buf[0] = uWireM_addr_send(MATRIX8X8_I2C_ADDR);
    _buf[1] = x;
-   uWireM_xfer(_buf, 2);
+   send(2);
 }
 
 /*** matrix8x8_clear() -- turn all LEDs off by writing 8 empty rows
@@ -54,46 +120,42 @@ void matrix8x8_clear(void) {
    /* Why bother clearing _buf[0] if we're going to immediately set it
       to another value? Avoiding doing so would make the code bigger (and
       probably slower, too). */
+   while(_txn.busy);
    memset(_buf, 0, sizeof(_buf));
+   memset(_shown, 0, sizeof(_shown));
+   _valid = 1;
    _buf[0] = uWireM_addr_send(MATRIX8X8_I2C_ADDR);
-   uWireM_xfer(_buf, 18);
+   send(18);
 }
 
 /*** matrix8x8_drawP() -- draw single frame from program memory
 
-Draws a single frame from program memory on the LED matrix display.
+Draws a single frame from program memory on the LED matrix display. Only
+the rows that differ from the frame last drawn are sent; see update().
 
 The argument is a pointer to the byte representing the first (top) row of
-the bitmap to be drawn. Subsequent rows are assumed to be contiguous in
-memory.
+the frame to be drawn. Subsequent rows are assumed to be contiguous in
+memory. Unlike matrix8x8_draw(), the rows must already be in the display
+controller's bit order (as from matrix8x8_pixels()): frames in flash are
+meant to be built ahead of time, so there is nothing to convert here.
 ***/
 void matrix8x8_drawP(const uint8_t * const p) {
-   uint8_t row;
-
-   /* Again, we zero the whole transfer buffer then selectively replace
-      parts of it in the interests of saving code space: */
-   memset(_buf, 0, sizeof(_buf));
-   _buf[0] = uWireM_addr_send(MATRIX8X8_I2C_ADDR);
-
-   /* The rows are numbered 0..8 from top to bottom. The row data goes
-      into the _buf[] elements with even-numbered indices, starting with
-      _buf[2] for the top row, going up to _buf[16] for the bottom. */
-   for(row = 0; row < 8; row++)
-      _buf[(row+1)<<1]= matrix8x8_pixels(pgm_read_byte(p+row));
+   uint8_t rows[8];
 
-   uWireM_xfer(_buf, 18);
+   memcpy_P(rows, p, sizeof(rows));
+   update(rows);
 }
 
-/*** matrix8x8_drawP() -- draw single frame from SRAM
+/*** matrix8x8_draw() -- draw single frame from SRAM
 
 This function is almost idential to matrix8x8_drawP(), above. However,
-it takes the image data from SRAM instead of program memory.
+it takes the image data from SRAM instead of program memory, as a bitmap
+(bit 7 is the leftmost pixel), and converts each row with
+matrix8x8_pixels().
 ***/
 void matrix8x8_draw(const uint8_t * const p) {
-   uint8_t row;
-   memset(_buf, 0, sizeof(_buf));
-   _buf[0] = uWireM_addr_send(MATRIX8X8_I2C_ADDR);
-   for(row = 0; row < 8; row++)
-      _buf[(row+1)<<1]= matrix8x8_pixels(*(p+row));
-   uWireM_xfer(_buf, 18);
+   uint8_t rows[8], row;
+
+   for(row = 0; row < 8; row++) rows[row] = matrix8x8_pixels(p[row]);
+   update(rows);
 }
@@ -0,0 +1,52 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* mkatan -- generate the lookup table used by fxp_atan2_lut()
+
+This is a host program, run at build time (see the Makefile). It writes
+atan_tbl.h to stdout. The table is derived from the settings in fixedpt.h,
+so changing FIXEDPT_FRACBITS no longer means regenerating constants by hand.
+
+The table has ATAN_TBL_SEGS+1 entries: entry i is atan(i/ATAN_TBL_SEGS) in
+binary radians, shifted left by ATAN_TBL_XBITS extra bits of precision.
+fxp_atan2_lut() interpolates between adjacent entries using the low
+ATAN_TBL_FBITS bits of the ratio, with 16-bit unsigned arithmetic. So we
+pick the largest ATAN_TBL_XBITS such that the biggest step between entries,
+times 2^ATAN_TBL_FBITS, still fits in 16 bits.
+*/
+#include <stdio.h>
+#include <math.h>
+#include "fixedpt.h"
+
+#define SEGS_BITS 6 /* 64 segments over [0,1]; max. interp. error ~0.001 deg */
+#define FBITS 7     /* bits of interpolation between entries */
+
+int main(void) {
+   const int segs = 1 << SEGS_BITS;
+   double scale, step;
+   int i, xbits;
+
+   for(xbits = 4; xbits >= 0; xbits--) {
+      scale = ldexp(FIXEDPT_BRAD_SEMICIRC / M_PI, xbits);
+      step = ceil(scale * atan(1.0 / segs)); /* the first step is biggest */
+      if(step * (1 << FBITS) < 65536.0 && scale * M_PI / 4 < 65536.0) break;
+   }
+   if(xbits < 0) {
+      fprintf(stderr, "mkatan: FIXEDPT_BRAD_SEMICIRC too big for table\n");
+      return -1;
+   }
+
+   printf("/* atan_tbl.h -- generated by mkatan; DO NOT EDIT */\n");
+   printf("#ifndef ATAN_TBL_H\n#define ATAN_TBL_H\n\n");
+   printf("#define ATAN_TBL_SEGS %d\n", segs);
+   printf("#define ATAN_TBL_FBITS %d\n", FBITS);
+   printf("#define ATAN_TBL_QBITS %d\n", SEGS_BITS + FBITS);
+   printf("#define ATAN_TBL_XBITS %d\n\n", xbits);
+   printf("static const uint16_t _atan_tbl[ATAN_TBL_SEGS+1] PROGMEM = {");
+   for(i = 0; i <= segs; i++) {
+      printf("%s0x%04lx,", i % 8 ? " " : "\n   ",
+       lround(scale * atan((double)i / segs)));
+   }
+   printf("\n};\n\n#endif /* ifndef ATAN_TBL_H */\n");
+   return 0;
+}
@@ -0,0 +1,113 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* mkframes -- generate the display frames used by compass.c
+
+This is a host program, run at build time (see the Makefile). It writes
+frame_tbl.h to stdout: every image the compass ever shows, eight rows
+each, already in the bit order the display controller expects (see
+matrix8x8_pixels()), so that drawing one is a table index and a call to
+matrix8x8_drawP().
+
+Frames 0 to 15 are the 16 points of the compass, starting at north and
+going clockwise, in the order of the sectors of sector_tbl.h. Then come
+the error and warning frames: FRAME_ERR ("ERR", a failed sensor read) and
+FRAME_TILT and FRAME_INTF, with FRAME_TILT_INTF for both. The warning
+numbers are FRAME_ERR with one bit or the other set, so the frame for any
+mix of warnings is FRAME_ERR or'd with the frame number of each.
+*/
+#include <stdio.h>
+#include <stdint.h>
+
+/* The strokes that make up the 16 points; e.g., NNE is "NORTH NORTH
+   EAST". Each is a bar in one row of the image, with bit 7 the leftmost
+   pixel. */
+#define PT_NORTH 0x01 /* "NORTH" */
+#define PT_N2    0x02 /* extra "NORTH" prefix */
+#define PT_SOUTH 0x04
+#define PT_S2    0x08
+#define PT_EAST  0x10
+#define PT_E2    0x20
+#define PT_WEST  0x40
+#define PT_W2    0x80
+
+static const struct { uint8_t flag, row, bits; } _strokes[] = {
+   { PT_NORTH, 5, 0x7c }, { PT_N2, 3, 0x7c },
+   { PT_SOUTH, 6, 0x7c }, { PT_S2, 4, 0x7c },
+   { PT_EAST,  7, 0xf0 }, { PT_E2, 2, 0xf0 },
+   { PT_WEST,  7, 0x0f }, { PT_W2, 2, 0x0f },
+};
+
+static const uint8_t _points[16] = {
+   PT_NORTH,                          PT_NORTH | PT_N2 | PT_EAST,
+   PT_NORTH | PT_EAST,                PT_NORTH | PT_EAST | PT_E2,
+   PT_EAST,                           PT_SOUTH | PT_EAST | PT_E2,
+   PT_SOUTH | PT_EAST,                PT_SOUTH | PT_S2 | PT_EAST,
+   PT_SOUTH,                          PT_SOUTH | PT_S2 | PT_WEST,
+   PT_SOUTH | PT_WEST,                PT_SOUTH | PT_WEST | PT_W2,
+   PT_WEST,                           PT_NORTH | PT_WEST | PT_W2,
+   PT_NORTH | PT_WEST,                PT_NORTH | PT_N2 | PT_WEST,
+};
+
+#define NPOINTS (sizeof(_points) / sizeof(_points[0]))
+#define NSTROKES (sizeof(_strokes) / sizeof(_strokes[0]))
+
+/*** pixels() -- the same conversion as matrix8x8_pixels() ***/
+static uint8_t pixels(uint8_t x) {
+   x = x >> 4 | x << 4;
+   x = (x & 0xCC) >> 2 | (x & 0x33) << 2;
+   x = (x & 0xAA) >> 1 | (x & 0x55) << 1;
+   return (x >> 1) | (x << 7);
+}
+
+static void frame(const uint8_t * const img, const char * const name) {
+   int row;
+
+   printf("   {");
+   for(row = 0; row < 8; row++)
+      printf("%s0x%02x", row ? ", " : " ", pixels(img[row]));
+   printf(" }, /* %s */\n", name);
+}
+
+int main(void) {
+   static const char * const names[NPOINTS] = {
+      "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
+      "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW",
+   };
+   uint8_t img[8] = { 0 };
+   unsigned i, s;
+
+   printf("/* frame_tbl.h -- generated by mkframes; DO NOT EDIT */\n");
+   printf("#ifndef FRAME_TBL_H\n#define FRAME_TBL_H\n\n");
+   printf("#define FRAME_POINTS %u\n", (unsigned)NPOINTS);
+   printf("#define FRAME_ERR %u\n", (unsigned)NPOINTS);
+   printf("#define FRAME_TILT %u\n", (unsigned)NPOINTS | 1);
+   printf("#define FRAME_INTF %u\n", (unsigned)NPOINTS | 2);
+   printf("#define FRAME_TILT_INTF %u\n", (unsigned)NPOINTS | 3);
+   printf("#define FRAME_N %u\n\n", (unsigned)NPOINTS + 4);
+   printf("static const uint8_t _frame_tbl[FRAME_N][8] PROGMEM = {\n");
+
+   for(i = 0; i < NPOINTS; i++) {
+      for(s = 0; s < 8; s++) img[s] = 0;
+      for(s = 0; s < NSTROKES; s++)
+         if(_points[i] & _strokes[s].flag)
+            img[_strokes[s].row] = _strokes[s].bits;
+      frame(img, names[i]);
+   }
+
+   /* "ERR" is three pixels down the left edge; "TILT" and "INTF" are four
+      down the rightmost column and the one next to it. */
+   for(s = 0; s < 8; s++) img[s] = 0;
+   img[2] = img[3] = img[4] = 0x80;
+   frame(img, "ERR");
+   for(i = 1; i < 4; i++) {
+      for(s = 0; s < 8; s++) img[s] = 0;
+      if(i & 1) img[2] = img[3] = img[4] = img[5] = 0x01;
+      if(i & 2)
+         for(s = 3; s < 7; s++) img[s] |= 0x02;
+      frame(img, i == 1 ? "TILT" : i == 2 ? "INTF" : "TILT, INTF");
+   }
+
+   printf("};\n\n#endif /* ifndef FRAME_TBL_H */\n");
+   return 0;
+}
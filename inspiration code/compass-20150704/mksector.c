@@ -0,0 +1,79 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+
+/* mksector -- generate the heading-to-sector table used by compass.c
+
+This is a host program, run at build time (see the Makefile). It writes
+sector_tbl.h to stdout. Like mkatan, it takes its settings from fixedpt.h,
+so the table always matches FIXEDPT_BRAD_SEMICIRC.
+
+The circle is divided into SECTOR_N equal sectors, sector 0 centred on
+north and the rest following clockwise. The table has 2^SECTOR_TBL_BITS
+entries, one per bin of equal width; a heading (from 0 up to a full
+circle) is looked up by its top SECTOR_TBL_BITS bits, which is one shift
+and one load. The low four bits of each entry are the sector the centre
+of the bin falls in. The high four bits are the sector to stay on if that
+was the previous one: the neighbouring sector for bins within SECTOR_HYST
+brads of a sector edge, the bin's own sector otherwise. So the caller's
+hysteresis is just
+
+   e = table[hdg >> SECTOR_TBL_SHIFT];
+   cur = (e >> 4) == prev ? prev : (e & 0x0f);
+
+The hysteresis band is effectively rounded to whole bins. All three
+settings can be overridden with -D where the Makefile builds mksector.
+*/
+#include <stdio.h>
+#include <math.h>
+#include "fixedpt.h"
+
+#ifndef SECTOR_N
+#define SECTOR_N 16 /* points of the compass shown on the display */
+#endif
+#ifndef SECTOR_TBL_BITS
+#define SECTOR_TBL_BITS 8
+#endif
+#ifndef SECTOR_HYST
+#define SECTOR_HYST (FIXEDPT_BRAD_SEMICIRC / 128) /* about 1.4 degrees */
+#endif
+
+#if SECTOR_N < 2 || SECTOR_N > 16
+#error SECTOR_N must be from 2 to 16 (it has to fit in four bits)
+#endif
+#if SECTOR_TBL_BITS > FIXEDPT_FRACBITS + 4
+#error SECTOR_TBL_BITS is more than the bits in a heading
+#endif
+
+int main(void) {
+   const double circle = 2.0 * FIXEDPT_BRAD_SEMICIRC, w = circle / SECTOR_N;
+   const int bins = 1 << SECTOR_TBL_BITS;
+   double c, s, off;
+   int i, m, hold;
+
+   if(SECTOR_HYST >= w / 2) {
+      fprintf(stderr, "mksector: SECTOR_HYST is more than half a sector\n");
+      return -1;
+   }
+
+   printf("/* sector_tbl.h -- generated by mksector; DO NOT EDIT */\n");
+   printf("#ifndef SECTOR_TBL_H\n#define SECTOR_TBL_H\n\n");
+   printf("#define SECTOR_N %d\n", SECTOR_N);
+   printf("#define SECTOR_TBL_BITS %d\n", SECTOR_TBL_BITS);
+   printf("#define SECTOR_TBL_SHIFT %d\n\n", FIXEDPT_FRACBITS + 4 - SECTOR_TBL_BITS);
+   printf("static const uint8_t _sector_tbl[1 << SECTOR_TBL_BITS] PROGMEM = {");
+   for(i = 0; i < bins; i++) {
+      /* s is the position of the bin's centre in sectors, counted from the
+         start of sector 0 (half a sector anticlockwise of north); off is
+         how far into its sector that is, in brads. */
+      c = (i + 0.5) * circle / bins;
+      s = (c + w / 2) / w;
+      m = (int)floor(s) % SECTOR_N;
+      off = (s - floor(s)) * w;
+      if(off < SECTOR_HYST) hold = (m + SECTOR_N - 1) % SECTOR_N;
+      else if(w - off < SECTOR_HYST) hold = (m + 1) % SECTOR_N;
+      else hold = m;
+      printf("%s0x%02x,", i % 12 ? " " : "\n   ", hold << 4 | m);
+   }
+   printf("\n};\n\n#endif /* ifndef SECTOR_TBL_H */\n");
+   return 0;
+}
@@ -0,0 +1,84 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#include <stdint.h>
+#include <hmc5883l/hmc5883l.h>
+#include "fixedpt.h"
+#include "heading.h"
+#include "tempcomp.h"
+#include "validate.h"
+#include "pipeline.h"
+
+/* The stages below do exactly what tempcomp(), heading() and validate()
+   do, one block at a time. They use nothing but the fixed-point routines,
+   so the same code builds for the host (see bench/pipeline.c), where it
+   can be run over recorded sessions.
+
+   Samples whose reading failed (PIPE_ERR_SAT or PIPE_ERR_I2C) go through
+   the arithmetic like the rest -- it is cheaper than testing for them --
+   but their flags are kept, and the caller must ignore their results. */
+
+/*** pipe_tempcomp() -- temperature-compensate a block of raw readings
+
+As tempcomp(), for each sample of the block. Both run the same code (this
+calls tempcomp() on each sample), so they can't give different answers.
+
+Arguments:
+   b -- pointer to the block; pos[] is modified in-place
+   tc -- sensitivity ratios, as set by tempcomp_set()
+***/
+void pipe_tempcomp(pipe_block_t * const b, const tempcomp_t * const tc) {
+   hmc5883l_pos_t *p = b->pos;
+   uint8_t i;
+
+   for(i = b->n; i; i--, p++) tempcomp(p, tc);
+}
+
+/*** pipe_heading() -- find the polar form of a block of readings
+
+As heading(), for each sample of the block; the results go in pol[]. Both
+run heading_polar(), so they can't give different answers.
+
+Arguments:
+   b -- pointer to the block; pos[] must be temperature-compensated
+   hx -- calibration, as prepared by heading_set()
+***/
+void pipe_heading(pipe_block_t * const b, const heading_xform_t * const hx) {
+   const hmc5883l_pos_t *p = b->pos;
+   fxp_polar_t *pol = b->pol;
+   uint8_t i;
+
+   for(i = b->n; i; i--, p++, pol++) heading_polar(p, hx, pol);
+}
+
+/*** pipe_validate() -- check a block of adjusted readings
+
+As validate(), for each sample of the block. The VLD_ERR_* flags found are
+or-ed into err[], keeping any flags already there.
+
+Arguments:
+   b -- pointer to the block; pol[] must have been filled in by
+      pipe_heading()
+***/
+void pipe_validate(pipe_block_t * const b) {
+   uint8_t i;
+
+   for(i = 0; i < b->n; i++) b->err[i] |= validate(b->pol + i);
+}
+
+/*** pipe_run() -- run a block of raw readings through all the stages
+
+Equivalent to calling tempcomp(), heading() and validate() on each sample
+in turn, except that each stage finishes the whole block before the next
+starts.
+
+Arguments:
+   b -- pointer to the block, with n, pos[] and err[] filled in
+   tc -- sensitivity ratios, as set by tempcomp_set()
+   hx -- calibration, as prepared by heading_set()
+***/
+void pipe_run(pipe_block_t * const b, const tempcomp_t * const tc,
+ const heading_xform_t * const hx) {
+   pipe_tempcomp(b, tc);
+   pipe_heading(b, hx);
+   pipe_validate(b);
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <hmc5883l/hmc5883l.h>
+#include "fixedpt.h"
+#include "heading.h"
+#include "tempcomp.h"
+
+/* Number of samples handled per pass through the pipeline. Each stage
+   runs over the whole block before the next one starts. The firmware
+   keeps this small (RAM is 512 bytes, and the display is only updated
+   once per block); host programs replaying recorded data can make it as
+   big as they like. */
+#ifndef PIPE_BLOCK
+#define PIPE_BLOCK 4
+#endif
+#if PIPE_BLOCK < 1 || PIPE_BLOCK > 255
+#error PIPE_BLOCK must fit in the uint8_t sample count
+#endif
+
+/* Per-sample error flags. The low two bits are the VLD_ERR_* values from
+   validate(); the others are set by whatever filled the block. */
+#define PIPE_ERR_SAT 0x04 /* sensor saturated (HMC5883L_ERR_SATURATED) */
+#define PIPE_ERR_I2C 0x08 /* no reading (any other sensor error) */
+
+typedef struct {
+   uint8_t n;                      /* number of samples in use */
+   hmc5883l_pos_t pos[PIPE_BLOCK]; /* raw, then temperature-compensated */
+   fxp_polar_t pol[PIPE_BLOCK];    /* adjusted reading, from heading() */
+   uint8_t err[PIPE_BLOCK];        /* PIPE_ERR_* and VLD_ERR_* flags */
+} pipe_block_t;
+
+void pipe_tempcomp(pipe_block_t * const b, const tempcomp_t * const tc)
+ __attribute__((nonnull(1,2)));
+void pipe_heading(pipe_block_t * const b, const heading_xform_t * const hx)
+ __attribute__((nonnull(1,2)));
+void pipe_validate(pipe_block_t * const b) __attribute__((nonnull(1)));
+void pipe_run(pipe_block_t * const b, const tempcomp_t * const tc,
+ const heading_xform_t * const hx) __attribute__((nonnull(1,2,3)));
+
+#endif /* ifndef PIPELINE_H */
@@ -0,0 +1,180 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#include <stdint.h>
+#include "fixedpt.h"
+#include "rotate.h"
+#include "quat.h"
+
+/* Products of two quaternion components have 2*QUAT_FRACBITS fraction
+   bits and, like the sums of up to four of them below, fit in an
+   fxp_sq_t. QROUND is half a unit of the result, for rounding. */
+#define QROUND ((fxp_sq_t)1 << (QUAT_FRACBITS-1))
+
+/*** dot4() -- sum of four products of quaternion components, rounded ***/
+static fixedpt_t dot4(const fixedpt_t a0, const fixedpt_t b0,
+ const fixedpt_t a1, const fixedpt_t b1, const fixedpt_t a2, const fixedpt_t b2,
+ const fixedpt_t a3, const fixedpt_t b3) {
+   return ((fxp_sq_t)a0 * b0 + (fxp_sq_t)a1 * b1 + (fxp_sq_t)a2 * b2 +
+    (fxp_sq_t)a3 * b3 + QROUND) >> QUAT_FRACBITS;
+}
+
+/*** quat_elem() -- find elemental rotation that puts point on given plane
+
+The quaternion equivalent of rot_find(), which see for the arguments; the
+fourth is a pointer to the quat_t into which the result is written.
+
+rot_find() gives a rotation by theta, where cos(theta) = b/d and
+sin(theta) = -a/d (d being the length of {a,b}). The quaternion needs
+cos(theta/2) and sin(theta/2), which are in the direction of {d+b, -a}:
+half way between {d,0} and {b,-a}. So no trig is needed, just one
+distance and one reciprocal to normalize.
+***/
+void quat_elem(const fixedpt_t a, const fixedpt_t b, const int idx,
+ quat_t * const q) {
+   fixedpt_t w = b, v = a, d;
+   ufixedpt_t u;
+   fxp_recip_t r;
+
+   /* Scale {a,b} so that the larger is in [2^(FIXEDPT_BITS-4),
+      2^(FIXEDPT_BITS-3)): big enough that the direction of {d+b,-a} is
+      precise whatever the size of the input, and small enough that d+b
+      can't overflow. */
+   u = (a < 0 ? -(ufixedpt_t)a : a) | (b < 0 ? -(ufixedpt_t)b : b);
+   if(u) {
+      while(u < (ufixedpt_t)1 << (FIXEDPT_BITS-4)) { u <<= 1; v <<= 1; w <<= 1; }
+      while(u >= (ufixedpt_t)1 << (FIXEDPT_BITS-3)) { u >>= 1; v >>= 1; w >>= 1; }
+   }
+
+   /* When b < 0, d+b cancels and loses the direction. Multiplying
+      {d+b,-a} through by d-b (which is a^2/(d+b)) and dividing by -a gives
+      {-a, d-b} instead: the same direction or its opposite, and a
+      quaternion and its negative are the same rotation. */
+   d = fxp_dist(v, w, FIXEDPT_ZERO);
+   if(w < 0) { d -= w; w = -v; v = d; } /* {-a, d-b} */
+   else { w += d; v = -v; }             /* {d+b, -a} */
+   if(w < 0) { w = -w; v = -v; } /* keep w >= 0, for tidiness */
+
+   d = fxp_dist(w, v, FIXEDPT_ZERO);
+   q->x = q->y = q->z = 0;
+   if(d == 0) { /* {a,b} is the origin */
+      q->w = QUAT_ONE;
+      v = 0;
+   } else {
+      r = fxp_recip(QUAT_ONE, d);
+      q->w = fxp_recip_mul(w, r);
+      v = fxp_recip_mul(v, r);
+   }
+
+   if(idx == 0) q->x = v;
+   else if(idx == 1) q->y = v;
+   else q->z = v;
+}
+
+/*** quat_compose() -- follow rotation A by rotation B, leaving result in A
+
+Sets A to the rotation that does A and then B (the quaternion product BA),
+like rot_mult() does for matrices.
+
+The arguments are pointers to the quaternions in question. Each component
+of the result is rounded; call quat_norm() after a long chain of these.
+***/
+void quat_compose(quat_t * const a, const quat_t * const b) {
+   quat_t r;
+
+   r.w = dot4(b->w, a->w, -b->x, a->x, -b->y, a->y, -b->z, a->z);
+   r.x = dot4(b->w, a->x, b->x, a->w, b->y, a->z, -b->z, a->y);
+   r.y = dot4(b->w, a->y, -b->x, a->z, b->y, a->w, b->z, a->x);
+   r.z = dot4(b->w, a->z, b->x, a->y, -b->y, a->x, b->z, a->w);
+   *a = r;
+}
+
+/*** quat_norm() -- scale a quaternion back to unit length
+
+Rounding in quat_compose() lets the length drift from one, which would
+scale points as well as rotate them. This puts it back. The length is
+found as fxp_dist() of w, x and the length of {y,z}, so no new square
+root code is needed.
+***/
+void quat_norm(quat_t * const q) {
+   fixedpt_t h;
+   fxp_recip_t r;
+
+   h = fxp_dist(q->w, q->x, fxp_dist(q->y, q->z, FIXEDPT_ZERO));
+   if(h == 0) { QUAT_IDENTITY(*q); return; }
+   r = fxp_recip(QUAT_ONE, h);
+   q->w = fxp_recip_mul(q->w, r); q->x = fxp_recip_mul(q->x, r);
+   q->y = fxp_recip_mul(q->y, r); q->z = fxp_recip_mul(q->z, r);
+}
+
+/*** quat_rotate() -- rotate a single point using a quaternion
+
+Rotates a point (specified by the hmc5883l_pos_t pointed to by the first
+argument) by the rotation given by the quaternion pointed to by the second
+argument. The point is rotated in-place.
+
+Uses p' = p + w t + u x t, where u is the vector part of the quaternion and
+t = 2 u x p. The coordinates must be less than a quarter of the fixedpt_t
+range (as magnetometer readings are) so that t can't overflow.
+***/
+void quat_rotate(hmc5883l_pos_t * const pos, const quat_t * const q) {
+   fixedpt_t tx, ty, tz;
+
+   tx = ((fxp_sq_t)q->y * pos->z - (fxp_sq_t)q->z * pos->y + QROUND/2) >>
+    (QUAT_FRACBITS-1);
+   ty = ((fxp_sq_t)q->z * pos->x - (fxp_sq_t)q->x * pos->z + QROUND/2) >>
+    (QUAT_FRACBITS-1);
+   tz = ((fxp_sq_t)q->x * pos->y - (fxp_sq_t)q->y * pos->x + QROUND/2) >>
+    (QUAT_FRACBITS-1);
+
+   pos->x += ((fxp_sq_t)q->w * tx + (fxp_sq_t)q->y * tz -
+    (fxp_sq_t)q->z * ty + QROUND) >> QUAT_FRACBITS;
+   pos->y += ((fxp_sq_t)q->w * ty + (fxp_sq_t)q->z * tx -
+    (fxp_sq_t)q->x * tz + QROUND) >> QUAT_FRACBITS;
+   pos->z += ((fxp_sq_t)q->w * tz + (fxp_sq_t)q->x * ty -
+    (fxp_sq_t)q->y * tx + QROUND) >> QUAT_FRACBITS;
+}
+
+/*** quat_yaw() -- turn a rotation further about the Z axis
+
+Follows the rotation pointed to by the first argument with a rotation by
+the second argument (in binary radians) about the Z axis, which after
+calibration is the axis the user turns about. Passing a heading h (as
+calibrate_rezero() does) makes a reading that was heading h read as north,
+without redoing the whole calibration.
+***/
+void quat_yaw(quat_t * const q, const fixedpt_t angle) {
+   fixedpt_t s, c;
+   quat_t e;
+
+   fxp_sincos(angle, &s, &c);
+   quat_elem(-s, c, 2, &e); /* rotation by theta, where sin(theta) = s */
+   quat_compose(q, &e);
+   quat_norm(q);
+}
+
+/*** quat_to_rot() -- convert a quaternion to a rotation matrix
+
+Writes the rotation matrix (as used by rot_posn()) equivalent to the
+quaternion pointed to by the first argument into the rotation_t pointed to
+by the second. rot_posn() multiplies by columns, so the matrix is the
+transpose of the usual one.
+***/
+void quat_to_rot(const quat_t * const q, rotation_t * const rot) {
+   const fxp_sq_t one = (fxp_sq_t)1 << (2*QUAT_FRACBITS);
+   const fxp_sq_t w = q->w, x = q->x, y = q->y, z = q->z;
+
+/* entry from a product-scale value: round to FIXEDPT_FRACBITS */
+#define ENT(v) ((fixedpt_t)(((v) + ((fxp_sq_t)1 << \
+ (2*QUAT_FRACBITS-FIXEDPT_FRACBITS-1))) >> (2*QUAT_FRACBITS-FIXEDPT_FRACBITS)))
+
+   rot->r[0][0] = ENT(one - 2*(y*y + z*z));
+   rot->r[1][0] = ENT(2*(x*y - w*z));
+   rot->r[2][0] = ENT(2*(x*z + w*y));
+   rot->r[0][1] = ENT(2*(x*y + w*z));
+   rot->r[1][1] = ENT(one - 2*(x*x + z*z));
+   rot->r[2][1] = ENT(2*(y*z - w*x));
+   rot->r[0][2] = ENT(2*(x*z - w*y));
+   rot->r[1][2] = ENT(2*(y*z + w*x));
+   rot->r[2][2] = ENT(one - 2*(x*x + y*y));
+#undef ENT
+}
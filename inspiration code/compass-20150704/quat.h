@@ -0,0 +1,36 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef QUAT_H
+#define QUAT_H
+
+#include <hmc5883l/hmc5883l.h>
+#include "fixedpt.h"
+#include "rotate.h"
+
+/* A rotation as a unit quaternion. The components are never bigger than
+   one, so they use all but the top two bits of a fixedpt_t for the
+   fraction (QUAT_FRACBITS) rather than FIXEDPT_FRACBITS. That is eight
+   times the precision of a rotation_t entry, at the default settings.
+
+   The rotation is applied to a point as q p q*, so composing rotations
+   (quat_compose()) and renormalizing the result (quat_norm()) is cheap,
+   and it's easy to turn an existing rotation a little more. For applying
+   the same rotation to many points, export it to a rotation_t with
+   quat_to_rot() and use rot_posn(). */
+#define QUAT_FRACBITS (FIXEDPT_BITS-2)
+#define QUAT_ONE ((fixedpt_t)1 << QUAT_FRACBITS)
+
+typedef struct { fixedpt_t w, x, y, z; } quat_t;
+
+#define QUAT_IDENTITY(q) do { (q).w = QUAT_ONE; (q).x = (q).y = (q).z = 0; \
+ } while(0)
+
+void quat_elem(const fixedpt_t a, const fixedpt_t b, const int idx,
+ quat_t * const q);
+void quat_compose(quat_t * const a, const quat_t * const b);
+void quat_norm(quat_t * const q);
+void quat_rotate(hmc5883l_pos_t * const pos, const quat_t * const q);
+void quat_yaw(quat_t * const q, const fixedpt_t angle);
+void quat_to_rot(const quat_t * const q, rotation_t * const rot);
+
+#endif /* ifndef QUAT_H */
@@ -29,10 +29,12 @@ result will be written.
 void rot_find(const fixedpt_t a, const fixedpt_t b, const int idx,
  rotation_t * const rot) {
    fixedpt_t d, dsin, dcos;
+   fxp_recip_t r;
    int i, j;
 
    d = fxp_dist(a, b, FIXEDPT_ZERO); /* equiv. to d = sqrtf(a*a + b*b) */
-   dsin = -fxp_div(a,d); dcos = fxp_div(b,d);
+   r = fxp_recip(FIXEDPT_ONE, d); /* 1/d, so we divide only once */
+   dsin = -fxp_recip_mul(a,r); dcos = fxp_recip_mul(b,r);
 
    for(i = 0; i < 3; i++) for(j = 0; j < 3; j++) rot->r[i][j] = FIXEDPT_ZERO;
    i = idx+1; if(i == 3) i = 0;
@@ -53,17 +55,9 @@ pointed to by the second argument, overwriting the original data.
 void rot_posn(hmc5883l_pos_t * const pos, const rotation_t * const rot) {
    fixedpt_t x, y, z;
 
-   x=fxp_mul(rot->r[0][0], pos->x) +
-     fxp_mul(rot->r[1][0], pos->y) +
-     fxp_mul(rot->r[2][0], pos->z);
-
-   y=fxp_mul(rot->r[0][1], pos->x) +
-     fxp_mul(rot->r[1][1], pos->y) +
-     fxp_mul(rot->r[2][1], pos->z);
-
-   z=fxp_mul(rot->r[0][2], pos->x) +
-     fxp_mul(rot->r[1][2], pos->y) +
-     fxp_mul(rot->r[2][2], pos->z);
+   x=fxp_dot3(rot->r[0][0], pos->x, rot->r[1][0], pos->y, rot->r[2][0], pos->z);
+   y=fxp_dot3(rot->r[0][1], pos->x, rot->r[1][1], pos->y, rot->r[2][1], pos->z);
+   z=fxp_dot3(rot->r[0][2], pos->x, rot->r[1][2], pos->y, rot->r[2][2], pos->z);
 
    pos->x=x; pos->y=y; pos->z=z;
 }
@@ -82,9 +76,8 @@ void rot_mult(rotation_t * const a, const rotation_t * const b) {
 
    for(i = 0; i < 3; i++) {
       for(j = 0; j < 3; j++) {
-         r.r[i][j] = fxp_mul(a->r[i][0], b->r[0][j]) +
-                     fxp_mul(a->r[i][1], b->r[1][j]) +
-                     fxp_mul(a->r[i][2], b->r[2][j]);
+         r.r[i][j] = fxp_dot3(a->r[i][0], b->r[0][j], a->r[i][1], b->r[1][j],
+                              a->r[i][2], b->r[2][j]);
       }
    }
 
@@ -30,11 +30,19 @@
    default, just-erased state: all bits 1. (This is not a valid calibration
    state, so it's easy to tell apart from a used slot.)
 
-   On an ATtiny85 with 512 bytes of EEPROM, we can fit 17 slots of
-   calibration data (at 30 bytes each). Since each update touches two
+   The slot in use also carries a format number and a checksum. The
+   layout of calibration_t has changed before (the rotation used to be a
+   matrix, and each slot 30 bytes), and if the EEPROM is kept across a
+   reflash (EESAVE set), what is there may be an older layout read at the
+   wrong boundaries. Data that doesn't check out are treated the same as
+   no data, so the user is made to calibrate again. Bump CAL_FORMAT
+   whenever calibration_t changes.
+
+   On an ATtiny85 with 512 bytes of EEPROM, we can fit 23 slots of
+   calibration data (at 22 bytes each). Since each update touches two
    slots (clearing the old one and updating the new one), and the slots
-   are used in rotation, this should make the EEPROM last 8.5 times
-   as long -- 850K cycles instead of 100K.
+   are used in rotation, this should make the EEPROM last 11.5 times
+   as long -- 1.15M cycles instead of 100K.
 */
 
 #include <string.h>
@@ -53,8 +61,48 @@
    big enough to hold a copy of the calibration data: */
 #define SLOTS (EEPROM_SIZE / sizeof(calibration_t))
 
+#define CAL_FORMAT 2 /* 1 was the rotation matrix, with no format byte */
+
 static calibration_t EEMEM _cal[SLOTS];
 
+/*** cal_sum() -- add up the bytes of a set of calibration data
+
+Returns the sum, modulo 256, of every byte of the calibration_t pointed to
+by the argument, including its check byte. stored_cal_set() sets the check
+byte so that this is zero.
+***/
+static uint8_t cal_sum(const calibration_t * const src) {
+   const uint8_t *p = (const uint8_t *)src;
+   uint8_t j, sum = 0;
+
+   for(j = 0; j < sizeof(*src); j++) sum += p[j];
+   return sum;
+}
+
+/*** find_slot() -- find the slot in use, if any
+
+Reads each slot in turn into the buffer pointed to by the argument, until
+one is found that isn't entirely erased.
+
+Returns the zero-based index of that slot (whose contents are left in the
+buffer), or a negative value if the EEPROM is entirely empty.
+***/
+static int find_slot(calibration_t * const buf) {
+   int i, j;
+   uint8_t *p = (uint8_t *)buf;
+
+   /* Read each slot in turn. (Reads do not wear out the EEPROM.) */
+   for(i = 0; i < SLOTS; i++) {
+      eeprom_read_block(buf, _cal+i, sizeof(*buf));
+
+      /* If any byte is something other than all-bits-1, then we
+         have found the right slot. */
+      for(j = 0; j < sizeof(*buf); j++) if(p[j] != 0xff) return i;
+   }
+
+   return -1; /* EEPROM is entirely empty */
+}
+
 /*** stored_cal_get() -- get calibration data from EEPROM, if present
 
 Retrieves the current calibration data from EEPROM, if any calibration
@@ -65,23 +113,15 @@ should be copied, or NULL if no copy is required.
 
 Returns the zero-based slot index in which the current calibration data
 are stored, or a negative value if EEPROM contains no calibration data.
+A slot whose format number or checksum is wrong counts as no calibration
+data.
 ***/
 int stored_cal_get(calibration_t * const dst) {
-   int i, j;
+   int i;
    calibration_t buf;
-   uint8_t *p = (uint8_t *)&buf;
-
-   /* Read each slot in turn. (Reads do not wear out the EEPROM.) */
-   for(i = 0; i < SLOTS; i++) {
-      eeprom_read_block(&buf, _cal+i, sizeof(buf));
-
-      /* If any byte is something other than all-bits-1, then we
-         have found the right slot; break out of the outer loop. */
-      for(j = 0; j < sizeof(buf); j++) if(p[j] != 0xff) break;
-      if(j < sizeof(buf)) break;
-   }
 
-   if(i == SLOTS) return -1; /* EEPROM is entirely empty */
+   if((i = find_slot(&buf)) < 0) return -1;
+   if(buf.format != CAL_FORMAT || cal_sum(&buf)) return -1;
 
    if(dst) memcpy(dst, &buf, sizeof(buf));
    return i;
@@ -94,16 +134,17 @@ data to be retrieved with stored_cal_get() (even after a power failure or
 reset event).
 
 The argument is a pointer to a buffer containing the calibration data to
-be stored.
+be stored. Its format and check bytes are filled in here.
 ***/
 void stored_cal_set(calibration_t * const src) {
    int i, j;
    calibration_t buf;
    uint8_t *p = (uint8_t *)&buf;
 
-   /* Find out what slot contains the current calibration data, or if
-      EEPROM is totally empty. */
-   if((i = stored_cal_get(NULL)) >= 0) {
+   /* Find out what slot is in use, or if EEPROM is totally empty. (The
+      slot in use may hold data in an old format, but it is cleared all
+      the same.) */
+   if((i = find_slot(&buf)) >= 0) {
 
       /* Clear the slot containing the current calibration data.
          (We need to do this by creating a buffer that's all-bits-1
@@ -121,5 +162,8 @@ void stored_cal_set(calibration_t * const src) {
    } else i = 0; /* If EEPROM is empty, just start with slot zero. */
  
    /* Write the new calibration data into the next slot: */ 
+   src->format = CAL_FORMAT;
+   src->check = 0;
+   src->check = -cal_sum(src);
    eeprom_update_block(src, _cal+i, sizeof(buf));
 }
@@ -20,17 +20,34 @@ sensor axis has become between calibration time and now. This, in turn,
 allows us to scale a current reading to the same sensitivity level in
 effect during calibration.
 
+The ratios between the two measurements change only when a new self-test
+is done, so tempcomp_set() finds them then (dividing once per axis) and
+tempcomp() applies them to each reading with no division at all.
+
 Arguments:
    pos -- pointer to hmc5883l_pos_t containing raw sensor reading (before
       any translation or rotation); this data will be modified in-place
       to contain the temperature-compensated equivalent.
-   cur -- sensitivty measurement from self-test, acquired near the same
-      time as the sample pointed to by pos
+   tc -- sensitivity ratios, as set by tempcomp_set()
+***/
+void tempcomp(hmc5883l_pos_t * const pos, const tempcomp_t * const tc) {
+   pos->x = fxp_recip_mul(pos->x, tc->x);
+   pos->y = fxp_recip_mul(pos->y, tc->y);
+   pos->z = fxp_recip_mul(pos->z, tc->z);
+}
+
+/*** tempcomp_set() -- find sensitivity ratios for tempcomp()
+
+Call this whenever either sensitivity measurement changes.
+
+Arguments:
+   tc -- pointer to tempcomp_t into which the ratios are written
+   cur -- sensitivty measurement from self-test, acquired recently
    orig -- sensitivity measurement from the time of calibration
 ***/
-void tempcomp(hmc5883l_pos_t * const pos, const hmc5883l_pos_t * const cur,
+void tempcomp_set(tempcomp_t * const tc, const hmc5883l_pos_t * const cur,
  const hmc5883l_pos_t * const orig) {
-   pos->x = fxp_scale(pos->x, orig->x, cur->x);
-   pos->y = fxp_scale(pos->y, orig->y, cur->y);
-   pos->z = fxp_scale(pos->z, orig->z, cur->z);
+   tc->x = fxp_recip(orig->x, cur->x);
+   tc->y = fxp_recip(orig->y, cur->y);
+   tc->z = fxp_recip(orig->z, cur->z);
 }
@@ -3,7 +3,11 @@
 
 #include <hmc5883l/hmc5883l.h>
 
-void tempcomp(hmc5883l_pos_t * const pos, const hmc5883l_pos_t * const cur,
+/* per-axis sensitivity ratios, from tempcomp_set() */
+typedef struct { fxp_recip_t x, y, z; } tempcomp_t;
+
+void tempcomp_set(tempcomp_t * const tc, const hmc5883l_pos_t * const cur,
  const hmc5883l_pos_t * const orig);
+void tempcomp(hmc5883l_pos_t * const pos, const tempcomp_t * const tc);
 
 #endif /* ifndef TEMPCOMP_H */
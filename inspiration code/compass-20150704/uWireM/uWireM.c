@@ -0,0 +1,207 @@
+/* Copyright (c) 2014-2015 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "uWireM.h"
+
+/* Interrupt-driven I2C master on the USI, in the manner of AVR310 (see
+   USI_TWI_Master.c, which this replaces except for initialization).
+
+   The USI shifts one bit for every two toggles of SCL, and raises its
+   counter overflow interrupt after a byte (or an ACK bit) has gone by.
+   Nothing in the USI makes the SCL edges by itself, so Timer/Counter0
+   ticks at twice the bus rate and each tick strobes USITC. The tick
+   handler is two instructions: it does nothing while the overflow flag is
+   set, so the bus simply stalls (with SCL low, as I2C allows) until the
+   overflow handler has set up the next byte or bit and cleared the flag.
+
+   Start and stop conditions are made by hand, with the same short delays
+   as AVR310 uses. Clock stretching by slaves is honoured only there; the
+   HMC5883L and HT16K33 don't stretch. */
+
+#define TICK_TOP (F_CPU / 2 / UWIREM_HZ - 1)
+#if TICK_TOP < 1 || TICK_TOP > 255
+#error UWIREM_HZ is out of range for Timer/Counter0 at this F_CPU
+#endif
+
+#if UWIREM_QLEN & (UWIREM_QLEN - 1)
+#error UWIREM_QLEN must be a power of two
+#endif
+
+/* USISR values: clear all flags and set the counter to overflow after
+   8 bits (16 edges) or 1 bit (2 edges). */
+#define USISR_8BIT ((1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC)|(0x0<<USICNT0))
+#define USISR_1BIT ((1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC)|(0xE<<USICNT0))
+
+/* What the byte or bit that just overflowed the counter was: */
+#define PH_TX 0     /* address or data byte sent */
+#define PH_TX_ACK 1 /* ACK from slave for it */
+#define PH_RX 2     /* data byte received */
+#define PH_RX_ACK 3 /* ACK (or NACK) to slave for it */
+
+static uWireM_txn_t *_q[UWIREM_QLEN];
+static uint8_t _head, _count, _pos, _left, _phase, _err;
+
+/*** begin() -- make start condition and send address byte of transaction
+
+Called with interrupts disabled, when the bus is idle.
+***/
+static void begin(uWireM_txn_t * const t) {
+   /* Release SCL to ensure that (repeated) Start can be performed */
+   PORT_USI |= (1<<PIN_USI_SCL);
+   while(!(PIN_USI & (1<<PIN_USI_SCL)));
+   _delay_us(T2_TWI/4);
+
+   /* Generate Start Condition */
+   PORT_USI &= ~(1<<PIN_USI_SDA);
+   _delay_us(T4_TWI/4);
+   PORT_USI &= ~(1<<PIN_USI_SCL);
+   PORT_USI |= (1<<PIN_USI_SDA);
+
+   USIDR = t->buf[0];
+   _pos = 1;
+   _left = t->len;
+   _phase = PH_TX;
+
+   /* Start ticking from here, so that SCL stays low for a full tick. */
+   TCNT0 = 0;
+   TIFR = 1<<OCF0A;
+   TIMSK |= 1<<OCIE0A;
+   USISR = USISR_8BIT;
+}
+
+/*** finish() -- make stop condition, retire transaction and begin next
+
+Called from the counter overflow handler.
+***/
+static void finish(uWireM_txn_t * const t, const uint8_t err) {
+   PORT_USI &= ~(1<<PIN_USI_SDA);
+   PORT_USI |= (1<<PIN_USI_SCL);
+   while(!(PIN_USI & (1<<PIN_USI_SCL)));
+   _delay_us(T4_TWI/4);
+   PORT_USI |= (1<<PIN_USI_SDA);
+   _delay_us(T2_TWI/4);
+
+   /* With the counter flag still set, the tick handler does nothing, but
+      there is no point in running it until there's something to send. */
+   TIMSK &= ~(1<<OCIE0A);
+
+   t->err = err;
+   t->busy = 0;
+   if(t->done) t->done(t);
+
+   /* t->done() may have queued something. t was still counted then, so
+      uWireM_queue() left it for us to begin. */
+   _head = (_head + 1) & (UWIREM_QLEN - 1);
+   if(--_count) begin(_q[_head]);
+}
+
+ISR(TIMER0_COMPA_vect, ISR_NAKED) {
+   asm volatile(
+      "sbis %[sr], %[oif]\n\t"
+      "sbi %[cr], %[tc]\n\t"
+      "reti\n\t"
+      :: [sr] "I" (_SFR_IO_ADDR(USISR)), [oif] "I" (USIOIF),
+         [cr] "I" (_SFR_IO_ADDR(USICR)), [tc] "I" (USITC));
+}
+
+ISR(USI_OVF_vect) {
+   uWireM_txn_t * const t = _q[_head];
+
+   switch(_phase) {
+      case PH_TX: /* clock in the slave's ACK */
+         DDR_USI &= ~(1<<PIN_USI_SDA);
+         _phase = PH_TX_ACK;
+         USISR = USISR_1BIT;
+         break;
+
+      case PH_TX_ACK:
+         DDR_USI |= (1<<PIN_USI_SDA);
+         if(USIDR & (1<<TWI_NACK_BIT)) {
+            USIDR = 0xff;
+            finish(t, _pos == 1 ? USI_TWI_NO_ACK_ON_ADDRESS :
+             USI_TWI_NO_ACK_ON_DATA);
+         } else if(!--_left) {
+            USIDR = 0xff;
+            finish(t, 0);
+         } else if(t->buf[0] & (1<<TWI_READ_BIT)) {
+            USIDR = 0xff;
+            DDR_USI &= ~(1<<PIN_USI_SDA);
+            _phase = PH_RX;
+            USISR = USISR_8BIT;
+         } else {
+            USIDR = t->buf[_pos++];
+            _phase = PH_TX;
+            USISR = USISR_8BIT;
+         }
+         break;
+
+      case PH_RX: /* store it; ACK it, or NACK it if it's the last */
+         t->buf[_pos++] = USIDR;
+         USIDR = --_left ? 0x00 : 0xff;
+         DDR_USI |= (1<<PIN_USI_SDA);
+         _phase = PH_RX_ACK;
+         USISR = USISR_1BIT;
+         break;
+
+      default: /* PH_RX_ACK */
+         USIDR = 0xff;
+         if(!_left) finish(t, 0);
+         else {
+            DDR_USI &= ~(1<<PIN_USI_SDA);
+            _phase = PH_RX;
+            USISR = USISR_8BIT;
+         }
+         break;
+   }
+}
+
+void uWireM_init(void) {
+   uint8_t sreg = SREG;
+
+   cli();
+   USI_TWI_Master_Initialise();
+   USICR |= 1<<USIOIE;
+
+   /* Timer/Counter0 in CTC mode, no prescaling; its interrupt is only
+      enabled while a transfer is under way. */
+   TIMSK &= ~(1<<OCIE0A);
+   TCCR0A = 1<<WGM01;
+   TCCR0B = 1<<CS00;
+   OCR0A = TICK_TOP;
+   _head = _count = 0;
+   SREG = sreg;
+}
+
+uint8_t uWireM_queue(uWireM_txn_t * const t) {
+   uint8_t sreg = SREG;
+
+   cli();
+   if(_count == UWIREM_QLEN) {
+      SREG = sreg;
+      return FALSE;
+   }
+   t->busy = 1;
+   t->err = 0;
+   _q[(_head + _count++) & (UWIREM_QLEN - 1)] = t;
+   if(_count == 1) begin(t);
+   SREG = sreg;
+   return TRUE;
+}
+
+uint8_t uWireM_xfer(uint8_t * const buf, const uint8_t len) {
+   static uWireM_txn_t t;
+
+   t.buf = buf; t.len = len; t.done = NULL;
+   while(!uWireM_queue(&t));
+   while(t.busy);
+   _err = t.err;
+   return !_err;
+}
+
+uint8_t uWireM_err(void) {
+   return _err;
+}
@@ -5,20 +5,47 @@
 
 /* See README for introduction and licensing information. */
 
+#include <stdint.h>
 #include "USI_TWI_Master.h"
 
+/* Bus clock in Hz. The bus is clocked by Timer/Counter0 interrupts, one per
+   SCL edge, so this must divide evenly into F_CPU/2 ticks of no more than
+   256. 100kHz (standard mode) costs about a third of the CPU while a
+   transfer is under way -- still better than all of it. */
+#ifndef UWIREM_HZ
+#define UWIREM_HZ 100000UL
+#endif
+
+/* Most transactions that can be waiting at once (a power of two): */
+#ifndef UWIREM_QLEN
+#define UWIREM_QLEN 8
+#endif
+
+/* A transaction for uWireM_queue(). The buffer and length are as for
+   uWireM_xfer(). The caller owns the structure and the buffer, and must
+   leave both alone until busy goes back to zero. */
+typedef struct uWireM_txn uWireM_txn_t;
+struct uWireM_txn {
+   uint8_t *buf;
+   uint8_t len;
+   volatile uint8_t busy; /* non-0 from uWireM_queue() until done */
+   uint8_t err;           /* 0, or a USI_TWI_* error code; valid once done */
+   void (*done)(uWireM_txn_t * const t); /* called when done, or NULL */
+};
+
 /*** uWireM_init() -- initialize USI hardware for use as I2C master
 
-This macro calls an initialization function which sets up the USI
-hardware for use as an I2C master. It must be called once before any
-I2C data can be sent or received using uWireM_xfer().
+This function sets up the USI hardware for use as an I2C master, and
+Timer/Counter0 to clock it. It must be called once before any I2C data
+can be sent or received using uWireM_queue() or uWireM_xfer(); global
+interrupts must also be enabled (with sei()) before any transfer.
 
 It must also be called again after the USI hardware is powered down
 and back up, before any further I2C communication can take place.
 
 Takes no arguments; returns void.
 ***/
-#define uWireM_init USI_TWI_Master_Initialise
+void uWireM_init(void);
 
 /*** uWireM_addr_send() -- calculate first transfer byte for I2C send
 
@@ -57,21 +84,41 @@ including the initial address byte. This must be a value in the range
 2-255, and the buffer pointed to by the first argument must be of at least
 the specified length.
 
+This waits for the transfer (and any queued ahead of it) to finish; see
+uWireM_queue() for a way that doesn't. It must not be called from a
+uWireM_txn_t's done function.
+
 Returns TRUE on success, FALSE on failure. In the event of a failure,
 the specific problem can be determined by calling uWireM_err().
 ***/
-#define uWireM_xfer USI_TWI_Start_Transceiver_With_Data
+uint8_t uWireM_xfer(uint8_t * const buf, const uint8_t len);
+
+/*** uWireM_queue() -- start I2C transfer without waiting for it
+
+Adds a transaction to the queue of transfers, and returns at once. The
+transfers are done one after another, in the order queued, by interrupt
+handlers; when this one is done, its busy member goes to zero, its err
+member is set, and its done function (if any) is called. The done
+function runs in interrupt context: it should be short, and may queue
+more transactions (to chain them) but must not wait for any.
+
+The argument is a pointer to the transaction, with buf, len and done
+filled in. It must not already be queued.
+
+Returns TRUE if queued, FALSE if the queue is full.
+***/
+uint8_t uWireM_queue(uWireM_txn_t * const t) __attribute__((nonnull(1)));
 
 /*** uWireM_err() -- get error code after failed data transfer
 
-This macro can be used to get the error code after a call to uWireM_xfer()
-has returned FALSE to indicate failure.
+This function can be used to get the error code after a call to
+uWireM_xfer() has returned FALSE to indicate failure.
 
 Takes no arguments.
 
 The value returned is one of the USI_TWI_* error codes defined in
 USI_TWI_Master.h.
 ***/
-#define uWireM_err USI_TWI_Get_State_Info
+uint8_t uWireM_err(void);
 
 #endif /* ifndef U_WIRE_M_H */
@@ -2,10 +2,10 @@
 #include <hmc5883l/hmc5883l.h>
 #include "validate.h"
 
-/* TILT_RATIO is the sine of the angle beyond which a tilt state is
-   considered to exist, as a fixedpt_t. */
-/* 2^FIXEDPT_FRACBITS=2^11=2048; sin(20)*2048 ~= 0x02BC */
-#define TILT_RATIO ((fixedpt_t)0x02BC) /* ~20 degrees */
+/* TILT_SIN2 is the square of the sine of the angle beyond which a tilt
+   state is considered to exist, in 256ths: sin(20)^2*256 ~= 30, which is
+   20.02 degrees. */
+#define TILT_SIN2 30
 
 /* MAG_MIN and MAG_MAX give the (inclusive) range of absolute magnitude
    of magnetometer reading (after correction for hard-iron interference)
@@ -18,13 +18,16 @@
    headings even in the face of some interference, we will permit a somewhat
    wider range: 0.20 to 0.80 Gauss.
 
-   The magnetometer gain is set to 1090 LSb/Ga, so the components of the
-   reading (and the overall magnitude) can be treated as integers with units
-   of (1/1090)Ga.
+   The components of the reading (and the overall magnitude) can be treated
+   as integers with units of (1/HMC5883L_GAIN)Ga. At the usual gain of 1090
+   LSb/Ga, the limits are 0.20*1090 = 0x00DA, 0.80*1090 = 0x0368. */
+#define MAG_MIN ((fixedpt_t)(0.20 * HMC5883L_GAIN))
+#define MAG_MAX ((fixedpt_t)(0.80 * HMC5883L_GAIN))
 
-   Thus, the limits are 0.20*1090 = 0x00DA, 0.80*1090 = 0x0368 */
-#define MAG_MIN ((fixedpt_t)0x00DA)
-#define MAG_MAX ((fixedpt_t)0x0368)
+/* tilt_lim() is mag2*TILT_SIN2/256, rounded down, without overflow. */
+static fxp_usq_t tilt_lim(const fxp_usq_t mag2) {
+   return (mag2 >> 8) * TILT_SIN2 + (((mag2 & 255) * TILT_SIN2) >> 8);
+}
 
 /*** validate() -- test if adjusted magnetometer reading makes sense
 
@@ -33,7 +36,8 @@ after the constant offset has been subtracted away, and after the reading
 has been rotated using the calibration matrix.)
 
 Arguments:
-   pos -- pointer to hmc5883l_pos_t containing adjusted reading
+   pol -- pointer to fxp_polar_t containing the polar form of the adjusted
+      reading, as filled in by heading()
 
 Returns a binary-or of zero or more of the following:
    VLD_ERR_TILT -- adjusted reading is too far from the plane of rotation
@@ -44,24 +48,22 @@ Returns a binary-or of zero or more of the following:
 
 If no problem is detected, returns 0 (VLD_ERR_OK).
 ***/
-int validate(const hmc5883l_pos_t * const pos) {
+int validate(const fxp_polar_t * const pol) {
    int rtn = VLD_ERR_OK;
-   fixedpt_t dist;
-
-   /* Let dist be the distance from the reading to the origin: */
-   dist = fxp_dist(pos->x, pos->y, pos->z);
 
    /* Imagine a line segment S from the origin to the reading. If
       the angle theta between S and the XY plane exceeds a threshold, then
-      a tilt condition exists. Since sin(theta) = pos->z / dist, we can
-      test for tilt simply by checking if (pos->z / dist) is greater than
-      a constant. */
-   if(fxp_abs(fxp_div(pos->z, dist)) > TILT_RATIO) rtn |= VLD_ERR_TILT;
+      a tilt condition exists. Since sin(theta) = z / dist, we can test
+      for tilt simply by checking if it is greater than a constant. Both
+      sides are squared, so that neither the square root for dist nor the
+      division is needed: z^2 > sin^2 * dist^2. */
+   if(FXP_SQ(pol->z) > tilt_lim(pol->mag2)) rtn |= VLD_ERR_TILT;
 
    /* If the absolute magnitude of the reading isn't in a range that makes
       sense for Earth's natural magnetic field, return an interference
-      indication. */
-   if(dist < MAG_MIN || dist > MAG_MAX) rtn |= VLD_ERR_INTF;
+      indication. (Squared, like the magnitude.) */
+   if(pol->mag2 < FXP_SQ(MAG_MIN) || pol->mag2 > FXP_SQ(MAG_MAX))
+      rtn |= VLD_ERR_INTF;
 
    return rtn;
 }
@@ -1,12 +1,12 @@
 #ifndef VALIDATE_H
 #define VALIDATE_H
 
-#include <hmc5883l/hmc5883l.h>
+#include "fixedpt.h"
 
 #define VLD_ERR_OK 0
 #define VLD_ERR_TILT 0x01
 #define VLD_ERR_INTF 0x02
 
-int validate(const hmc5883l_pos_t * const pos);
+int validate(const fxp_polar_t * const pol);
 
 #endif /* ifndef VALIDATE_H */
@@ -10,10 +10,10 @@
 
 typedef struct { hmc5883l_pos_t n, w, c; } nwc_t;
 
-#if FIXEDPT_FRACBITS < 6
-#error This code assumes FIXEDPT_FRACBITS is at least 6.
-#endif
-#define DELTA ((fixedpt_t)(1 << (FIXEDPT_FRACBITS-6)))
+/* DELTA is the smallest movement counted as a new point on the calibration
+   circle. Readings are raw sensor counts whatever FIXEDPT_FRACBITS is, so
+   this is in counts: about 0.03Ga at 1090 LSb/Ga. */
+#define DELTA ((fixedpt_t)32)
 
 #define DIST(a,b) fxp_dist(a.x - b.x, a.y - b.y, a.z - b.z)
 
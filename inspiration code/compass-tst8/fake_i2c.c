@@ -0,0 +1,313 @@
+/* Copyright (c) 2014 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+/*****************************************************************************
+fake_i2c -- simulated I2C buses with an HMC5883L on them
+
+This is an i2c_backend_t (see i2c_ops.h) that answers for an HMC5883L at
+HMC5883L_ADDR entirely in user space, so that hmc5883l.c can be run and
+timed without the hardware. It understands the calls i2c_ops.c makes: the
+SMBus byte and byte-data transfers, plain read() and combined I2C_RDWR
+transactions.
+
+fake_i2c_open() gives a single bus with just the sensor on it. With
+fake_i2c_mock(), buses are instead plain files standing in for the i2c-*
+nodes (see i2c_dev_dir), so that finding devices can be tried out too.
+Each file describes its bus, one item per line:
+
+   1e          -- there is a device at this (hex) address
+   delay 2000  -- each transfer on this bus takes this many microseconds
+
+A device at HMC5883L_ADDR is the simulated sensor (the same one on every
+bus); one at any other address answers, but reads as all ones. Transfers
+to an address with no device fail, as on a real bus.
+
+The simulated sensor behaves as the data sheet describes in the ways the
+driver depends on:
+
+   - registers 0-12, with the ID registers reading "H43"
+   - the register pointer goes up by one for each byte read or written,
+     wraps from 12 back to 0, and from 8 back to 3
+   - writing 0x01 to the mode register starts a single measurement, which
+     takes FAKE_MEAS_NS; then the mode register goes back to idle
+   - RDY, in the status register, is cleared only while a measurement's
+     data are being written, for the last FAKE_WRITE_NS of it; then it is
+     set again. Reading the data doesn't clear it, and neither does
+     starting a measurement, so until the write a poll reads the old RDY
+     and a read gets the old data. During the write the data registers
+     are half new and half old.
+
+The field it measures is 0.5Ga (at the default gain), horizontal, turning
+about the Z axis at FAKE_DEG_PER_S, so the heading changes steadily. Time
+is the real (monotonic) time, so the driver's sleeps are real sleeps.
+*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "i2c_ops.h"
+#include <linux/i2c-dev.h>
+#include "diag.h"
+#include "debug.h"
+#include "hmc5883l.h"
+#include "fake_i2c.h"
+
+#define FAKE_MEAS_NS 6000000L /* a single measurement at 8x averaging */
+#define FAKE_WRITE_NS 250000L /* ...the end of which is writing the data */
+#define FAKE_DEG_PER_S 30.0
+#define FAKE_FIELD 545.0      /* 0.5Ga at 1090 LSb/Ga */
+
+#define REG_MR 2
+#define REG_DATA 3
+#define REG_SR 9
+#define NREGS 13
+
+#define FAKE_MAXFD 256
+
+/* What's on each bus, by descriptor */
+typedef struct {
+   char present[128];
+   long delay_us;
+   uint8_t slave;
+} bus_t;
+
+static bus_t _bus[FAKE_MAXFD];
+static uint8_t _regs[NREGS], _ptr;
+static int _measuring;
+static struct timespec _done; /* when the measurement under way ends */
+
+/* The buses can be searched from several threads at once (see i2c_ops.c) */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(struct timespec * const t) {
+   struct timespec n;
+
+   clock_gettime(CLOCK_MONOTONIC, &n);
+   if(t) *t = n;
+   return n.tv_sec + n.tv_nsec * 1e-9;
+}
+
+/*** fill() -- write the field at time t to data registers first..last-1 ***/
+static void fill(const struct timespec * const t, const int first,
+ const int last) {
+   double a;
+   int16_t v[3];
+   int i;
+
+   a = (t->tv_sec + t->tv_nsec * 1e-9) * FAKE_DEG_PER_S * M_PI / 180;
+   v[0] = (int16_t)lround(FAKE_FIELD * cos(a)); /* X */
+   v[1] = 0;                                    /* Z */
+   v[2] = (int16_t)lround(-FAKE_FIELD * sin(a)); /* Y */
+   for(i = first; i < last; i++) {
+      _regs[REG_DATA + 2*i] = (uint8_t)(v[i] >> 8);
+      _regs[REG_DATA + 2*i + 1] = (uint8_t)v[i];
+   }
+}
+
+/*** update() -- bring the measurement under way up to date ***/
+static void update(void) {
+   struct timespec n;
+   long left;
+
+   if(!_measuring) return;
+   now(&n);
+   left = (_done.tv_sec - n.tv_sec) * 1000000000L + _done.tv_nsec - n.tv_nsec;
+   if(left > FAKE_WRITE_NS) return;
+
+   if(left > 0) {
+      /* Writing the data: RDY is low and only X is new so far */
+      _regs[REG_SR] &= ~0x01;
+      fill(&_done, 0, 1);
+      return;
+   }
+   fill(&_done, 0, 3);
+   _regs[REG_SR] |= 0x01;
+   _regs[REG_MR] = 0x03;
+   _measuring = 0;
+}
+
+static void advance(void) {
+   if(_ptr == REG_DATA + 5) _ptr = REG_DATA;
+   else if(++_ptr >= NREGS) _ptr = 0;
+}
+
+static uint8_t rd(void) {
+   uint8_t v;
+
+   update();
+   v = _regs[_ptr];
+   advance();
+   return v;
+}
+
+static void wr(const uint8_t v) {
+   update();
+   if(_ptr == REG_MR && (v & 0x03) == 0x01) {
+      _measuring = 1;
+      now(&_done);
+      _done.tv_nsec += FAKE_MEAS_NS;
+      if(_done.tv_nsec >= 1000000000L) {
+         _done.tv_sec++;
+         _done.tv_nsec -= 1000000000L;
+      }
+   }
+   if(_ptr < REG_DATA) _regs[_ptr] = v; /* the rest are read-only */
+   advance();
+}
+
+/*** xfer() -- one message: a write (pointer, then data) or a read ***/
+static int xfer(const bus_t * const bus, const uint16_t addr,
+ const int rd_flag, uint8_t * const buf, const int len) {
+   int i;
+
+   if(addr > 127 || !bus->present[addr]) { errno = ENXIO; return -1; }
+   if(addr != HMC5883L_ADDR) {
+      if(rd_flag) memset(buf, 0xff, len);
+      return 0;
+   }
+   if(rd_flag) {
+      for(i = 0; i < len; i++) buf[i] = rd();
+   } else if(len > 0) {
+      _ptr = buf[0] < NREGS ? buf[0] : 0;
+      for(i = 1; i < len; i++) wr(buf[i]);
+   }
+   return 0;
+}
+
+/*** load() -- (re)read the description of the mock bus open on fd ***/
+static int load(bus_t * const bus, const int fd) {
+   char text[1024], *line, *save;
+   ssize_t n;
+   unsigned addr;
+   long us;
+
+   if((n = pread(fd, text, sizeof(text) - 1, 0)) < 0) return -1;
+   text[n] = '\0';
+   memset(bus, 0, sizeof(*bus));
+   for(line = strtok_r(text, "\n", &save); line;
+    line = strtok_r(NULL, "\n", &save)) {
+      if(sscanf(line, " delay %ld", &us) == 1) bus->delay_us = us;
+      else if(sscanf(line, " %x", &addr) == 1 && addr < 128)
+         bus->present[addr] = 1;
+   }
+   return 0;
+}
+
+/*** transfer() -- do one ioctl, other than I2C_SLAVE, on a bus ***/
+static int transfer(bus_t * const bus, const unsigned long req,
+ void * const arg) {
+   struct i2c_smbus_ioctl_data *sm = arg;
+   struct i2c_rdwr_ioctl_data *rw = arg;
+   uint8_t b[2];
+   unsigned i;
+
+   switch(req) {
+      case I2C_SMBUS:
+         b[0] = sm->command;
+         if(sm->size == I2C_SMBUS_BYTE && sm->read_write == I2C_SMBUS_WRITE)
+            return xfer(bus, bus->slave, 0, b, 1);
+         if(sm->size != I2C_SMBUS_BYTE_DATA) break;
+         if(sm->read_write == I2C_SMBUS_WRITE) {
+            b[1] = sm->data->byte;
+            return xfer(bus, bus->slave, 0, b, 2);
+         }
+         if(xfer(bus, bus->slave, 0, b, 1)) return -1;
+         return xfer(bus, bus->slave, 1, &(sm->data->byte), 1);
+
+      case I2C_RDWR:
+         for(i = 0; i < rw->nmsgs; i++)
+            if(xfer(bus, rw->msgs[i].addr, rw->msgs[i].flags & I2C_M_RD,
+             rw->msgs[i].buf, rw->msgs[i].len))
+               return -1;
+         return rw->nmsgs;
+   }
+   errno = EINVAL;
+   return -1;
+}
+
+/*** bus_delay() -- take the bus's transfer time, outside the lock ***/
+static void bus_delay(const int fd) {
+   struct timespec t;
+   long us;
+
+   pthread_mutex_lock(&_lock);
+   us = _bus[fd].delay_us;
+   pthread_mutex_unlock(&_lock);
+   if(us <= 0) return;
+   t.tv_sec = us / 1000000L;
+   t.tv_nsec = us % 1000000L * 1000L;
+   nanosleep(&t, NULL);
+}
+
+static int fake_ioctl(const int fd, const unsigned long req, void * const arg) {
+   int rtn;
+
+   if(fd < 0 || fd >= FAKE_MAXFD) { errno = EBADF; return -1; }
+   if(req != I2C_SLAVE) bus_delay(fd);
+   pthread_mutex_lock(&_lock);
+   if(req == I2C_SLAVE) {
+      /* Done first thing on every newly opened bus, so it's where a mock
+         bus's file is read */
+      rtn = load(&_bus[fd], fd);
+      _bus[fd].slave = (uint8_t)(unsigned long)arg;
+   } else rtn = transfer(&_bus[fd], req, arg);
+   pthread_mutex_unlock(&_lock);
+   return rtn;
+}
+
+static ssize_t fake_read(const int fd, void * const buf, const size_t len) {
+   ssize_t rtn;
+
+   if(fd < 0 || fd >= FAKE_MAXFD) { errno = EBADF; return -1; }
+   bus_delay(fd);
+   pthread_mutex_lock(&_lock);
+   rtn = xfer(&_bus[fd], _bus[fd].slave, 1, buf, len) ? -1 : (ssize_t)len;
+   pthread_mutex_unlock(&_lock);
+   return rtn;
+}
+
+static const i2c_backend_t _fake = { fake_ioctl, fake_read };
+
+/*** fake_i2c_mock() -- switch to the simulated buses
+
+Makes all bus operations go to the simulated HMC5883L from now on, on
+buses that are the mock files described above.
+***/
+void fake_i2c_mock(void) {
+   memset(_regs, 0, sizeof(_regs));
+   _regs[10] = 'H'; _regs[11] = '4'; _regs[12] = '3';
+   _regs[REG_MR] = 0x03;
+   _ptr = 0;
+   _measuring = 0;
+   i2c_backend = &_fake;
+}
+
+/*** fake_i2c_open() -- switch to the simulated bus and open it
+
+As fake_i2c_mock(), then opens a bus with nothing on it but the sensor,
+with the current slave set to addr (as by the I2C_SLAVE ioctl, which
+i2c_open() does for a real bus). Returns a descriptor to use in place of
+one from hmc5883l_open(), or a negative value on failure. It's open on
+/dev/null, so it can be close()d as usual.
+***/
+int fake_i2c_open(const uint8_t addr) {
+   int fd;
+
+   if((fd = open("/dev/null", O_RDWR)) < 0)
+      return sysdiag("open", "can't open /dev/null");
+   if(fd >= FAKE_MAXFD) {
+      close(fd);
+      return diag("too many open files for the simulated bus");
+   }
+   fake_i2c_mock();
+   memset(&_bus[fd], 0, sizeof(_bus[fd]));
+   _bus[fd].present[HMC5883L_ADDR] = 1;
+   _bus[fd].slave = addr;
+   return fd;
+}
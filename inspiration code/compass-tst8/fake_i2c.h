@@ -0,0 +1,11 @@
+/* Copyright (c) 2014 Douglas Henke <dhenke@mythopoeic.org>
+   This is free software -- see COPYING for details.           */
+#ifndef FAKE_I2C_H
+#define FAKE_I2C_H
+
+#include <stdint.h>
+
+void fake_i2c_mock(void);
+int fake_i2c_open(const uint8_t addr);
+
+#endif /* ifndef FAKE_I2C_H */
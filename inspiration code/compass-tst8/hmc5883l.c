@@ -2,9 +2,11 @@
    This is free software -- see COPYING for details.           */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
-#include <linux/i2c-dev.h>
+#include <time.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include "diag.h"
 #include "debug.h"
@@ -21,9 +23,33 @@
 #define REG_IRB 11 /* ID B = '4' */
 #define REG_IRC 12 /* ID C = '3' */
 
+#define SR_RDY 0x01 /* status: data ready */
+
+/* In HMC5883L_RDWR mode, hmc5883l_read() neither polls the status register
+   nor fetches the data until at least wait_ns has passed since the
+   measurement was triggered. RDY alone can't be trusted before then: it
+   stays set after the data are read and after the next measurement is
+   started, and only drops for the ~250us while the new data are written,
+   so a poll that comes too early reads the old RDY and would fetch the old
+   data. wait_ns starts at MEAS_NS, the longest a measurement takes at the
+   fastest rate the data sheet gives (1s/160Hz), and is never less.
+
+   If the poll then finds RDY clear, the sensor was caught writing; it is
+   polled again after POLL_MIN_NS, then twice as long before each poll
+   after that (but never more than POLL_MAX_NS), for up to POLL_MAX polls.
+   The time it took is then an upper bound on how long this sensor's
+   measurements take, and becomes wait_ns. A poll that finds RDY set says
+   nothing about when the data were written, so wait_ns never shrinks. */
+#define MEAS_NS 6250000L
+#define POLL_MIN_NS 250000L
+#define POLL_MAX_NS 2000000L
+#define POLL_MAX 32
+
+#define NS(t) ((t).tv_sec * 1000000000L + (t).tv_nsec)
+
 /*** hmc5883l_chk() -- check for HMC5883L magnetometer on I2C bus
 
-This callback function is intended for use with i2c_find() to test for
+This callback function is intended for use with i2c_open() to test for
 the presence of a Honeywell HMC5883L 3-axis digital compass on the I2C
 bus.
 
@@ -39,18 +65,17 @@ the given descriptor.
 ***/
 static int hmc5883l_chk(const int fd) {
    TSTA(fd < 0);
-   if(i2c_smbus_read_byte_data(fd, REG_IRA) != 'H') return -1;
-   if(i2c_smbus_read_byte_data(fd, REG_IRB) != '4') return -1;
-   if(i2c_smbus_read_byte_data(fd, REG_IRC) != '3') return -1;
+   if(i2c_reg_read(fd, REG_IRA) != 'H') return -1;
+   if(i2c_reg_read(fd, REG_IRB) != '4') return -1;
+   if(i2c_reg_read(fd, REG_IRC) != '3') return -1;
    return 0;
 }
 
 /*** hmc5883l_open() -- open fd to talk to HMC5883L
 
-Locates an HMC5883L magentometer on one of the available I2C busses and
-returns an open descriptor prepared to communicate with it. (If there are
-several busses with an HMC5883L connected, one will be chosen arbitrarily.
-But why would that situation exist?)
+Locates an HMC5883L magentometer on one of the available I2C busses (see
+i2c_open()) and returns an open descriptor prepared to communicate with
+it.
 
 The caller is responsible for close()(2)-ing the descriptor when it is no
 longer needed.
@@ -58,7 +83,121 @@ longer needed.
 On error (or if no such device could be located) returns a negative value.
 ***/
 int hmc5883l_open(void) {
-   return i2c_find(0x1e, "HMC5883L", hmc5883l_chk);
+   static const i2c_devtype_t type = { "HMC5883L", HMC5883L_ADDR,
+    hmc5883l_chk };
+
+   return i2c_open(&type);
+}
+
+/*** nap() -- sleep for ns nanoseconds, counting the system call ***/
+static void nap(hmc5883l_state_t * const p, const long ns) {
+   struct timespec t;
+
+   t.tv_sec = ns / 1000000000L;
+   t.tv_nsec = ns % 1000000000L;
+   p->stats.syscalls++;
+   while(nanosleep(&t, &t) && errno == EINTR) p->stats.syscalls++;
+}
+
+/*** since() -- nanoseconds from t until now ***/
+static long since(const struct timespec * const t) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return NS(now) - NS(*t);
+}
+
+/*** read_smbus() -- take a reading the HMC5883L_SMBUS way
+
+Arguments are the sensor state and a buffer for the six data bytes.
+
+Returns 0 on success, non-0 on failure.
+***/
+static int read_smbus(hmc5883l_state_t * const p, uint8_t * const buf) {
+   /* Start a measurement in single measurement mode: */
+   if(i2c_reg_write(p->fd, REG_MR, 0x01))
+      return sysdiag("i2c_reg_write", "can't write to Mode");
+
+   /* Tell the device we want to start reading at DXRA (register 3): */
+   if(i2c_ptr_write(p->fd, REG_DATA))
+      return sysdiag("i2c_ptr_write", "failed writing position");
+
+   /* We could poll the status register here, but on a time-sharing
+      system, we could easily miss the very brief period during which
+      it's low. So instead, we'll just block for a minimum of
+      (1Hz/s)/160Hz = 6250us, after which we know the reading will be
+      ready. */
+   nap(p, 6250000L);
+
+   /* Read all six positions: */
+   if(i2c_read(p->fd, buf, 6) != 6)
+      return sysdiag("read", "failed reading position values");
+   return 0;
+}
+
+/*** read_rdwr() -- take a reading the HMC5883L_RDWR way
+
+Each reading ends by starting the next measurement, in the same combined
+transaction that reads the data, so the sensor is measuring while the
+caller works on the reading just returned. That time is counted towards
+the wait here. Only the first reading (or the first after an error) has to
+start its own measurement.
+
+Status register polls are a combined transaction too: the register
+pointer write and the read, with a repeated start between.
+
+Arguments are the sensor state and a buffer for the six data bytes.
+
+Returns 0 on success, non-0 on failure.
+***/
+static int read_rdwr(hmc5883l_state_t * const p, uint8_t * const buf) {
+   uint8_t r_sr = REG_SR, sr = 0, r_data = REG_DATA, trig[2] = {REG_MR, 0x01};
+   struct i2c_msg poll[2] = {
+      { HMC5883L_ADDR, 0, 1, &r_sr },
+      { HMC5883L_ADDR, I2C_M_RD, 1, &sr },
+   }, fetch[3] = {
+      { HMC5883L_ADDR, 0, 1, &r_data },
+      { HMC5883L_ADDR, I2C_M_RD, 6, buf },
+      { HMC5883L_ADDR, 0, 2, trig }, /* start the next measurement */
+   };
+   long wait, step = POLL_MIN_NS;
+   int n;
+
+   if(!p->started) {
+      if(i2c_rdwr(p->fd, fetch + 2, 1))
+         return sysdiag("i2c_rdwr", "can't start measurement");
+      clock_gettime(CLOCK_MONOTONIC, &(p->t_start));
+      p->started = 1;
+   }
+
+   wait = p->wait_ns - since(&(p->t_start));
+   for(n = 0; ; n++) {
+      if(wait > 0) nap(p, wait);
+      p->stats.polls++;
+      if(i2c_rdwr(p->fd, poll, 2)) {
+         p->started = 0;
+         return sysdiag("i2c_rdwr", "can't read status");
+      }
+      if(sr & SR_RDY) break;
+      if(n == POLL_MAX) {
+         p->started = 0;
+         return diag("HMC5883L reading not ready after %d polls", n + 1);
+      }
+      wait = step;
+      if((step <<= 1) > POLL_MAX_NS) step = POLL_MAX_NS;
+   }
+
+   /* Caught writing: the measurement took longer than we waited. */
+   if(n) p->wait_ns = since(&(p->t_start));
+
+   if(i2c_rdwr(p->fd, fetch, 3)) {
+      p->started = 0;
+      return sysdiag("i2c_rdwr", "failed reading position values");
+   }
+   /* After the whole transaction, so a little later than the trigger:
+      the wait can only come out long, never short. */
+   clock_gettime(CLOCK_MONOTONIC, &(p->t_start));
+   return 0;
 }
 
 /*** hmc5883l_read() -- read sensor values from HMC5883L
@@ -68,6 +207,10 @@ Read the sensor values from the HMC5883L.
 Note: Results are undefined if HMC5883L has not yet been configured
 using hmc5883l_config().
 
+How the sensor is talked to depends on p->mode; see hmc5883l_mode_t.
+Each call adds to the totals in p->stats: the reading, the system calls
+made for it and the time it took.
+
 Arguments:
    fd -- descriptor returned by previous call to hmc5883l_open()
    p -- pointer to data structure into which sensor data is to be
@@ -79,10 +222,13 @@ Arguments:
 Returns 0 on success, non-0 on failure.
 ***/
 int hmc5883l_read(hmc5883l_state_t * const p, hmc5883l_pos_t * const pos) {
-   int i;
+   int i, rtn;
    static int dbg = 0;
    __u8 buf[6];
    int16_t *val = (int16_t *)buf;
+   struct timespec t0;
+   unsigned long calls = i2c_syscalls;
+   double lat;
 #ifdef NEVER
    static const int bits_per_gauss[] = { /* indices are enum gain values */
       1370, 1090, 820, 660, 440, 390, 330, 230
@@ -91,24 +237,15 @@ int hmc5883l_read(hmc5883l_state_t * const p, hmc5883l_pos_t * const pos) {
 
    TSTA(!p); TSTA(p->fd < 0);
 
-   /* Start a measurement in single measurement mode: */
-   if(i2c_smbus_write_byte_data(p->fd, REG_MR, 0x01))
-      return sysdiag("i2c_smbus_write_byte_data", "can't write to Mode");
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   rtn = p->mode == HMC5883L_RDWR ? read_rdwr(p, buf) : read_smbus(p, buf);
+   p->stats.syscalls += i2c_syscalls - calls;
+   if(rtn) return rtn;
 
-   /* Tell the device we want to start reading at DXRA (register 3): */
-   if(i2c_smbus_write_byte(p->fd, REG_DATA))
-      return sysdiag("i2c_smbus_write_byte", "failed writing position");
-
-   /* We could poll the status register here, but on a time-sharing
-      system, we could easily miss the very brief period during which
-      it's low. So instead, we'll just block for a minimum of
-      (1Hz/s)/160Hz = 6250us, after which we know the reading will be
-      ready. */
-   usleep(6250);
-
-   /* Read all six positions: */
-   if(read(p->fd, buf, 6) != 6)
-      return sysdiag("read", "failed reading position values");
+   p->stats.reads++;
+   lat = since(&t0) * 1e-9;
+   p->stats.lat_sum += lat;
+   if(lat > p->stats.lat_max) p->stats.lat_max = lat;
 
    if(!pos) return 0;
 
@@ -138,25 +275,32 @@ Arguments:
 Returns 0 on success or non-0 on error.
 ***/
 int hmc5883l_config(hmc5883l_state_t * const p) {
+   int rtn;
+
    TSTA(!p); TSTA(p->fd < 0);
 
    /* Set config register A for desired averaging and bias. We leave
       the output rate all-bits-zero since we're just going to be using
       single measurement mode: */
-   if(i2c_smbus_write_byte_data(p->fd, REG_CRA,
-    (p->cfg.avg)<<5 | (p->cfg.bias)))
-      return sysdiag("i2c_smbus_write_byte_data", "can't write to CRA");
+   if(i2c_reg_write(p->fd, REG_CRA, (p->cfg.avg)<<5 | (p->cfg.bias)))
+      return sysdiag("i2c_reg_write", "can't write to CRA");
 
    /* Set config register B for desired gain: */
-   if(i2c_smbus_write_byte_data(p->fd, REG_CRB, (p->cfg.gain)<<5))
-      return sysdiag("i2c_smbus_write_byte_data", "can't write to CRB");
+   if(i2c_reg_write(p->fd, REG_CRB, (p->cfg.gain)<<5))
+      return sysdiag("i2c_reg_write", "can't write to CRB");
 
    /* Set mode register to force idle mode: */
-   if(i2c_smbus_write_byte_data(p->fd, REG_MR, 0x03))
-      return sysdiag("i2c_smbus_write_byte_data", "can't write to Mode");
+   if(i2c_reg_write(p->fd, REG_MR, 0x03))
+      return sysdiag("i2c_reg_write", "can't write to Mode");
+
+   /* Nothing is being measured now, whatever was before: */
+   p->started = 0;
+   p->wait_ns = MEAS_NS;
 
    /* If the gain was changed, the next reading will use the old gain.
       Perform a reading and discard the results so the caller doesn't
-      have to worry about this. */
-   return hmc5883l_read(p, NULL);
+      have to worry about this. The statistics start after it. */
+   rtn = hmc5883l_read(p, NULL);
+   memset(&(p->stats), 0, sizeof(p->stats));
+   return rtn;
 }
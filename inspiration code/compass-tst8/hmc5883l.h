@@ -3,8 +3,11 @@
 #ifndef HMC5883L_H
 #define HMC5883L_H
 
+#include <time.h>
 #include "fixedpt.h"
 
+#define HMC5883L_ADDR 0x1e
+
 typedef struct { fixedpt_t x, y, z; } hmc5883l_pos_t;
 
 typedef struct {
@@ -19,9 +22,39 @@ typedef struct {
    GAIN_390=5, GAIN_330=6, GAIN_230=7} gain;
 } hmc5883l_config_t;
 
+/* How hmc5883l_read() talks to the sensor: */
+typedef enum {
+   /* Separate SMBus writes to start a measurement and set the register
+      pointer, a fixed sleep, then a read: four system calls a reading. */
+   HMC5883L_SMBUS = 0,
+
+   /* Combined I2C_RDWR transactions: one reads the data and starts the
+      next measurement; another reads the status register, once long
+      enough has passed since the trigger for RDY to mean the new data.
+      Usually three system calls a reading, and the caller's own time
+      between readings counts towards the wait. */
+   HMC5883L_RDWR = 1
+} hmc5883l_mode_t;
+
+/* Running totals kept by hmc5883l_read(): */
+typedef struct {
+   unsigned long reads;    /* readings taken */
+   unsigned long syscalls; /* system calls made for them, sleeps included */
+   unsigned long polls;    /* status register reads (HMC5883L_RDWR only) */
+   double lat_sum;         /* time spent in hmc5883l_read(), in seconds */
+   double lat_max;         /* longest single hmc5883l_read() */
+} hmc5883l_stats_t;
+
 typedef struct {
    hmc5883l_config_t cfg;
+   hmc5883l_mode_t mode;
    int fd;
+   hmc5883l_stats_t stats;
+
+   /* Used by HMC5883L_RDWR only: */
+   int started;          /* a measurement is under way */
+   struct timespec t_start; /* ...and when it was started */
+   long wait_ns;         /* how long to wait before polling (see .c) */
 } hmc5883l_state_t;
 
 int hmc5883l_open(void);
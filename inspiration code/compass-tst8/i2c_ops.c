@@ -1,21 +1,113 @@
 /* Copyright (c) 2014 Douglas Henke <dhenke@mythopoeic.org>
    This is free software -- see COPYING for details.           */
+/*****************************************************************************
+i2c_ops -- finding I2C devices, and talking to them
+
+Devices are found by type: a program describes each kind of device it
+wants with an i2c_devtype_t, registers them with i2c_register(), then asks
+for each one with i2c_open().
+
+The first i2c_open() looks for every registered type on every bus at once,
+with one thread per bus, so that on a board with many buses the search
+takes about as long as probing the slowest bus rather than all of them in
+turn. Where each type was found is written to the state file i2c_cache
+(see cache_file()).
+After that, i2c_open() only checks that the device is still on the bus
+the state file names; the full search is done again if it isn't.
+
+The buses are the i2c-* nodes in i2c_dev_dir. With the fake backend (see
+fake_i2c.c), they can be plain files in any directory instead, which
+describe a mock bus each.
+*****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include "i2c_ops.h"
 #include <linux/i2c-dev.h>
 #include "diag.h"
 #include "debug.h"
-#include "i2c_ops.h"
 
-#define DEVDIR "/dev"
+#define I2C_MAX_TYPES 8
+
+/* Calls through i2c_backend can come from several threads while buses
+   are being searched */
+#define COUNT() __atomic_add_fetch(&i2c_syscalls, 1, __ATOMIC_RELAXED)
+
+static int dev_ioctl(const int fd, const unsigned long req, void * const arg) {
+   return ioctl(fd, req, arg);
+}
+
+static ssize_t dev_read(const int fd, void * const buf, const size_t len) {
+   return read(fd, buf, len);
+}
+
+const i2c_backend_t i2c_dev_backend = { dev_ioctl, dev_read };
+const i2c_backend_t *i2c_backend = &i2c_dev_backend;
+unsigned long i2c_syscalls;
+
+const char *i2c_dev_dir = "/dev";
+/* i2c_cache points here until a program names another file, which is
+   how cache_file() tells the default from a file chosen on purpose */
+static const char _default_cache[] = I2C_CACHE;
+const char *i2c_cache = _default_cache;
+
+static const i2c_devtype_t *_types[I2C_MAX_TYPES];
+static int _ntypes;
+static int _cache_failed; /* a state file write failed; don't try again */
+
+/* One bus being searched, and which of _types were found on it */
+typedef struct {
+   char path[PATH_MAX];
+   pthread_t thread;
+   int started;
+   char found[I2C_MAX_TYPES];
+} bus_t;
+
+/*** i2c_register() -- add a device type for i2c_open() to look for
+
+The type must stay valid (it's normally static) for as long as
+i2c_open() might be called. Registering a type again does nothing.
+
+Register all the types a program uses before the first i2c_open(), so
+that one search of the buses finds all of them.
+
+Returns 0 on success, or a negative value on failure.
+***/
+int i2c_register(const i2c_devtype_t * const type) {
+   int i;
+
+   TSTA(!type); TSTA(!type->name); TSTA(!type->chk);
+   for(i = 0; i < _ntypes; i++)
+      if(_types[i] == type) return 0;
+   if(_ntypes == I2C_MAX_TYPES)
+      return diag("can't register %s: too many device types", type->name);
+   _types[_ntypes++] = type;
+   return 0;
+}
+
+/*** is_bus() -- check that fname is (or can stand in for) an I2C bus
+
+With the real bus, that means a character device; any other backend gets
+plain files (mock buses) as well. Returns nonzero if it is.
+***/
+static int is_bus(const char * const fname) {
+   struct stat sbuf;
+
+   if(stat(fname, &sbuf)) return 0;
+   return S_ISCHR(sbuf.st_mode) ||
+    (i2c_backend != &i2c_dev_backend && S_ISREG(sbuf.st_mode));
+}
 
 /*** try_dev() -- check if desired I2C device is on a given bus
 
@@ -25,11 +117,10 @@ determine if a specific I2C device is present on the associated bus.
 Arguments:
    fname -- the path to the device-special file associated with the
       I2C bus to be tested
-   addr -- the (unshifted) address of the I2C device we're looking for
-   devname -- pointer to a nul-terminated string containing the human-
-      readable name of the device (typically a part number like "DS1307")
-   callback -- a callback function which should return 0 IFF the
-      desired device is present
+   type -- the device we're looking for: its (unshifted) address, its
+      human-readable name (typically a part number like "DS1307") and
+      chk, a callback function which should return 0 IFF the desired
+      device is present
 
 The callback function is called with a single argument: a file descriptor
 open on the specified bus, which has been initialized to communicate with
@@ -44,31 +135,37 @@ talk to something and 2) attempt to distinguish amongst the various
 devices that can use the address in question, if there are more than one.
 Some devices have ID registers that are ideal for this purpose.
 
+When quiet is nonzero, nothing is reported unless the device is found.
+
 On success, returns a descriptor open and ready to talk to the intended
 slave device (which has been verified as present by the callback).
 
 On failure, returns a negative value.
 ***/
-static int try_dev(const char * const fname, const uint8_t addr,
- const char * const devname, int(*callback)(const int fd)) {
+static int try_dev(const char * const fname, const i2c_devtype_t * const type,
+ const int quiet) {
    int fd = -1, rtn = 0;
 
-   TSTA(!fname); TSTA(!devname); TSTA(!callback);
+   TSTA(!fname); TSTA(!type);
 
    if((fd = open(fname, O_RDWR)) < 0) {
-      rtn = sysdiag("open", "can't open %s", fname); goto done;
+      rtn = quiet ? -1 : sysdiag("open", "can't open %s", fname); goto done;
    }
 
-   if(ioctl(fd, I2C_SLAVE, addr)) {
-      rtn = sysdiag("ioctl", "no I2C slave %02x on %s", addr, fname); goto done;
+   COUNT();
+   if(i2c_backend->ioctl(fd, I2C_SLAVE, (void *)(unsigned long)type->addr)) {
+      rtn = quiet ? -1 :
+       sysdiag("ioctl", "no I2C slave %02x on %s", type->addr, fname);
+      goto done;
    }
 
-   if(callback(fd)) {
-      rtn = diag("no %s at address %02x on %s", devname, addr, fname);
+   if(type->chk(fd)) {
+      rtn = quiet ? -1 :
+       diag("no %s at address %02x on %s", type->name, type->addr, fname);
       goto done;
    }
 
-   diag("%s found at %02x on %s", devname, addr, fname);
+   if(!quiet) diag("%s found at %02x on %s", type->name, type->addr, fname);
 
    done:
    if(rtn && fd >= 0) {
@@ -78,60 +175,307 @@ static int try_dev(const char * const fname, const uint8_t addr,
    return fd;
 }
 
-/*** i2c_find() -- find and open an I2C device
+/*** search() -- thread body: look for each registered type on one bus ***/
+static void *search(void * const arg) {
+   bus_t * const bus = arg;
+   int i, fd;
 
-This function attempts to find a specific I2C device connected to any one of
-the available busses.
+   for(i = 0; i < _ntypes; i++) {
+      if((fd = try_dev(bus->path, _types[i], 1)) < 0) continue;
+      bus->found[i] = 1;
+      if(close(fd)) sysdiag("close", "can't close I2C device");
+   }
+   return NULL;
+}
 
-Arguments:
-   addr -- the unshifted address of the desired I2C device
-   devname -- pointer to a nul-terminated string containing the human-
-      readable name of the device (typically a part number like "DS1307")
-   callback -- pointer to a callback function used to test for the
-      presence of the desired device; see try_dev() above for details
+/*** bus_name() -- true IFF name is what an I2C bus node is called ***/
+static int bus_name(const char * const name) {
+   return !strncmp(name, "i2c-", 4) && strlen(name) >= 5 && !strchr(name, '/');
+}
 
-On success, returns an open file descriptor ready for communication with
-the specified device. The caller must close()(2) this descriptor when it
-is no longer needed.
+static int bus_node(const struct dirent * const ent) {
+   return bus_name(ent->d_name);
+}
 
-On failure, returns a negative value.
+/*** cache_file() -- find the state file to use
+
+Returns i2c_cache, unless that is still the default and we aren't root.
+Then it's I2C_USER_CACHE under $HOME instead (making the directory it's
+in, if need be), since only root can write the default; or NULL, for no
+state file, if HOME isn't set or the name is too long.
 ***/
-int i2c_find(const uint8_t addr, const char * const devname,
-int(*callback)(const int fd)) {
-   DIR *dir=NULL;
-   int fd = -1, rtn = 0;
-   struct dirent *ent;
-   struct stat sbuf;
+static const char *cache_file(void) {
+   static char user[PATH_MAX];
+   static int tried;
+   const char *home;
+   char *slash;
 
-   TSTA(!devname); TSTA(!callback);
+   if(i2c_cache != _default_cache || !geteuid()) return i2c_cache;
+   if(!tried) {
+      tried = 1;
+      if(!(home = getenv("HOME")) || !*home ||
+       snprintf(user, sizeof(user), "%s/%s", home, I2C_USER_CACHE) >=
+       (int)sizeof(user)) {
+         *user = '\0';
+      } else if((slash = strrchr(user, '/'))) {
+         *slash = '\0';
+         mkdir(user, 0700); /* if it fails, so will writing the file */
+         *slash = '/';
+      }
+   }
+   return *user ? user : NULL;
+}
+
+/*** cache_get() -- look up a type in the state file
 
-   if(chdir(DEVDIR)) {
-      rtn = sysdiag("chdir", "can't chdir to %s", DEVDIR); goto done;
+Copies the path of the bus type was last found on to path (PATH_MAX
+bytes). Only entries naming a bus node directly in i2c_dev_dir count, the
+same ones scan() would search: not "/dev/../tmp/i2c-1", say, nor anything
+in a directory below it. An entry too long for path doesn't count either.
+
+Returns 0 if there is one, or a negative value if not.
+***/
+static int cache_get(const i2c_devtype_t * const type, char * const path) {
+   FILE *f;
+   char line[PATH_MAX + 64], name[64];
+   unsigned addr;
+   int rtn = -1, n;
+   const size_t dirlen = strlen(i2c_dev_dir);
+   const char * const file = cache_file();
+
+   if(!file || !(f = fopen(file, "r"))) return -1;
+   while(rtn && fgets(line, sizeof(line), f)) {
+      if(sscanf(line, "%63s %x %n", name, &addr, &n) != 2) continue;
+      if(strcmp(name, type->name) || addr != type->addr) continue;
+      line[strcspn(line, "\n")] = '\0';
+      if(strncmp(line + n, i2c_dev_dir, dirlen) || line[n + dirlen] != '/' ||
+       !bus_name(line + n + dirlen + 1))
+         continue;
+      if(snprintf(path, PATH_MAX, "%s", line + n) >= PATH_MAX) continue;
+      rtn = 0;
    }
+   fclose(f);
+   return rtn;
+}
 
-   if((dir = opendir(".")) == NULL) {
-      rtn = sysdiag("opendir", "can't open %s", DEVDIR); goto done;
+/*** cache_put() -- write what a search found to the state file
+
+One line per registered type that was found: its name, its address in
+hex and the bus it's on. It's written to a temporary file then renamed,
+so a program starting at the same time never sees half of it. The
+temporary file is made by mkstemp() beside the state file, so it is
+always a new file of our own: a name someone else guessed in advance, or
+a symlink left there, can't be written through.
+
+If the state file can't be written, that is reported once, and the
+program carries on without it (searching every bus each time).
+***/
+static void cache_put(bus_t * const buses, const int nbus) {
+   FILE *f;
+   char tmp[PATH_MAX];
+   int i, b, fd;
+   const char * const file = cache_file();
+
+   if(!file || _cache_failed) return;
+   _cache_failed = 1; /* until it's written */
+   if(snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= (int)sizeof(tmp)) {
+      diag("state file name too long: %s", file);
+      return;
+   }
+   if((fd = mkstemp(tmp)) < 0) {
+      sysdiag("mkstemp", "can't write %s", tmp);
+      return;
+   }
+   if(!(f = fdopen(fd, "w"))) {
+      sysdiag("fdopen", "can't write %s", tmp);
+      close(fd);
+      unlink(tmp);
+      return;
+   }
+   for(i = 0; i < _ntypes; i++)
+      for(b = 0; b < nbus; b++)
+         if(buses[b].found[i]) {
+            fprintf(f, "%s %02x %s\n", _types[i]->name, _types[i]->addr,
+             buses[b].path);
+            break;
+         }
+   if(fclose(f) || rename(tmp, file)) {
+      sysdiag("rename", "can't write %s", file);
+      unlink(tmp);
+      return;
    }
+   _cache_failed = 0;
+}
 
-   while((ent = readdir(dir)) != NULL) {
-      if(strlen(ent->d_name) < 5) continue;
-      if(memcmp(ent->d_name, "i2c-", 4)) continue;
-      if(stat(ent->d_name, &sbuf)) {
-         sysdiag("stat", "can't stat %s", ent->d_name);
-         continue;
-      }
-      if(!S_ISCHR(sbuf.st_mode)) continue;
+/*** scan() -- search every bus for every registered type, all at once
+
+Starts one thread per bus in i2c_dev_dir, each running search(), and
+waits for them all. (If a thread can't be started, that bus is searched
+by the calling thread instead.) The results go to the state file, and the
+path of the first bus, in name order, with type on it to path.
+
+Returns 0 if type was found, or a negative value if not.
+***/
+static int scan(const i2c_devtype_t * const type, char * const path) {
+   struct dirent **ents = NULL;
+   struct timespec t0, t1;
+   bus_t *buses = NULL;
+   int i, b, n, nbus = 0, rtn = -1;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   if((n = scandir(i2c_dev_dir, &ents, bus_node, alphasort)) < 0)
+      return sysdiag("scandir", "can't read %s", i2c_dev_dir);
+   if(n && !(buses = calloc(n, sizeof(*buses)))) {
+      rtn = sysdiag("calloc", "can't search %d I2C buses", n); goto done;
+   }
 
-      if((fd = try_dev(ent->d_name, addr, devname, callback)) >= 0) goto done;
+   for(i = 0; i < n; i++) {
+      snprintf(buses[nbus].path, sizeof(buses[nbus].path), "%s/%s",
+       i2c_dev_dir, ents[i]->d_name);
+      if(is_bus(buses[nbus].path)) nbus++;
    }
+   for(b = 0; b < nbus; b++)
+      buses[b].started = !pthread_create(&buses[b].thread, NULL, search,
+       &buses[b]);
+   for(b = 0; b < nbus; b++)
+      if(!buses[b].started) search(&buses[b]);
+   for(b = 0; b < nbus; b++)
+      if(buses[b].started) pthread_join(buses[b].thread, NULL);
 
-   rtn = diag("no I2C device found with address %02x", addr);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   diag("searched %d I2C buses in %.1f ms", nbus,
+    (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) * 1e-6);
+
+   cache_put(buses, nbus);
+   for(i = 0; i < _ntypes && _types[i] != type; i++)
+      ;
+   for(b = 0; rtn && i < _ntypes && b < nbus; b++)
+      if(buses[b].found[i]) {
+         strcpy(path, buses[b].path);
+         rtn = 0;
+      }
 
    done:
-   if(dir && closedir(dir)) rtn = sysdiag("closedir", "can't close %s", DEVDIR);
-   if(rtn && fd >= 0) {
-      if(close(fd)) sysdiag("close", "can't close I2C device");
-      fd = -1;
+   for(i = 0; i < n; i++) free(ents[i]);
+   free(ents);
+   free(buses);
+   return rtn;
+}
+
+/*** i2c_open() -- find and open an I2C device
+
+This function attempts to find a device of the given type (registering
+the type first, if it isn't already) connected to any one of the
+available busses: the one the state file says it was on last time, if
+it's still there, or else the first one a search of all of them finds it
+on. (If there are several busses with one connected, which gets used
+depends on the bus names. But why would that situation exist?)
+
+On success, returns an open file descriptor ready for communication with
+the specified device. The caller must close()(2) this descriptor when it
+is no longer needed.
+
+On failure, returns a negative value.
+***/
+int i2c_open(const i2c_devtype_t * const type) {
+   char path[PATH_MAX];
+   int fd;
+
+   if(i2c_register(type)) return -1;
+
+   if(!cache_get(type, path) && is_bus(path) &&
+    (fd = try_dev(path, type, 1)) >= 0) {
+      diag("%s found at %02x on %s, as last time", type->name, type->addr,
+       path);
+      return fd;
    }
-   return fd;
+
+   if(scan(type, path))
+      return diag("no %s found with address %02x", type->name, type->addr);
+   return try_dev(path, type, 0);
+}
+
+/*** smbus() -- perform one SMBus operation on the current slave
+
+Does what the i2c_smbus_*() helpers from <linux/i2c-dev.h> do, but
+through i2c_backend. (Newer versions of that header no longer have the
+helpers; they moved to libi2c.)
+
+Arguments are as for the I2C_SMBUS ioctl: read_write is I2C_SMBUS_READ or
+I2C_SMBUS_WRITE, cmd the command (register) byte, size one of the
+I2C_SMBUS_* transaction types and data the value, if any.
+
+Returns 0 on success, or a negative value on failure (with errno set).
+***/
+static int smbus(const int fd, const uint8_t read_write, const uint8_t cmd,
+ const int size, union i2c_smbus_data * const data) {
+   struct i2c_smbus_ioctl_data args;
+
+   args.read_write = read_write;
+   args.command = cmd;
+   args.size = size;
+   args.data = data;
+   COUNT();
+   return i2c_backend->ioctl(fd, I2C_SMBUS, &args);
+}
+
+/*** i2c_reg_read() -- read one register of the current slave
+
+Returns the register value, or a negative value on failure.
+***/
+int i2c_reg_read(const int fd, const uint8_t reg) {
+   union i2c_smbus_data data;
+
+   if(smbus(fd, I2C_SMBUS_READ, reg, I2C_SMBUS_BYTE_DATA, &data)) return -1;
+   return data.byte;
+}
+
+/*** i2c_reg_write() -- write one register of the current slave
+
+Returns 0 on success, or a negative value on failure.
+***/
+int i2c_reg_write(const int fd, const uint8_t reg, const uint8_t val) {
+   union i2c_smbus_data data;
+
+   data.byte = val;
+   return smbus(fd, I2C_SMBUS_WRITE, reg, I2C_SMBUS_BYTE_DATA, &data);
+}
+
+/*** i2c_ptr_write() -- set the register pointer of the current slave
+
+Writes the single byte reg, which devices like the HMC5883L take as the
+register the next read starts at.
+
+Returns 0 on success, or a negative value on failure.
+***/
+int i2c_ptr_write(const int fd, const uint8_t reg) {
+   return smbus(fd, I2C_SMBUS_WRITE, reg, I2C_SMBUS_BYTE, NULL);
+}
+
+/*** i2c_read() -- plain read from the current slave, as read()(2) ***/
+ssize_t i2c_read(const int fd, void * const buf, const size_t len) {
+   COUNT();
+   return i2c_backend->read(fd, buf, len);
+}
+
+/*** i2c_rdwr() -- perform a combined transaction
+
+Sends the n messages in msgs as one transaction, with a repeated start
+between messages and a single stop at the end, using the I2C_RDWR ioctl.
+Each message carries its own slave address; the current slave is not
+used. The reads fill in their buffers.
+
+This is one system call however many messages there are, where doing the
+same thing with the SMBus calls or read()/write() takes one per message.
+
+Returns 0 on success, or a negative value on failure (with errno set).
+***/
+int i2c_rdwr(const int fd, struct i2c_msg * const msgs, const int n) {
+   struct i2c_rdwr_ioctl_data data;
+
+   TSTA(!msgs); TSTA(n < 1); TSTA(n > I2C_RDWR_IOCTL_MAX_MSGS);
+   data.msgs = msgs;
+   data.nmsgs = n;
+   COUNT();
+   return i2c_backend->ioctl(fd, I2C_RDWR, &data) == n ? 0 : -1;
 }
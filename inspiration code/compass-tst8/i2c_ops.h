@@ -3,7 +3,53 @@
 #ifndef I2C_OPS_H
 #define I2C_OPS_H
 
-int i2c_find(const uint8_t addr, const char * const devname,
- int(*callback)(const int fd));
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/i2c.h>
+
+/* Everything done to an open bus goes through an i2c_backend_t. Normally
+   that's i2c_dev_backend, the kernel's i2c-dev driver; fake_i2c.c has one
+   that simulates the sensor in user space, for trying things out without
+   hardware. Each member behaves like the system call it's named after. */
+typedef struct {
+   int (*ioctl)(const int fd, const unsigned long req, void * const arg);
+   ssize_t (*read)(const int fd, void * const buf, const size_t len);
+} i2c_backend_t;
+
+extern const i2c_backend_t i2c_dev_backend;
+extern const i2c_backend_t *i2c_backend;
+
+/* Number of calls made through i2c_backend; each one is a system call
+   when it's the real bus. */
+extern unsigned long i2c_syscalls;
+
+/* A kind of device for i2c_open() to look for: chk is called with a
+   descriptor set up to talk to addr, and returns 0 IFF the device there is
+   this kind (see try_dev() in i2c_ops.c). */
+typedef struct {
+   const char *name; /* human-readable, typically a part number */
+   uint8_t addr;     /* unshifted */
+   int (*chk)(const int fd);
+} i2c_devtype_t;
+
+/* Where the state file is, unless i2c_cache says otherwise: somewhere
+   only root can write, not a world-writable directory like /var/tmp. For
+   anyone else, the default is I2C_USER_CACHE under $HOME instead. */
+#define I2C_CACHE "/var/cache/compass-read.i2c"
+#define I2C_USER_CACHE ".cache/compass-read.i2c"
+
+/* The directory the i2c-* bus nodes are in, normally /dev; and the state
+   file that remembers which bus each device type was found on, or NULL
+   for none. */
+extern const char *i2c_dev_dir;
+extern const char *i2c_cache;
+
+int i2c_register(const i2c_devtype_t * const type);
+int i2c_open(const i2c_devtype_t * const type);
+int i2c_reg_read(const int fd, const uint8_t reg);
+int i2c_reg_write(const int fd, const uint8_t reg, const uint8_t val);
+int i2c_ptr_write(const int fd, const uint8_t reg);
+ssize_t i2c_read(const int fd, void * const buf, const size_t len);
+int i2c_rdwr(const int fd, struct i2c_msg * const msgs, const int n);
 
 #endif /* ifndef I2C_OPS_H */
@@ -7,14 +7,64 @@
 #include <math.h>
 #include "diag.h"
 #include "debug.h"
+#include "i2c_ops.h"
 #include "hmc5883l.h"
+#include "fake_i2c.h"
 #include "calibrate.h"
 #include "heading.h"
 
-int main(void) {
+/*** report() -- take n readings and print what they cost ***/
+static int report(hmc5883l_state_t * const state, const long n) {
+   hmc5883l_pos_t pos;
+   long i;
+
+   for(i = 0; i < n; i++)
+      if(hmc5883l_read(state, &pos)) return -1;
+
+   printf("%s: %lu readings\n", state->mode == HMC5883L_RDWR ?
+    "I2C_RDWR, status polling" : "SMBus, fixed sleep", state->stats.reads);
+   printf("   system calls: %.2f per reading\n",
+    (double)state->stats.syscalls / state->stats.reads);
+   if(state->mode == HMC5883L_RDWR)
+      printf("   status polls: %.2f per reading\n",
+       (double)state->stats.polls / state->stats.reads);
+   printf("   latency:      %.3f ms mean, %.3f ms max\n",
+    state->stats.lat_sum * 1e3 / state->stats.reads,
+    state->stats.lat_max * 1e3);
+   return 0;
+}
+
+static void usage(const char * const name) {
+   fprintf(stderr, "usage: %s [-f] [-r] [-n count] [-D dir] [-C file]\n"
+    "   -f        use a simulated sensor instead of the I2C bus\n"
+    "   -r        use combined I2C_RDWR transactions and status polling\n"
+    "   -n count  take count readings, report their cost and exit\n"
+    "   -D dir    look for I2C buses in dir instead of /dev; with -f,\n"
+    "             they are mock buses (see fake_i2c.c)\n"
+    "   -C file   remember where the sensor was in file instead of\n"
+    "             %s\n"
+    "             (~/%s if not root; \"\" for nowhere)\n",
+    name, I2C_CACHE, I2C_USER_CACHE);
+}
+
+int main(int argc, char * const argv[]) {
    hmc5883l_state_t state;
    hmc5883l_pos_t pos;
    calibration_t calib;
+   int opt, fake = 0, mock = 0;
+   long count = 0;
+
+   state.mode = HMC5883L_SMBUS;
+   while((opt = getopt(argc, argv, "frn:D:C:")) != -1) {
+      switch(opt) {
+         case 'f': fake = 1; break;
+         case 'r': state.mode = HMC5883L_RDWR; break;
+         case 'D': i2c_dev_dir = optarg; mock = 1; break;
+         case 'C': i2c_cache = *optarg ? optarg : NULL; break;
+         case 'n': if((count = atol(optarg)) > 0) break; /* else... */
+         default: usage(argv[0]); return -1;
+      }
+   }
 
    diag("Initializing... please hold still.");
 
@@ -23,9 +73,13 @@ int main(void) {
    //state.cfg.gain = GAIN_1370;
    state.cfg.bias = BIAS_NONE;
    state.cfg.gain = GAIN_1090;
-   if((state.fd = hmc5883l_open()) < 0) return -1;
+   if(fake && mock) fake_i2c_mock();
+   state.fd = fake && !mock ? fake_i2c_open(HMC5883L_ADDR) : hmc5883l_open();
+   if(state.fd < 0) return -1;
    if(hmc5883l_config(&state)) return -1;
 
+   if(count) return report(&state, count);
+
    /* Get calibration data: */
    calibrate(&state, &calib);
 
@@ -0,0 +1,225 @@
+#ifndef MAG5883_H
+#define MAG5883_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <EEPROM.h>
+
+/*
+ * Driver for the two magnetometers GY-273 boards come with: the Honeywell
+ * HMC5883L and the QST QMC5883L. They do the same job with different
+ * addresses, register maps, axis orders, byte orders and gain settings.
+ *
+ * Mag<CHIP, GAIN, ORDER> is the driver for one of them, with everything
+ * that differs as template arguments: CHIP is the register map (Hmc5883l or
+ * Qmc5883l, below), GAIN the chip's own gain or range code and ORDER the
+ * word each axis is in (the chip's own order unless the board is wired
+ * differently). All of it is known at compile time, so read() is a single
+ * I2C read and straight-line code to pick the bytes apart, with no tests of
+ * which chip it is.
+ *
+ * Which chip the board has is found out at run time by begin(), which
+ * probes for both the first time and keeps the answer in one byte of
+ * EEPROM. After that, startup only talks to the chip it found last time; if
+ * that one doesn't answer (the board was swapped), it probes again.
+ */
+
+namespace mag5883 {
+
+//Which chip there is, as kept in EEPROM (0xFF is erased EEPROM)
+enum Chip : uint8_t { NONE = 0xFF, HMC = 'H', QMC = 'Q' };
+
+//Where each axis is in the data registers, counted in 16-bit words
+template <uint8_t X, uint8_t Y, uint8_t Z> struct Axes {
+  static const uint8_t x = X, y = Y, z = Z;
+};
+
+//Write val to register reg; true if the chip answered
+inline bool writeReg(uint8_t addr, uint8_t reg, uint8_t val){
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  Wire.write(val);
+  return Wire.endTransmission() == 0;
+}
+
+//Read len bytes from reg on into buf; true if they all came
+inline bool readRegs(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len){
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  if (Wire.endTransmission() != 0 || Wire.requestFrom(addr, len) != len){
+    return false;
+  }
+  while (len--){
+    *buf++ = Wire.read();
+  }
+  return true;
+}
+
+struct Hmc5883l {
+  static const Chip chip = HMC;
+  static const uint8_t addr = 0x1E;
+  static const uint8_t dataReg = 0x03; //X MSB, X LSB, Z MSB, ... Y LSB
+  //After register 8 the chip rolls the pointer back to 3 by itself, so
+  //each sample is the six data bytes and nothing else
+  static const uint8_t readLen = 6;
+  static const bool bigEndian = true;
+  typedef Axes<0, 2, 1> Order;
+  static const uint8_t maxGain = 7; //+/-0.88 to +/-8.1 Ga
+  static const uint8_t defaultGain = 1; //+/-1.3 Ga, 1090 LSb/Ga
+  static const uint8_t drdyMode = FALLING; //DRDY pulses low for 250us
+  static const uint32_t periodUs = 33333; //30 Hz, as set by configure()
+
+  static bool probe(){ //identification registers 10..12 read "H43"
+    uint8_t id[3];
+    return readRegs(addr, 0x0A, id, 3) &&
+           id[0] == 'H' && id[1] == '4' && id[2] == '3';
+  }
+
+  static bool configure(uint8_t gain){
+    //8-sample average, 30 Hz, normal measurement; gain; continuous mode
+    return writeReg(addr, 0x00, B01110100) &&
+           writeReg(addr, 0x01, gain << 5) &&
+           writeReg(addr, 0x02, 0x00);
+  }
+};
+
+struct Qmc5883l {
+  static const Chip chip = QMC;
+  static const uint8_t addr = 0x0D;
+  static const uint8_t dataReg = 0x00; //X LSB, X MSB, Y LSB, ... Z MSB
+  //With pointer roll-over on, the chip goes back to 0 after the status
+  //register (6), so the status comes along with each sample
+  static const uint8_t readLen = 7;
+  static const bool bigEndian = false;
+  typedef Axes<0, 1, 2> Order;
+  static const uint8_t maxGain = 1; //+/-2 or +/-8 G
+  static const uint8_t defaultGain = 0; //+/-2 G, 12000 LSb/G
+  static const uint8_t drdyMode = RISING; //DRDY high until the data is read
+  static const uint32_t periodUs = 20000; //50 Hz, as set by configure()
+
+  static bool probe(){ //chip ID register 13 reads 0xFF
+    uint8_t id;
+    return readRegs(addr, 0x0D, &id, 1) && id == 0xFF;
+  }
+
+  static bool configure(uint8_t range){
+    //Set/reset period as the data sheet recommends; pointer roll-over on,
+    //DRDY pin on; 512x oversampling, range, 50 Hz, continuous mode
+    return writeReg(addr, 0x0B, 0x01) &&
+           writeReg(addr, 0x0A, B01000000) &&
+           writeReg(addr, 0x09, range << 4 | B00000101);
+  }
+};
+
+template <class CHIP, uint8_t GAIN = CHIP::defaultGain,
+          class ORDER = typename CHIP::Order>
+class Mag {
+  static_assert(GAIN <= CHIP::maxGain, "no such gain setting");
+  static_assert(ORDER::x < 3 && ORDER::y < 3 && ORDER::z < 3 &&
+                ORDER::x != ORDER::y && ORDER::y != ORDER::z &&
+                ORDER::x != ORDER::z, "each axis in a different word");
+
+  //Point the chip's register pointer at the data
+  static bool park(){
+    Wire.beginTransmission(CHIP::addr);
+    Wire.write(CHIP::dataReg);
+    return Wire.endTransmission() == 0;
+  }
+
+  static int axis(const uint8_t *b, uint8_t word){
+    return CHIP::bigEndian ? (int16_t)(b[2*word] << 8 | b[2*word + 1]) :
+                             (int16_t)(b[2*word + 1] << 8 | b[2*word]);
+  }
+
+public:
+  typedef CHIP Chip;
+
+  //Set the chip up and leave the pointer on the data. False if it isn't
+  //there.
+  static bool begin(){
+    return CHIP::configure(GAIN) && park();
+  }
+
+  //Read one sample. Returns false, leaving x, y and z alone, if the read
+  //fails.
+  static bool read(int *x, int *y, int *z){
+    uint8_t b[CHIP::readLen];
+
+    if (Wire.requestFrom(CHIP::addr, CHIP::readLen) != CHIP::readLen){
+      //A short read leaves the pointer part way round; put it back
+      while (Wire.available()){
+        Wire.read();
+      }
+      park();
+      return false;
+    }
+    for (uint8_t i = 0; i < CHIP::readLen; i++){
+      b[i] = Wire.read();
+    }
+    *x = axis(b, ORDER::x);
+    *y = axis(b, ORDER::y);
+    *z = axis(b, ORDER::z);
+    return true;
+  }
+};
+
+//What begin() found: the chip, and how to drive it
+struct Driver {
+  Chip chip;
+  bool (*read)(int *x, int *y, int *z); //one sample, as Mag<...>::read()
+  uint8_t drdyMode; //attachInterrupt() mode for the chip's DRDY pin
+  uint32_t periodUs; //time between samples
+};
+
+namespace detail {
+
+inline bool noRead(int *, int *, int *){
+  return false;
+}
+
+template <class M> bool start(Driver *d){
+  if (!M::begin()){
+    return false;
+  }
+  d->chip = M::Chip::chip;
+  d->read = M::read;
+  d->drdyMode = M::Chip::drdyMode;
+  d->periodUs = M::Chip::periodUs;
+  return true;
+}
+
+template <class H, class Q> bool start(Chip c, Driver *d){
+  return c == H::Chip::chip ? start<H>(d) :
+         c == Q::Chip::chip ? start<Q>(d) : false;
+}
+
+template <class H, class Q> Chip probe(){
+  return H::Chip::probe() ? H::Chip::chip :
+         Q::Chip::probe() ? Q::Chip::chip : NONE;
+}
+
+}
+
+//Find the magnetometer and set it up, with H as the driver to use for an
+//HMC5883L and Q for a QMC5883L (Mag<...> types). The chip found is kept in
+//EEPROM at eepromAddr. Wire.begin() has to have been called. If there is
+//no magnetometer, the Driver has chip NONE and a read() that always fails.
+template <class H, class Q> Driver begin(int eepromAddr){
+  static_assert(H::Chip::chip == HMC && Q::Chip::chip == QMC,
+                "H drives the HMC5883L, Q the QMC5883L");
+  Driver d = { NONE, detail::noRead, 0, 0 };
+  Chip c = (Chip)EEPROM.read(eepromAddr);
+
+  if (detail::start<H, Q>(c, &d)){
+    return d; //the usual case: no probing
+  }
+  c = detail::probe<H, Q>();
+  if (detail::start<H, Q>(c, &d)){
+    EEPROM.update(eepromAddr, c);
+  }
+  return d;
+}
+
+}
+
+#endif
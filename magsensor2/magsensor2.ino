@@ -30,11 +30,13 @@
  ***************************************************************************/
 
 #include <Wire.h>
-#include <Adafruit_Sensor.h>
-#include <Adafruit_HMC5883_U.h>
+#include <EEPROM.h>
+#include "mag5883.h"
+#include "sector.h"
 
-/* Assign a unique ID to this sensor at the same time */
-Adafruit_HMC5883_Unified mag = Adafruit_HMC5883_Unified(12345);
+/* HMC5883L or QMC5883L, whichever the board has; the answer is kept in
+   EEPROM byte 0 so later startups don't have to look */
+mag5883::Driver mag;
 
 int Npin = 5;
 int NEpin = 6;
@@ -45,19 +47,19 @@ int SWpin = 11;
 int Wpin = 10;
 int NWpin = 9;
 int pinArray[] = {Npin, NEpin, Epin, SEpin, Spin, SWpin, Wpin, NWpin};
-int numberOfPins = sizeof(pinArray)/sizeof(int);
-float degreesPerPin = 360/(float)numberOfPins;
+const int numberOfPins = sizeof(pinArray)/sizeof(int);
+int pinIndex = 0;
+
+//Motor for each heading (in brads, 65536 to the circle), with 2 degrees
+//(364 brads) of hysteresis; the table is built at compile time.
+typedef SectorMap<numberOfPins, 364> MotorMap;
+
 void displaySensorDetails(void)
 {
-  sensor_t sensor;
-  mag.getSensor(&sensor);
   Serial.println("------------------------------------");
-  Serial.print  ("Sensor:       "); Serial.println(sensor.name);
-  Serial.print  ("Driver Ver:   "); Serial.println(sensor.version);
-  Serial.print  ("Unique ID:    "); Serial.println(sensor.sensor_id);
-  Serial.print  ("Max Value:    "); Serial.print(sensor.max_value); Serial.println(" uT");
-  Serial.print  ("Min Value:    "); Serial.print(sensor.min_value); Serial.println(" uT");
-  Serial.print  ("Resolution:   "); Serial.print(sensor.resolution); Serial.println(" uT");  
+  Serial.print  ("Sensor:       ");
+  Serial.println(mag.chip == mag5883::HMC ? "HMC5883L" : "QMC5883L");
+  Serial.print  ("Sample every: "); Serial.print(mag.periodUs); Serial.println(" us");
   Serial.println("------------------------------------");
   Serial.println("");
   delay(500);
@@ -69,10 +71,13 @@ void setup(void)
   Serial.println("HMC5883 Magnetometer Test"); Serial.println("");
   
   /* Initialise the sensor */
-  if(!mag.begin())
+  Wire.begin();
+  mag = mag5883::begin<mag5883::Mag<mag5883::Hmc5883l>,
+                       mag5883::Mag<mag5883::Qmc5883l> >(0);
+  if(mag.chip == mag5883::NONE)
   {
-    /* There was a problem detecting the HMC5883 ... check your connections */
-    Serial.println("Ooops, no HMC5883 detected ... Check your wiring!");
+    /* There was a problem detecting the magnetometer ... check your connections */
+    Serial.println("Ooops, no HMC5883L or QMC5883L detected ... Check your wiring!");
     while(1);
   }
 
@@ -93,31 +98,26 @@ void turnOffAllPins(){
     }
 }
 
-int headingToIndex(float heading){
-  heading += degreesPerPin/2; //rotate to get clean breaks
-  if (heading >= 360) {
-    return 0; //
-  }
-  else {
-    return (int)heading/degreesPerPin;
-  }
+int headingToIndex(uint16_t heading, int prevIndex){
+  return MotorMap::lookup(heading, prevIndex);
 }
 
 
 void loop(void) 
 {
-  /* Get a new sensor event */ 
-  sensors_event_t event; 
-  mag.getEvent(&event);
+  /* Get a new sample (raw counts; all three axes have the same gain) */ 
+  int x, y, z;
+  if(!mag.read(&x, &y, &z))
+    return;
  
-  /* Display the results (magnetic vector values are in micro-Tesla (uT)) */
-  //Serial.print("X: "); Serial.print(event.magnetic.x); Serial.print("  ");
-  //Serial.print("Y: "); Serial.print(event.magnetic.y); Serial.print("  ");
-  //Serial.print("Z: "); Serial.print(event.magnetic.z); Serial.print("  ");Serial.println("uT");
+  /* Display the results */
+  //Serial.print("X: "); Serial.print(x); Serial.print("  ");
+  //Serial.print("Y: "); Serial.print(y); Serial.print("  ");
+  //Serial.print("Z: "); Serial.print(z); Serial.println("  ");
 
   // Hold the module so that Z is pointing 'up' and you can measure the heading with x&y
   // Calculate heading when the magnetometer is level, then correct for signs of axis.
-  float heading = atan2(event.magnetic.z, event.magnetic.x);
+  float heading = atan2((float)z, (float)x);
   
   // Once you have your heading, you must then add your 'Declination Angle', which is the 'Error' of the magnetic field in your location.
   // Find yours here: http://www.magnetic-declination.com/
@@ -140,7 +140,7 @@ void loop(void)
   
  
   turnOffAllPins();
-  int pinIndex = headingToIndex(headingDegrees);
+  pinIndex = headingToIndex((long)(heading * (32768/PI)), pinIndex);
   digitalWrite(pinArray[pinIndex], HIGH);
   Serial.print(pinIndex); Serial.print("\t"); Serial.println(headingDegrees);
   delay(50);